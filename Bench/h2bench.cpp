@@ -0,0 +1,491 @@
+// h2bench: an HTTP/2 load generator built on the server's own frame, settings and HPACK code.
+//
+//   bin/h2bench [-c connections] [-n streams] [-d seconds] [-r requests] [-k requests per connection]
+//               [-H host] [-p port] [-w webroot] [-P] [-s] [-j] [url...]
+//
+// -s resumes the TLS session of the previous connection on each reconnect, like a returning client.
+// -P speaks cleartext HTTP/2 with prior knowledge (h2c), for a server started with H2C_PORT.
+// Every connection runs on its own thread and keeps n streams in flight. Without urls the mix is
+// "/" plus every file below the webroot (html/), requested as /html/<path> the way main binds it.
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <csignal>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "http2/protocol/frame.h"
+#include "http2/protocol/settings.h"
+#include "http2/protocol/hpack/hpack.h"
+
+#define H2BENCH_READ_SIZE 65536
+#define H2BENCH_WINDOW 2147483647   // largest flow control window, responses are never held back
+#define H2BENCH_DRAIN_SECONDS 5     // how long responses still in flight may take after the deadline
+
+namespace protocol = http2::protocol;
+namespace fs = std::filesystem;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int connections = 8;
+    int streams = 16;
+    double seconds = 10;
+    uint64_t requests = 0;      // 0 runs for the whole duration
+    uint64_t perConnection = 0; // 0 keeps each connection open for the whole run
+    std::string webroot = "html";
+    bool json = false;
+    bool cleartext = false; // h2c with prior knowledge instead of TLS
+    bool resume = false;    // offer the previous connection's session when reconnecting
+    std::vector<std::string> urls;
+};
+
+struct Results {
+    std::vector<int64_t> latencies; // ns from HEADERS sent to END_STREAM received
+    std::vector<int64_t> handshakes; // ns from connect() to the negotiated h2 handshake
+    uint64_t handshakeFailures = 0;
+    uint64_t resumed = 0; // handshakes the server accepted the offered session for
+    uint64_t responses = 0;
+    uint64_t errors = 0; // reset or abandoned streams, 5xx responses
+    uint64_t bodyBytes = 0;
+    uint64_t statuses[6] = {}; // by the first digit of :status
+
+    void merge(const Results& other) {
+        latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+        handshakes.insert(handshakes.end(), other.handshakes.begin(), other.handshakes.end());
+        handshakeFailures += other.handshakeFailures;
+        resumed += other.resumed;
+        responses += other.responses;
+        errors += other.errors;
+        bodyBytes += other.bodyBytes;
+        for (int i = 0; i < 6; ++i) statuses[i] += other.statuses[i];
+    }
+};
+
+static int64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Shared by every connection: the URL mix and the request budget.
+class Workload {
+private:
+    const Options& options;
+    std::atomic<uint64_t> issued{0};
+    int64_t deadlineNs;
+public:
+    Workload(const Options& options)
+        : options(options), deadlineNs(now() + (int64_t) (options.seconds * 1e9)) {}
+
+    bool done() const {
+        return now() >= deadlineNs || (options.requests && issued.load(std::memory_order_relaxed) >= options.requests);
+    }
+
+    // claims the next request, an empty string once the budget or the time is used up
+    std::string next() {
+        if (now() >= deadlineNs) return "";
+        uint64_t n = issued.fetch_add(1, std::memory_order_relaxed);
+        if (options.requests && n >= options.requests) return "";
+        return options.urls[n % options.urls.size()];
+    }
+};
+
+class BenchConnection {
+private:
+    struct InFlight {
+        int64_t startNs;
+        std::vector<uint8_t> headerBlock; // fragments until END_HEADERS
+        int status = 0;
+    };
+
+    const Options& options;
+    Workload& workload;
+    Results& results;
+
+    int fd = -1;
+    SSL* ssl = nullptr;
+    protocol::hpack::Encoder encoder;
+    protocol::hpack::Decoder decoder;
+    std::map<uint32_t, InFlight> inFlight;
+    uint32_t nextStreamId = 1;
+    uint64_t sent = 0;
+    uint64_t unacknowledged = 0; // DATA bytes not yet given back with a connection WINDOW_UPDATE
+    std::vector<uint8_t> out;
+    bool goaway = false;
+    uint32_t peerMaxStreams = ~uint32_t(0); // SETTINGS_MAX_CONCURRENT_STREAMS of the server
+
+    void queue(const protocol::Frame& frame) {
+        std::vector<uint8_t> encoded = frame.encode();
+        out.insert(out.end(), encoded.begin(), encoded.end());
+    }
+
+    void queueWindowUpdate(uint32_t streamId, uint32_t increment) {
+        queue(protocol::Frame(protocol::WINDOW_UPDATE_FRAME, protocol::NO_FLAGS, streamId, {
+            uint8_t(increment >> 24), uint8_t(increment >> 16), uint8_t(increment >> 8), uint8_t(increment)
+        }));
+    }
+
+    bool flush() {
+        size_t at = 0;
+        while (at < out.size()) {
+            int n = ssl ? SSL_write(ssl, out.data() + at, out.size() - at)
+                        : (int) send(fd, out.data() + at, out.size() - at, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            at += n;
+        }
+        out.clear();
+        return true;
+    }
+
+    bool startStream(const std::string& url) {
+        http2::headers::Headers headers;
+        headers.add(":method", "GET");
+        headers.add(":scheme", "https");
+        headers.add(":authority", options.host + ":" + std::to_string(options.port));
+        headers.add(":path", url);
+        headers.add("user-agent", "h2bench");
+        headers.add("accept", "*/*");
+        headers.add("accept-encoding", "gzip, br");
+
+        protocol::Frame frame(protocol::HEADERS_FRAME, protocol::END_HEADERS | protocol::END_STREAM, nextStreamId);
+        encoder.encode_all(headers.all(), frame.mutable_payload());
+        queue(frame);
+
+        inFlight[nextStreamId] = InFlight{now()};
+        nextStreamId += 2;
+        sent++;
+        return true;
+    }
+
+    void finishStream(uint32_t streamId, bool failed) {
+        auto it = inFlight.find(streamId);
+        if (it == inFlight.end()) return;
+
+        int status = it->second.status;
+        if (failed || status >= 500) results.errors++;
+        if (!failed) {
+            results.responses++;
+            results.latencies.push_back(now() - it->second.startNs);
+            if (status >= 100 && status < 600) results.statuses[status / 100]++;
+        }
+        inFlight.erase(it);
+    }
+
+    bool handleFrame(const protocol::Frame& frame) {
+        uint32_t sid = frame.stream_id();
+        switch (frame.type()) {
+            case protocol::SETTINGS_FRAME:
+                if (!frame.has_flag(protocol::ACK)) {
+                    protocol::Settings settings;
+                    if (settings.decode(frame.payload()) == protocol::NO_ERROR) {
+                        peerMaxStreams = settings.max_concurrent_streams();
+                    }
+                    queue(protocol::Frame(protocol::SETTINGS_FRAME, protocol::ACK, 0));
+                }
+                break;
+            case protocol::PING_FRAME:
+                if (!frame.has_flag(protocol::ACK)) {
+                    protocol::Frame pong(protocol::PING_FRAME, protocol::ACK, 0);
+                    pong.mutable_payload() = frame.payload();
+                    queue(pong);
+                }
+                break;
+            case protocol::HEADERS_FRAME:
+            case protocol::CONTINUATION_FRAME: {
+                auto it = inFlight.find(sid);
+                if (it == inFlight.end()) break;
+                std::vector<uint8_t>& block = it->second.headerBlock;
+                block.insert(block.end(), frame.payload().begin(), frame.payload().end());
+                if (frame.has_flag(protocol::END_HEADERS)) {
+                    // the table has to see every block to stay in step with the server's encoder
+                    std::vector<protocol::hpack::Header> headers;
+                    if (!decoder.decode(block, headers)) return false;
+                    for (const auto& header : headers) {
+                        if (header.name == ":status") it->second.status = std::atoi(header.value.c_str());
+                    }
+                    block.clear();
+                }
+                if (frame.has_flag(protocol::END_STREAM)) finishStream(sid, false);
+                break;
+            }
+            case protocol::DATA_FRAME:
+                results.bodyBytes += frame.payload().size();
+                unacknowledged += frame.payload().size();
+                if (unacknowledged > H2BENCH_WINDOW / 2) {
+                    queueWindowUpdate(0, unacknowledged);
+                    unacknowledged = 0;
+                }
+                if (frame.has_flag(protocol::END_STREAM)) finishStream(sid, false);
+                break;
+            case protocol::RST_STREAM_FRAME:
+                finishStream(sid, true);
+                break;
+            case protocol::GOAWAY_FRAME:
+                goaway = true;
+                break;
+            default:
+                break;
+        }
+        return true;
+    }
+
+public:
+    BenchConnection(const Options& options, Workload& workload, Results& results)
+        : options(options), workload(workload), results(results) {}
+
+    ~BenchConnection() {
+        if (ssl) {
+            // without close_notify OpenSSL marks the session as not resumable
+            SSL_shutdown(ssl);
+            SSL_free(ssl);
+        }
+        if (fd >= 0) close(fd);
+    }
+
+    bool open(SSL_CTX* ctx, SSL_SESSION* session) {
+        int64_t startNs = now();
+
+        struct addrinfo hints = {}, *addrs = nullptr;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &addrs) != 0) return false;
+        for (struct addrinfo* a = addrs; a && fd < 0; a = a->ai_next) {
+            fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addrs);
+        if (fd < 0) return false;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct timeval timeout = {H2BENCH_DRAIN_SECONDS, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        if (!options.cleartext) {
+            ssl = SSL_new(ctx);
+            SSL_set_fd(ssl, fd);
+            SSL_set_tlsext_host_name(ssl, options.host.c_str());
+            if (session) SSL_set_session(ssl, session);
+            if (SSL_connect(ssl) <= 0) return false;
+            if (SSL_session_reused(ssl)) results.resumed++;
+
+            const unsigned char* alpn = nullptr;
+            unsigned int alpnLen = 0;
+            SSL_get0_alpn_selected(ssl, &alpn, &alpnLen);
+            if (alpnLen != 2 || memcmp(alpn, "h2", 2) != 0) return false;
+        }
+
+        results.handshakes.push_back(now() - startNs);
+
+        static const std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        out.insert(out.end(), preface.begin(), preface.end());
+
+        protocol::Settings settings;
+        settings.set_enable_push(false);
+        settings.set_initial_window_size(H2BENCH_WINDOW);
+        protocol::Frame settingsFrame(protocol::SETTINGS_FRAME, protocol::NO_FLAGS, 0);
+        settings.encode(settingsFrame.mutable_payload());
+        queue(settingsFrame);
+        queueWindowUpdate(0, H2BENCH_WINDOW - 65535);
+        return flush();
+    }
+
+    // with TLS 1.3 the ticket arrives after the handshake, so this is only worth asking once run() is over
+    SSL_SESSION* session() const {
+        return ssl ? SSL_get1_session(ssl) : nullptr;
+    }
+
+    // runs requests until the workload or the per connection budget is used up
+    void run() {
+        std::vector<uint8_t> buffer;
+        size_t pending = 0;
+
+        while (true) {
+            while (!goaway && (int) inFlight.size() < options.streams && inFlight.size() < peerMaxStreams &&
+                   (!options.perConnection || sent < options.perConnection)) {
+                std::string url = workload.next();
+                if (url.empty()) break;
+                startStream(url);
+            }
+            if (!flush()) break;
+            if (inFlight.empty()) return;
+
+            buffer.resize(pending + H2BENCH_READ_SIZE);
+            int n = ssl ? SSL_read(ssl, buffer.data() + pending, H2BENCH_READ_SIZE)
+                        : (int) recv(fd, buffer.data() + pending, H2BENCH_READ_SIZE, 0);
+            if (n <= 0) break;
+
+            size_t available = pending + n, consumed = 0;
+            std::vector<protocol::Frame> frames = protocol::Frame::toFrames(
+                buffer.data(), buffer.data() + available, consumed);
+            std::copy(buffer.begin() + consumed, buffer.begin() + available, buffer.begin());
+            pending = available - consumed;
+
+            for (const auto& frame : frames) {
+                if (!handleFrame(frame)) {
+                    fprintf(stderr, "h2bench: failed to decode response headers\n");
+                    goto abandon;
+                }
+            }
+            if (goaway && inFlight.empty()) return;
+        }
+
+    abandon:
+        // the connection failed or timed out, whatever is still in flight never completed
+        while (!inFlight.empty()) finishStream(inFlight.begin()->first, true);
+    }
+};
+
+static std::vector<std::string> defaultUrls(const std::string& webroot) {
+    std::vector<std::string> urls = {"/"};
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(webroot, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (it->is_regular_file()) {
+            urls.push_back("/html/" + fs::relative(it->path(), webroot).generic_string());
+        }
+    }
+    std::sort(urls.begin() + 1, urls.end());
+    return urls;
+}
+
+static double percentile(const std::vector<int64_t>& sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = std::min(sorted.size() - 1, (size_t) (q * sorted.size()));
+    return sorted[i] / 1e6;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: h2bench [-c connections] [-n streams] [-d seconds] [-r requests] "
+                    "[-k requests per connection] [-H host] [-p port] [-w webroot] [-P] [-s] [-j] [url...]\n");
+    exit(2);
+}
+
+static Options parseOptions(int argc, char** argv) {
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:d:r:k:H:p:w:Psj")) != -1) {
+        switch (opt) {
+            case 'c': options.connections = std::max(1, atoi(optarg)); break;
+            case 'n': options.streams = std::max(1, atoi(optarg)); break;
+            case 'd': options.seconds = atof(optarg); break;
+            case 'r': options.requests = strtoull(optarg, nullptr, 10); break;
+            case 'k': options.perConnection = strtoull(optarg, nullptr, 10); break;
+            case 'H': options.host = optarg; break;
+            case 'p': options.port = atoi(optarg); break;
+            case 'w': options.webroot = optarg; break;
+            case 'P': options.cleartext = true; break;
+            case 's': options.resume = true; break;
+            case 'j': options.json = true; break;
+            default: usage();
+        }
+    }
+    for (int i = optind; i < argc; ++i) options.urls.push_back(argv[i]);
+    if (options.urls.empty()) options.urls = defaultUrls(options.webroot);
+    return options;
+}
+
+int main(int argc, char** argv) {
+    Options options = parseOptions(argc, argv);
+    // a server that refuses or sheds the connection must fail the write, not end the run
+    signal(SIGPIPE, SIG_IGN);
+
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    // the bundled certificate is self-signed, the run measures the server and not the PKI
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    static const unsigned char alpn[] = {2, 'h', '2'};
+    SSL_CTX_set_alpn_protos(ctx, alpn, sizeof(alpn));
+
+    Workload workload(options);
+    std::vector<Results> perThread(options.connections);
+    std::vector<std::thread> threads;
+    int64_t startNs = now();
+
+    for (int i = 0; i < options.connections; ++i) {
+        threads.emplace_back([&, i] {
+            Results& results = perThread[i];
+            SSL_SESSION* session = nullptr;
+            // a connection that is used up, failed or was sent away is replaced until the run ends
+            while (!workload.done()) {
+                BenchConnection conn(options, workload, results);
+                if (!conn.open(ctx, session)) {
+                    results.handshakeFailures++;
+                    ERR_clear_error();
+                    usleep(10000);
+                    continue;
+                }
+                conn.run();
+                if (options.resume) {
+                    SSL_SESSION_free(session);
+                    session = conn.session();
+                }
+            }
+            SSL_SESSION_free(session);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+
+    double elapsed = (now() - startNs) / 1e9;
+    Results total;
+    for (const auto& results : perThread) total.merge(results);
+    std::sort(total.latencies.begin(), total.latencies.end());
+
+    double handshakeMeanMs = 0;
+    for (int64_t ns : total.handshakes) handshakeMeanMs += ns / 1e6;
+    if (!total.handshakes.empty()) handshakeMeanMs /= total.handshakes.size();
+
+    double rps = total.responses / elapsed;
+    double mbps = total.bodyBytes / elapsed / 1e6;
+    double maxMs = total.latencies.empty() ? 0 : total.latencies.back() / 1e6;
+
+    if (options.json) {
+        printf("{\"connections\":%d,\"streams\":%d,\"seconds\":%.3f,\"requests\":%llu,\"errors\":%llu,"
+               "\"requests_per_sec\":%.1f,\"bytes\":%llu,\"mb_per_sec\":%.3f,"
+               "\"latency_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},"
+               "\"handshakes\":%zu,\"handshake_failures\":%llu,\"resumed_handshakes\":%llu,\"handshakes_per_sec\":%.1f,\"handshake_mean_ms\":%.3f,"
+               "\"status\":{\"1xx\":%llu,\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu}}\n",
+               options.connections, options.streams, elapsed,
+               (unsigned long long) total.responses, (unsigned long long) total.errors,
+               rps, (unsigned long long) total.bodyBytes, mbps,
+               percentile(total.latencies, 0.5), percentile(total.latencies, 0.99),
+               percentile(total.latencies, 0.999), maxMs,
+               total.handshakes.size(), (unsigned long long) total.handshakeFailures,
+               (unsigned long long) total.resumed, total.handshakes.size() / elapsed, handshakeMeanMs,
+               (unsigned long long) total.statuses[1], (unsigned long long) total.statuses[2],
+               (unsigned long long) total.statuses[3], (unsigned long long) total.statuses[4],
+               (unsigned long long) total.statuses[5]);
+    } else {
+        printf("%d connections x %d streams, %zu urls, %.2f s\n",
+               options.connections, options.streams, options.urls.size(), elapsed);
+        printf("requests:    %llu (%llu errors), 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu\n",
+               (unsigned long long) total.responses, (unsigned long long) total.errors,
+               (unsigned long long) total.statuses[2], (unsigned long long) total.statuses[3],
+               (unsigned long long) total.statuses[4], (unsigned long long) total.statuses[5]);
+        printf("throughput:  %.1f req/s, %.2f MB/s\n", rps, mbps);
+        printf("latency:     p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n",
+               percentile(total.latencies, 0.5), percentile(total.latencies, 0.99),
+               percentile(total.latencies, 0.999), maxMs);
+        printf("handshakes:  %zu (%llu failed, %llu resumed), %.1f/s, mean %.3f ms\n",
+               total.handshakes.size(), (unsigned long long) total.handshakeFailures,
+               (unsigned long long) total.resumed,
+               total.handshakes.size() / elapsed, handshakeMeanMs);
+    }
+
+    SSL_CTX_free(ctx);
+    return total.responses > 0 ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+"""End-to-end loopback benchmark: bin/server driven by bin/h2bench on this machine.
+
+    python3 Bench/loopback.py [profile ...] [--threads N] [--seconds S] [--save-baseline]
+
+Every run gets a scratch directory with a throwaway self-signed server.crt/server.key, a copy of
+html/ and generated fixtures. The server starts there on port 8080 with SERVER_THREADS set, and
+h2bench loads it with the chosen profile. Throughput, latency percentiles and the server's CPU
+time and RSS go to build/loopback/<profile>.json. Each run is compared against
+Bench/baselines/<profile>.json when that exists. --save-baseline stores the run as the new baseline.
+--cleartext runs the same profiles over h2c with prior knowledge, stored as <profile>-h2c.json.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SERVER = os.path.join(REPO, "bin", "server")
+H2BENCH = os.path.join(REPO, "bin", "h2bench")
+BASELINES = os.path.join(REPO, "Bench", "baselines")
+RESULTS = os.path.join(REPO, "build", "loopback")
+PORT = 8080
+H2C_PORT = 8081
+
+SMALL_FILES = 200
+LARGE_FILE_MB = 64
+
+# h2bench arguments and the URLs of each workload, "small" expands to the generated small files
+PROFILES = {
+    "small-files": {"args": ["-c", "8", "-n", "16"], "urls": "small"},
+    "large-file": {"args": ["-c", "4", "-n", "1"], "urls": ["/html/bench/large.bin"]},
+    "many-streams": {"args": ["-c", "2", "-n", "100"], "urls": "small"},
+    "connection-churn": {"args": ["-c", "16", "-n", "1", "-k", "1"], "urls": ["/html/file.png"]},
+    "connection-resume": {"args": ["-c", "16", "-n", "1", "-k", "1", "-s"], "urls": ["/html/file.png"]},
+}
+
+# metric path in the result, whether a higher value is better
+METRICS = [
+    (("client", "requests_per_sec"), True),
+    (("client", "mb_per_sec"), True),
+    (("client", "latency_ms", "p50"), False),
+    (("client", "latency_ms", "p99"), False),
+    (("client", "latency_ms", "p999"), False),
+    (("client", "handshakes_per_sec"), True),
+    (("server", "cpu_us_per_request"), False),
+    (("server", "rss_peak_kb"), False),
+]
+
+
+def prepare(workdir):
+    """Certificate, web root and fixtures the server is started on."""
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1",
+                    "-subj", "/CN=localhost", "-keyout", "server.key", "-out", "server.crt"],
+                   cwd=workdir, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    shutil.copytree(os.path.join(REPO, "html"), os.path.join(workdir, "html"))
+    shutil.copy(os.path.join(REPO, "push.manifest"), workdir)
+
+    small = os.path.join(workdir, "html", "bench", "small")
+    os.makedirs(small)
+    for i in range(SMALL_FILES):
+        # 1-4 KB of text, the size of a typical stylesheet or script
+        with open(os.path.join(small, "file%03d.txt" % i), "w") as f:
+            f.write(("line %d of a small benchmark file\n" % i) * (32 + i % 96))
+
+    with open(os.path.join(workdir, "html", "bench", "large.bin"), "wb") as f:
+        for _ in range(LARGE_FILE_MB):
+            f.write(os.urandom(1 << 20))
+
+    return ["/html/bench/small/file%03d.txt" % i for i in range(SMALL_FILES)]
+
+
+def port_open(port=PORT):
+    with socket.socket() as s:
+        return s.connect_ex(("127.0.0.1", port)) == 0
+
+
+class ServerProcess:
+    """bin/server in the scratch directory, with its CPU time and RSS sampled while it runs."""
+
+    def __init__(self, workdir, threads, cleartext):
+        env = dict(os.environ, SERVER_THREADS=str(threads), LOG_LEVEL="error")
+        port = PORT
+        if cleartext:
+            env.update(TLS_PORT="0", H2C_PORT=str(H2C_PORT))
+            port = H2C_PORT
+        self.proc = subprocess.Popen([SERVER], cwd=workdir, env=env,
+                                     stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        self.rss_peak = 0
+        self.sampling = True
+
+        deadline = time.time() + 10
+        while not port_open(port):
+            if self.proc.poll() is not None or time.time() > deadline:
+                raise RuntimeError("server did not start listening on port %d" % port)
+            time.sleep(0.05)
+
+        self.sampler = threading.Thread(target=self._sample_rss, daemon=True)
+        self.sampler.start()
+
+    def _sample_rss(self):
+        while self.sampling:
+            self.rss_peak = max(self.rss_peak, self.rss())
+            time.sleep(0.1)
+
+    def rss(self):
+        try:
+            with open("/proc/%d/status" % self.proc.pid) as f:
+                for line in f:
+                    if line.startswith("VmRSS:"):
+                        return int(line.split()[1])
+        except OSError:
+            pass
+        return 0
+
+    def cpu_seconds(self):
+        with open("/proc/%d/stat" % self.proc.pid) as f:
+            # the command name may contain spaces, the fields after it do not
+            fields = f.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+    def stop(self):
+        self.sampling = False
+        self.sampler.join()
+        self.proc.terminate()
+        try:
+            self.proc.wait(5)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            self.proc.wait()
+
+
+def run_profile(name, workdir, small_urls, threads, seconds, cleartext):
+    profile = PROFILES[name]
+    urls = small_urls if profile["urls"] == "small" else profile["urls"]
+    transport = ["-P", "-p", str(H2C_PORT)] if cleartext else []
+
+    server = ServerProcess(workdir, threads, cleartext)
+    try:
+        cpu_before = server.cpu_seconds()
+        started = time.time()
+        out = subprocess.run([H2BENCH, "-j", "-d", str(seconds)] + transport + profile["args"] + urls,
+                             cwd=workdir, check=True, capture_output=True, text=True).stdout
+        elapsed = time.time() - started
+        cpu = server.cpu_seconds() - cpu_before
+        rss_end = server.rss()
+    finally:
+        server.stop()
+
+    client = json.loads(out)
+    requests = max(client["requests"], 1)
+    return {
+        "profile": name,
+        "transport": "h2c" if cleartext else "tls",
+        "threads": threads,
+        "seconds": seconds,
+        "commit": subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=REPO,
+                                 capture_output=True, text=True).stdout.strip(),
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+        "client": client,
+        "server": {
+            "cpu_seconds": round(cpu, 3),
+            "cpu_percent": round(100 * cpu / elapsed, 1),
+            "cpu_us_per_request": round(1e6 * cpu / requests, 2),
+            "rss_peak_kb": server.rss_peak,
+            "rss_end_kb": rss_end,
+        },
+    }
+
+
+def lookup(result, path):
+    for key in path:
+        result = result.get(key, {}) if isinstance(result, dict) else {}
+    return result if isinstance(result, (int, float)) else None
+
+
+def compare(result, baseline, tolerance):
+    """Prints each metric against the baseline, returns the metrics that got worse than tolerance."""
+    regressions = []
+    print("  %-28s %12s %12s %8s" % ("metric", "baseline", "now", "change"))
+    for path, higher_is_better in METRICS:
+        before, now = lookup(baseline, path), lookup(result, path)
+        if before is None or now is None:
+            continue
+        change = (now - before) / before if before else 0.0
+        worse = -change if higher_is_better else change
+        flag = ""
+        if worse > tolerance:
+            flag = "  REGRESSION"
+            regressions.append(".".join(path))
+        print("  %-28s %12.3f %12.3f %+7.1f%%%s" % (".".join(path), before, now, 100 * change, flag))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("profiles", nargs="*", metavar="profile",
+                        help="workloads to run, all of them by default: " + ", ".join(PROFILES))
+    parser.add_argument("--threads", type=int, default=4, help="SERVER_THREADS for the server")
+    parser.add_argument("--seconds", type=float, default=10, help="length of each run")
+    parser.add_argument("--tolerance", type=float, default=0.10,
+                        help="relative change against the baseline that counts as a regression")
+    parser.add_argument("--save-baseline", action="store_true", help="store this run as the baseline")
+    parser.add_argument("--cleartext", action="store_true", help="h2c with prior knowledge instead of TLS")
+    args = parser.parse_args()
+    profiles = args.profiles or list(PROFILES)
+    unknown = [name for name in profiles if name not in PROFILES]
+    if unknown:
+        parser.error("unknown profile: " + ", ".join(unknown))
+
+    for binary in (SERVER, H2BENCH):
+        if not os.access(binary, os.X_OK):
+            sys.exit("%s is missing, run make first" % binary)
+    for port in (PORT, H2C_PORT):
+        if port_open(port):
+            sys.exit("port %d is already in use, stop the running server first" % port)
+
+    os.makedirs(RESULTS, exist_ok=True)
+    workdir = tempfile.mkdtemp(prefix="h2loopback-")
+    regressions = {}
+    try:
+        small_urls = prepare(workdir)
+        for name in profiles:
+            result = run_profile(name, workdir, small_urls, args.threads, args.seconds, args.cleartext)
+            if args.cleartext:
+                name += "-h2c"
+            client, server = result["client"], result["server"]
+            print("%s: %.1f req/s, %.2f MB/s, p50 %.3f ms, p99 %.3f ms, %.1f handshakes/s, "
+                  "cpu %.1f%%, rss peak %d KB" % (
+                      name, client["requests_per_sec"], client["mb_per_sec"], client["latency_ms"]["p50"],
+                      client["latency_ms"]["p99"], client["handshakes_per_sec"], server["cpu_percent"],
+                      server["rss_peak_kb"]))
+
+            with open(os.path.join(RESULTS, name + ".json"), "w") as f:
+                json.dump(result, f, indent=2)
+
+            baseline_path = os.path.join(BASELINES, name + ".json")
+            if args.save_baseline:
+                os.makedirs(BASELINES, exist_ok=True)
+                with open(baseline_path, "w") as f:
+                    json.dump(result, f, indent=2)
+                print("  saved as baseline")
+            elif os.path.exists(baseline_path):
+                with open(baseline_path) as f:
+                    baseline = json.load(f)
+                print("  against baseline from %s (%s)" % (baseline.get("commit", "?"), baseline.get("timestamp", "?")))
+                worse = compare(result, baseline, args.tolerance)
+                if worse:
+                    regressions[name] = worse
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+
+    if regressions:
+        for name, metrics in regressions.items():
+            print("%s regressed: %s" % (name, ", ".join(metrics)))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,501 @@
+// Microbenchmarks for the protocol primitives, run with `make bench`.
+//
+//   bin/microbench [-f filter] [-t ms per sample] [-o results.json]
+//
+// Every benchmark is calibrated until one sample takes at least the target time, then sampled
+// BENCH_SAMPLES times. The median is reported, so one preempted sample does not skew a run.
+// A table goes to stdout, the JSON with every result to -o (or to stdout after the table).
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "http2/protocol/frame.h"
+#include "http2/protocol/settings.h"
+#include "http2/protocol/hpack/hpack.h"
+#include "Response/response.h"
+#include "Client/clientManager.h"
+#include "Networking/Transport/memoryTransport.h"
+#include "WebBinder/webBinder.h"
+#include "Utils/Logger/logger.h"
+#include <sys/socket.h>
+
+#define BENCH_SAMPLES 7
+
+namespace protocol = http2::protocol;
+namespace hpack = http2::protocol::hpack;
+using http2::headers::Header;
+
+static int64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// keeps the compiler from dropping work whose result is never used
+template<class T>
+static inline void keep(const T& value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations; // per sample
+    double nsPerOp;      // median over the samples
+    double minNsPerOp;
+    size_t bytesPerOp;   // input bytes one operation handles, 0 when it is not about bytes
+};
+
+class Bench {
+private:
+    std::string filter;
+    int64_t targetNs;
+    std::vector<Result> results;
+
+    template<class F>
+    static int64_t sample(F& op, uint64_t iterations) {
+        int64_t start = now();
+        for (uint64_t i = 0; i < iterations; ++i) op();
+        return now() - start;
+    }
+
+public:
+    Bench(std::string filter, int64_t targetNs) : filter(std::move(filter)), targetNs(targetNs) {}
+
+    template<class F>
+    void run(const std::string& name, size_t bytesPerOp, F op) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+
+        uint64_t iterations = 1;
+        int64_t elapsed = sample(op, iterations);
+        while (elapsed < targetNs) {
+            // aim straight for the target once there is a usable estimate, 10x at most per step
+            uint64_t estimate = elapsed > 1000 ? iterations * targetNs / elapsed + 1 : iterations * 10;
+            iterations = std::min(estimate, iterations * 10);
+            elapsed = sample(op, iterations);
+        }
+
+        std::vector<double> perOp;
+        for (int i = 0; i < BENCH_SAMPLES; ++i) {
+            perOp.push_back((double) sample(op, iterations) / iterations);
+        }
+        std::sort(perOp.begin(), perOp.end());
+
+        Result result{name, iterations, perOp[BENCH_SAMPLES / 2], perOp[0], bytesPerOp};
+        printf("%-44s %12.1f ns/op %12.1f min", name.c_str(), result.nsPerOp, result.minNsPerOp);
+        if (bytesPerOp) printf(" %10.1f MB/s", bytesPerOp / result.nsPerOp * 1e3);
+        printf("\n");
+        fflush(stdout);
+        results.push_back(result);
+    }
+
+    std::string json() const {
+        struct utsname host;
+        uname(&host);
+
+        std::string out = "{\"host\":\"" + std::string(host.nodename) + "\",\"machine\":\"" + host.machine +
+                          "\",\"samples\":" + std::to_string(BENCH_SAMPLES) + ",\"benchmarks\":[";
+        char buf[512];
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            snprintf(buf, sizeof(buf), "%s\n{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,"
+                     "\"min_ns_per_op\":%.2f,\"bytes_per_op\":%zu}",
+                     i ? "," : "", r.name.c_str(), (unsigned long long) r.iterations,
+                     r.nsPerOp, r.minNsPerOp, r.bytesPerOp);
+            out += buf;
+        }
+        out += "\n]}\n";
+        return out;
+    }
+};
+
+// Header sets as sent by current browsers, a navigation and a subresource request.
+static const std::vector<Header> chromeNavigation = {
+    {":method", "GET"}, {":authority", "localhost:8080"}, {":scheme", "https"}, {":path", "/"},
+    {"sec-ch-ua", "\"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\""},
+    {"sec-ch-ua-mobile", "?0"}, {"sec-ch-ua-platform", "\"Linux\""},
+    {"upgrade-insecure-requests", "1"},
+    {"user-agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36"},
+    {"accept", "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,"
+               "application/signed-exchange;v=b3;q=0.7"},
+    {"sec-fetch-site", "none"}, {"sec-fetch-mode", "navigate"}, {"sec-fetch-user", "?1"},
+    {"sec-fetch-dest", "document"}, {"accept-encoding", "gzip, deflate, br, zstd"},
+    {"accept-language", "en-US,en;q=0.9"}, {"priority", "u=0, i"},
+};
+
+static const std::vector<Header> chromeImage = {
+    {":method", "GET"}, {":authority", "localhost:8080"}, {":scheme", "https"}, {":path", "/html/folder.png"},
+    {"sec-ch-ua", "\"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\""},
+    {"sec-ch-ua-mobile", "?0"},
+    {"user-agent", "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36"},
+    {"sec-ch-ua-platform", "\"Linux\""},
+    {"accept", "image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8"},
+    {"sec-fetch-site", "same-origin"}, {"sec-fetch-mode", "no-cors"}, {"sec-fetch-dest", "image"},
+    {"referer", "https://localhost:8080/"}, {"accept-encoding", "gzip, deflate, br, zstd"},
+    {"accept-language", "en-US,en;q=0.9"}, {"priority", "i"},
+};
+
+static const std::vector<Header> firefoxNavigation = {
+    {":method", "GET"}, {":path", "/html/"}, {":authority", "localhost:8080"}, {":scheme", "https"},
+    {"user-agent", "Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0"},
+    {"accept", "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8"},
+    {"accept-language", "en-US,en;q=0.5"}, {"accept-encoding", "gzip, deflate, br"},
+    {"upgrade-insecure-requests", "1"}, {"sec-fetch-dest", "document"}, {"sec-fetch-mode", "navigate"},
+    {"sec-fetch-site", "none"}, {"sec-fetch-user", "?1"}, {"te", "trailers"},
+};
+
+// what respondGet sends back for a static file
+static const std::vector<Header> serverResponse = {
+    {":status", "200"}, {"cache-control", "private"}, {"content-type", "text/html"},
+    {"content-length", "1543"}, {"content-encoding", "br"}, {"vary", "accept-encoding"},
+    {"etag", "\"6a3f-5e1b2c3d4f5a6b7c-br\""}, {"last-modified", "Sun, 16 Jun 2025 16:56:24 GMT"},
+    {"accept-ranges", "bytes"}, {"location", "/"}, {"server", "HTTP2Server/1.0"},
+};
+
+static size_t literalSize(const std::vector<Header>& headers) {
+    size_t size = 0;
+    for (const auto& header : headers) size += header.name.size() + header.value.size();
+    return size;
+}
+
+static std::vector<uint8_t> encodeBlock(hpack::Encoder& encoder, const std::vector<Header>& headers) {
+    std::vector<uint8_t> block;
+    encoder.encode_all(headers, block);
+    return block;
+}
+
+static void frameBenchmarks(Bench& bench) {
+    protocol::Frame data(protocol::DATA_FRAME, protocol::END_STREAM, 1);
+    data.mutable_payload().assign(16384, 'x');
+    std::vector<uint8_t> encodedData = data.encode();
+
+    bench.run("frame/encode_data_16k", encodedData.size(), [&] {
+        std::vector<uint8_t> out = data.encode();
+        keep(out);
+    });
+
+    bench.run("frame/decode_data_16k", encodedData.size(), [&] {
+        protocol::Frame frame;
+        frame.decode(encodedData);
+        keep(frame);
+    });
+
+    protocol::Frame ping(protocol::PING_FRAME, protocol::NO_FLAGS, 0, {1, 2, 3, 4, 5, 6, 7, 8});
+    bench.run("frame/encode_ping", 17, [&] {
+        std::vector<uint8_t> out = ping.encode();
+        keep(out);
+    });
+
+    // what a browser sends when it opens a connection: SETTINGS, WINDOW_UPDATE, a few HEADERS
+    std::vector<uint8_t> burst;
+    auto append = [&burst](const protocol::Frame& frame) {
+        std::vector<uint8_t> encoded = frame.encode();
+        burst.insert(burst.end(), encoded.begin(), encoded.end());
+    };
+    protocol::Frame settings(protocol::SETTINGS_FRAME, protocol::NO_FLAGS, 0);
+    settings.mutable_payload().assign(24, 0);
+    append(settings);
+    append(protocol::Frame(protocol::WINDOW_UPDATE_FRAME, protocol::NO_FLAGS, 0, {0, 0xef, 0, 1}));
+    hpack::Encoder encoder;
+    for (uint32_t sid = 1; sid <= 19; sid += 2) {
+        protocol::Frame headers(protocol::HEADERS_FRAME, protocol::END_HEADERS | protocol::END_STREAM, sid);
+        encoder.encode_all(sid == 1 ? chromeNavigation : chromeImage, headers.mutable_payload());
+        append(headers);
+    }
+
+    bench.run("frame/toFrames_connection_burst", burst.size(), [&] {
+        size_t consumed = 0;
+        std::vector<protocol::Frame> frames = protocol::Frame::toFrames(burst.data(), burst.data() + burst.size(), consumed);
+        keep(frames);
+    });
+}
+
+static void hpackBenchmarks(Bench& bench) {
+    std::string userAgent = chromeNavigation[8].value;
+    std::vector<uint8_t> plain(userAgent.begin(), userAgent.end());
+    std::vector<uint8_t> compressed;
+    hpack::encode_huffman(plain, compressed);
+
+    bench.run("hpack/encode_huffman_user_agent", plain.size(), [&] {
+        std::vector<uint8_t> out;
+        hpack::encode_huffman(plain, out);
+        keep(out);
+    });
+
+    bench.run("hpack/decode_huffman_user_agent", compressed.size(), [&] {
+        std::vector<uint8_t> out;
+        hpack::decode_huffman(compressed, out);
+        keep(out);
+    });
+
+    // a table index fits the prefix, a content-length needs continuation bytes
+    std::vector<uint8_t> out;
+    out.reserve(16);
+    for (uint32_t value : {10u, 1337u, 1048576u}) {
+        std::string suffix = std::to_string(value);
+        bench.run("hpack/encode_integer_" + suffix, 0, [&] {
+            out.clear();
+            hpack::encode_integer(0x00, 5, value, out);
+            keep(out);
+        });
+
+        std::vector<uint8_t> encoded;
+        hpack::encode_integer(0x00, 5, value, encoded);
+        bench.run("hpack/decode_integer_" + suffix, 0, [&] {
+            uint32_t decoded;
+            size_t n = hpack::decode_integer(encoded, 5, decoded);
+            keep(n);
+            keep(decoded);
+        });
+    }
+
+    struct Set {
+        const char* name;
+        const std::vector<Header>& headers;
+    };
+    for (const Set& set : {Set{"chrome_navigation", chromeNavigation}, Set{"chrome_image", chromeImage},
+                           Set{"firefox_navigation", firefoxNavigation}, Set{"server_response", serverResponse}}) {
+        size_t literal = literalSize(set.headers);
+
+        // the first block on a connection, every header goes into the dynamic table
+        bench.run(std::string("hpack/encode_all_cold_") + set.name, literal, [&] {
+            hpack::Encoder encoder;
+            std::vector<uint8_t> block;
+            encoder.encode_all(set.headers, block);
+            keep(block);
+        });
+
+        hpack::Encoder encoder;
+        std::vector<uint8_t> first = encodeBlock(encoder, set.headers);
+        std::vector<uint8_t> repeat = encodeBlock(encoder, set.headers);
+
+        bench.run(std::string("hpack/decode_lowmem_cold_") + set.name, first.size(), [&] {
+            hpack::Decoder decoder;
+            size_t count = 0;
+            decoder.decode_lowmem(first, [&count](Header header) { count += header.value.size(); });
+            keep(count);
+        });
+
+        // later requests on the connection only reference the table, so decoding leaves it as it was
+        hpack::Decoder warm;
+        warm.decode_lowmem(first, [](Header) {});
+        bench.run(std::string("hpack/decode_lowmem_warm_") + set.name, repeat.size(), [&] {
+            size_t count = 0;
+            warm.decode_lowmem(repeat, [&count](Header header) { count += header.value.size(); });
+            keep(count);
+        });
+    }
+}
+
+static void settingsBenchmarks(Bench& bench) {
+    protocol::Settings settings;
+    settings.set_header_table_size(65536);
+    settings.set_enable_push(false);
+    settings.set_max_concurrent_streams(1000);
+    settings.set_initial_window_size(6291456);
+    settings.set_max_frame_size(16384);
+    settings.set_max_header_list_size(262144);
+
+    std::vector<uint8_t> encoded;
+    settings.encode(encoded);
+
+    bench.run("settings/encode", encoded.size(), [&] {
+        std::vector<uint8_t> out;
+        settings.encode(out);
+        keep(out);
+    });
+
+    bench.run("settings/decode", encoded.size(), [&] {
+        protocol::Settings decoded;
+        protocol::Error err = decoded.decode(encoded);
+        keep(err);
+        keep(decoded);
+    });
+}
+
+static void responseBenchmarks(Bench& bench) {
+    hpack::Encoder encoder;
+    protocol::Frame headers(protocol::HEADERS_FRAME, protocol::END_HEADERS, 1);
+    encoder.encode_all(serverResponse, headers.mutable_payload());
+
+    protocol::Frame small(protocol::DATA_FRAME, protocol::END_STREAM, 1);
+    small.mutable_payload().assign(1543, 'x');
+    protocol::Frame large(protocol::DATA_FRAME, protocol::END_STREAM, 1);
+    large.mutable_payload().assign(256 * 1024, 'x');
+
+    for (const auto& [name, body] : {std::make_pair("1k", &small), std::make_pair("256k", &large)}) {
+        bench.run(std::string("response/process_encode_") + name, headers.payload().size() + body->payload().size(), [&] {
+            Response resp;
+            resp.addFrame(headers);
+            resp.addFrame(*body);
+            resp.processFrames();
+            std::vector<std::vector<uint8_t>> out = resp.encodeFrames();
+            keep(out);
+        });
+    }
+}
+
+// Drives one Client of the real server over a MemoryTransport, the bench plays the browser on the
+// other end of the socketpair. Frame parsing, HPACK, routing, responses and the worker pool hand-off
+// are measured together, without TLS or the network adding noise.
+class StackPeer {
+private:
+    MemoryTransport* transport;
+    Client* client;
+    hpack::Encoder encoder;
+    std::vector<uint8_t> in;
+    uint32_t nextStreamId = 1;
+    epoll_event event{};
+
+    void send(const std::vector<uint8_t>& bytes) {
+        size_t at = 0;
+        while (at < bytes.size()) {
+            ssize_t n = ::send(transport->peerFD, bytes.data() + at, bytes.size() - at, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    ClientManager::handleClient(client, event);
+                    continue;
+                }
+                perror("stack peer send");
+                exit(1);
+            }
+            at += n;
+        }
+    }
+
+    // reads what the server wrote until END_STREAM arrives on streamId, returns the DATA bytes
+    uint32_t awaitStream(uint32_t streamId) {
+        uint32_t dataBytes = 0;
+        uint8_t buf[65536];
+        while (true) {
+            ssize_t n = recv(transport->peerFD, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EAGAIN) {
+                // the socketpair filled up, let the client push out the rest as on EPOLLOUT
+                ClientManager::handleClient(client, event);
+                continue;
+            }
+            if (n <= 0) {
+                fprintf(stderr, "stack peer: connection closed\n");
+                exit(1);
+            }
+            in.insert(in.end(), buf, buf + n);
+
+            size_t consumed = 0;
+            std::vector<protocol::Frame> frames = protocol::Frame::toFrames(in.data(), in.data() + in.size(), consumed);
+            in.erase(in.begin(), in.begin() + consumed);
+
+            bool done = false;
+            for (const auto& frame : frames) {
+                if (frame.type() == protocol::DATA_FRAME) dataBytes += frame.payload().size();
+                if (frame.stream_id() == streamId && frame.has_flag(protocol::END_STREAM)) done = true;
+                if (frame.type() == protocol::RST_STREAM_FRAME && frame.stream_id() == streamId) done = true;
+            }
+            if (done) return dataBytes;
+        }
+    }
+
+public:
+    StackPeer(WebBinder* binder) : transport(new MemoryTransport()) {
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_loopback;
+        client = new Client(1, addr, sizeof(addr), &ClientManager::threadPool, transport, binder);
+
+        static const std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        std::vector<uint8_t> out(preface.begin(), preface.end());
+        protocol::Frame settings(protocol::SETTINGS_FRAME, protocol::NO_FLAGS, 0);
+        protocol::Settings().encode(settings.mutable_payload());
+        std::vector<uint8_t> encoded = settings.encode();
+        out.insert(out.end(), encoded.begin(), encoded.end());
+        send(out);
+        ClientManager::handleClient(client, event);
+    }
+
+    ~StackPeer() {
+        delete client;
+    }
+
+    // one request on a fresh stream, answered in full, its DATA credited back to the connection
+    void request(const std::vector<Header>& headers) {
+        uint32_t streamId = nextStreamId;
+        nextStreamId += 2;
+
+        protocol::Frame frame(protocol::HEADERS_FRAME, protocol::END_HEADERS | protocol::END_STREAM, streamId);
+        encoder.encode_all(headers, frame.mutable_payload());
+        send(frame.encode());
+        ClientManager::handleClient(client, event);
+
+        uint32_t dataBytes = awaitStream(streamId);
+        if (dataBytes > 0) {
+            protocol::Frame update(protocol::WINDOW_UPDATE_FRAME, protocol::NO_FLAGS, 0, {
+                uint8_t(dataBytes >> 24), uint8_t(dataBytes >> 16), uint8_t(dataBytes >> 8), uint8_t(dataBytes)
+            });
+            send(update.encode());
+        }
+    }
+};
+
+static void stackBenchmarks(Bench& bench) {
+    WebBinder binder;
+    binder.bindDirectory("./html/", "/html");
+    binder.bindFile("./html/reallyCoolSite.html", "/");
+    binder.bindHandler("/ping", [](const std::map<std::string, std::string>&) {
+        return ResponseData("text/plain", std::vector<u_int8_t>{'o', 'k'});
+    });
+
+    const std::vector<Header> ping = {
+        {":method", "GET"}, {":authority", "localhost:8080"}, {":scheme", "https"}, {":path", "/ping"},
+    };
+
+    StackPeer peer(&binder);
+    bench.run("stack/get_handler", literalSize(ping), [&] { peer.request(ping); });
+    bench.run("stack/get_navigation_br", literalSize(chromeNavigation), [&] { peer.request(chromeNavigation); });
+    bench.run("stack/get_image", literalSize(chromeImage), [&] { peer.request(chromeImage); });
+}
+
+int main(int argc, char** argv) {
+    std::string filter, output;
+    int64_t targetNs = 100 * 1000000LL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:o:")) != -1) {
+        switch (opt) {
+            case 'f': filter = optarg; break;
+            case 't': targetNs = atoll(optarg) * 1000000LL; break;
+            case 'o': output = optarg; break;
+            default:
+                fprintf(stderr, "usage: microbench [-f filter] [-t ms per sample] [-o results.json]\n");
+                return 2;
+        }
+    }
+
+    // the stack benchmarks run the server's own code, which logs every request at INFO
+    if (!getenv("LOG_LEVEL")) Logger::setLevel(LEVEL_ERROR);
+
+    Bench bench(filter, targetNs);
+    frameBenchmarks(bench);
+    hpackBenchmarks(bench);
+    settingsBenchmarks(bench);
+    responseBenchmarks(bench);
+    stackBenchmarks(bench);
+
+    std::string json = bench.json();
+    if (output.empty()) {
+        fputs(json.c_str(), stdout);
+        return 0;
+    }
+
+    FILE* file = fopen(output.c_str(), "w");
+    if (!file) {
+        perror(output.c_str());
+        return 1;
+    }
+    fputs(json.c_str(), file);
+    fclose(file);
+    printf("results written to %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "admission.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include <cstdlib>
+
+static size_t limit(const char* name, size_t fallback) {
+    const char* value = std::getenv(name);
+    long n = value ? std::atol(value) : 0;
+    return n > 0 ? n : fallback;
+}
+
+const size_t Admission::maxConnections = limit("MAX_CONNECTIONS", DEFAULT_MAX_CONNECTIONS);
+const size_t Admission::maxConnectionsPerIp = limit("MAX_CONNECTIONS_PER_IP", DEFAULT_MAX_CONNECTIONS_PER_IP);
+const size_t Admission::maxConcurrentStreams = limit("MAX_CONCURRENT_STREAMS", DEFAULT_MAX_CONCURRENT_STREAMS);
+const size_t Admission::maxOpenStreams = limit("MAX_OPEN_STREAMS", DEFAULT_MAX_OPEN_STREAMS);
+
+size_t Admission::connections = 0;
+size_t Admission::openStreams = 0;
+std::map<std::string, size_t> Admission::perIp;
+bool Admission::paused = false;
+int64_t Admission::lastShedNs = 0;
+
+static const LabeledCounter connectionsRefused("http2_connections_refused_total", "Connections closed right after accept",
+                                               "reason", {"global", "per_ip"});
+static const LabeledCounter streamsRefused("http2_streams_refused_total", "Streams reset before they were processed",
+                                           "reason", {"concurrency", "overload"});
+static const bool admissionGauges = (
+    Metrics::gauge("http2_open_streams", "Admitted peer streams on all connections",
+                   [] { return (double) Admission::openStreams; }),
+    Metrics::gauge("http2_accept_paused", "1 while accepting is paused at the connection cap",
+                   [] { return Admission::paused ? 1.0 : 0.0; }),
+    true);
+
+bool Admission::admit(const std::string& ip) {
+    if (connections >= maxConnections) {
+        connectionsRefused.add(0);
+        LOG_WARNING("Connection cap of " + std::to_string(maxConnections) + " reached, refusing " + ip);
+        return false;
+    }
+
+    size_t& fromIp = perIp[ip];
+    if (fromIp >= maxConnectionsPerIp) {
+        connectionsRefused.add(1);
+        LOG_WARNING("Per-IP connection cap of " + std::to_string(maxConnectionsPerIp) + " reached for " + ip);
+        return false;
+    }
+
+    ++fromIp;
+    ++connections;
+    return true;
+}
+
+void Admission::release(const std::string& ip) {
+    auto it = perIp.find(ip);
+    if (it == perIp.end()) return;
+
+    if (--it->second == 0) perIp.erase(it);
+    --connections;
+}
+
+http2::protocol::Error Admission::admitStream(size_t openOnConnection) {
+    if (openOnConnection >= maxConcurrentStreams) {
+        // the peer ignored our SETTINGS, REFUSED_STREAM tells it the request is safe to retry
+        streamsRefused.add(0);
+        return http2::protocol::REFUSED_STREAM;
+    }
+    if (openStreams >= maxOpenStreams) {
+        streamsRefused.add(1);
+        return http2::protocol::ENHANCE_YOUR_CALM;
+    }
+    return http2::protocol::NO_ERROR;
+}
+
+bool Admission::acceptPaused() {
+    if (!paused && connections >= maxConnections) {
+        paused = true;
+        LOG_WARNING("Connection cap of " + std::to_string(maxConnections) + " reached, pausing accept");
+    } else if (paused && connections * 100 < maxConnections * ADMISSION_RESUME_PERCENT) {
+        paused = false;
+        LOG_INFO("Connections down to " + std::to_string(connections) + ", accepting again");
+    }
+    return paused;
+}
+
+bool Admission::shedDue() {
+    if (!overloaded()) return false;
+
+    int64_t now = Metrics::now();
+    if (now - lastShedNs < SHED_INTERVAL_MS * 1000000LL) return false;
+    lastShedNs = now;
+    return true;
+}
@@ -0,0 +1,54 @@
+#include <map>
+#include <string>
+#include <cstddef>
+#include "http2/protocol/error.h"
+
+#define DEFAULT_MAX_CONNECTIONS 10000
+#define DEFAULT_MAX_CONNECTIONS_PER_IP 256
+#define DEFAULT_MAX_CONCURRENT_STREAMS 100   // advertised in SETTINGS_MAX_CONCURRENT_STREAMS
+#define DEFAULT_MAX_OPEN_STREAMS 4096        // across all connections, beyond it the server is overloaded
+#define ADMISSION_RESUME_PERCENT 90          // paused accepting resumes below this share of the connection cap
+#define SHED_INTERVAL_MS 1000                // idle connections are shed at most this often while overloaded
+#define HANDSHAKE_TIMEOUT_MS 10000           // under overload, connections still handshaking after this are closed
+#define DRAIN_TIMEOUT_MS 1000                // a shed connection is closed at the latest this long after its GOAWAY
+
+#pragma once
+
+// Limits on how much work the server takes on. Connections are capped globally and per IP,
+// streams per connection (REFUSED_STREAM past SETTINGS_MAX_CONCURRENT_STREAMS) and across the
+// server. At the connection cap the listeners stop being polled, past the stream budget new
+// streams get ENHANCE_YOUR_CALM and idle connections a GOAWAY, so admitted requests keep their
+// latency. Limits come from MAX_CONNECTIONS, MAX_CONNECTIONS_PER_IP, MAX_CONCURRENT_STREAMS and
+// MAX_OPEN_STREAMS. Only the event loop calls in here.
+class Admission {
+public:
+    static const size_t maxConnections;
+    static const size_t maxConnectionsPerIp;
+    static const size_t maxConcurrentStreams;
+    static const size_t maxOpenStreams;
+
+    static size_t connections;
+    static size_t openStreams; // admitted peer streams on all connections
+    static bool paused;        // the listeners are not polled
+
+    // false when the connection has to be closed right away, otherwise it counts until release
+    static bool admit(const std::string& ip);
+
+    static void release(const std::string& ip);
+
+    // NO_ERROR when a new peer stream may open on a connection with openOnConnection streams,
+    // otherwise the code to reset it with
+    static http2::protocol::Error admitStream(size_t openOnConnection);
+
+    static bool overloaded() { return connections >= maxConnections || openStreams >= maxOpenStreams; }
+
+    // with hysteresis, so a connection cap that is hovered around does not toggle every event
+    static bool acceptPaused();
+
+    // whether idle connections should be shed now, rate limited to SHED_INTERVAL_MS
+    static bool shedDue();
+
+private:
+    static std::map<std::string, size_t> perIp;
+    static int64_t lastShedNs;
+};
@@ -1,5 +1,7 @@
 #include "client.h"
 #include "Utils/Logger/logger.h"
+#include "http2/protocol/constants.h"
+#include "admission.h"
 
 std::string Client::getIp(const sockaddr_in6& addr) {
     char ipStr[INET6_ADDRSTRLEN];
@@ -7,41 +9,314 @@ std::string Client::getIp(const sockaddr_in6& addr) {
     return std::string(ipStr);
 }
 
-Client::Client(int id, int fd, const sockaddr_in6& addr, socklen_t addrLen, SSL* ssl, WebBinder* binder)
+Client::Client(int id, const sockaddr_in6& addr, socklen_t addrLen, Transport* transport, WebBinder* binder)
     : id(id), addr(addr), addrLen(addrLen), start(time(nullptr)),
-    errorCode(0), clientFD(fd, EpollFdType::CLIENT), lastProcessedStream(-1),
-    recvBuffer(BUFFER_SIZE), ssl(ssl), binder(binder) {
+    errorCode(0), clientFD(transport->fd, EpollFdType::CLIENT), lastProcessedStream(-1),
+    peerStreams(0), admitted(false), waitingOnBody(false), drainDeadlineNs(0), epollEvents(EPOLLIN),
+    recvBuffer(BUFFER_SIZE), recvPending(0), sendWindow(65535), nextPushId(2), acceptedNs(Metrics::now()),
+    traced(Trace::sample()),
+    sendfileOffset(0), sendfileLeft(0), sendfileAt(0), transport(transport), binder(binder) {
     ip = getIp(addr);
     state = State::HANDSHAKE;
 
     hpackDecoder = std::make_unique<http2::protocol::hpack::Decoder>();
 }
 
+Client::~Client() {
+    while (!streams.empty()) {
+        closeStream(streams.begin()->first);
+    }
+}
+
 bool Client::isTimedOut(const int timeout) const {
     return difftime(time(nullptr), start) > timeout;
 }
 
+bool Client::isIdle() const {
+    return state == CLIENT_IDLE && streams.empty() && isDrained();
+}
+
+static const std::vector<std::string> frameTypes = {
+    "DATA", "HEADERS", "PRIORITY", "RST_STREAM", "SETTINGS",
+    "PUSH_PROMISE", "PING", "GOAWAY", "WINDOW_UPDATE", "CONTINUATION"
+};
+const LabeledCounter Client::framesIn("http2_frames_received_total", "Frames received by type", "type", frameTypes);
+const LabeledCounter Client::framesOut("http2_frames_sent_total", "Frames sent by type", "type", frameTypes);
+
+static const Histogram streamDuration("http2_stream_duration_seconds", "Request headers received to last response frame queued");
+
+void Client::streamFinished(Stream* strm) {
+    strm->responseSent = true;
+    if (strm->startNs > 0) {
+        streamDuration.recordSince(strm->startNs);
+        floodGuard.streamAnswered();
+    }
+    if (traced && strm->startNs > 0) Trace::streamSpan(id, strm->id, strm->startNs);
+}
+
 bool Client::sendData(const std::vector<uint8_t>& data, int weight) {
-    Logger::debug("Data: " + toHex(data.data(), data.size()) +
+    // callers hand over whole encoded frames, count them by the type in each header
+    for (size_t at = 0; at + 9 <= data.size(); at += 9 + ((data[at] << 16) | (data[at + 1] << 8) | data[at + 2])) {
+        framesOut.add(data[at + 3]);
+    }
+
+    LOG_DEBUG("Data: " + toHex(data.data(), data.size()) +
                   ", size: " + std::to_string(data.size()) +
                   ", for client ID: " + std::to_string(id));
 
+    outBuffer.insert(outBuffer.end(), data.begin(), data.end());
+    return flushOutput(weight);
+}
+
+bool Client::flushOutput(int weight) {
+    while (!outBuffer.empty() || sendfileLeft > 0) {
+        // nothing queued after a spliced payload may overtake it
+        size_t limit = sendfileLeft > 0 ? sendfileAt : outBuffer.size();
+
+        if (limit > 0) {
+            ssize_t sent = writeOut(limit, weight);
+            if (sent < 0) return false;
+
+            outBuffer.erase(outBuffer.begin(), outBuffer.begin() + sent);
+            if (sendfileLeft > 0) sendfileAt -= sent;
+            if ((size_t) sent < limit) return true;
+            continue;
+        }
+
+        ssize_t sent = sendfileOut(weight);
+        if (sent < 0) return false;
+
+        sendfileOffset += sent;
+        sendfileLeft -= sent;
+        if (sendfileLeft > 0) return true;
+        sendfileBody.reset();
+    }
+
+    return true;
+}
+
+ssize_t Client::writeOut(size_t len, int weight) {
     state = WRITING;
-    auto bytesSent = threadPool->enqueue(weight, [this, data]() {
-        ssize_t bytesSent = SSL_write(ssl, data.data(), data.size());
-        if (bytesSent < 0) {
-            Logger::error("Error sending frame to client: " + std::to_string(errno));
-            return -1;
-        } else if (bytesSent < static_cast<ssize_t>(data.size())) {
-            Logger::warning("Partial frame sent to client, expected: " + std::to_string(data.size()) +
-                            ", sent: " + std::to_string(bytesSent));
+    int64_t queuedNs = traced ? Metrics::now() : 0;
+    auto bytesSent = threadPool->enqueue(weight, [this, len, queuedNs]() {
+        if (traced) Trace::span("pool_wait", id, 0, queuedNs);
+        TraceSpan span(traced, "write", id);
+        ssize_t bytesSent = transport->write(outBuffer.data(), len);
+        if (bytesSent <= 0) {
+            // 0 means the socket buffer is full, the same bytes are retried on the next event
+            return bytesSent;
+        } else if (bytesSent < static_cast<ssize_t>(len)) {
+            LOG_DEBUG("Partial frame sent to client, expected: " + std::to_string(len) +
+                          ", sent: " + std::to_string(bytesSent));
         } else {
-            Logger::debug("Sent frame to client ID: " + std::to_string(id));
+            LOG_DEBUG("Sent frame to client ID: " + std::to_string(id));
         }
-        return (int) bytesSent;
+        return bytesSent;
     });
+    ssize_t sent = bytesSent.get();
     state = CLIENT_IDLE;
-    return bytesSent.get() >= 0;
+    return sent;
+}
+
+ssize_t Client::sendfileOut(int weight) {
+    state = WRITING;
+    auto bytesSent = threadPool->enqueue(weight, [this]() {
+        TraceSpan span(traced, "sendfile", id);
+        return transport->sendfile(sendfileBody->fileDescriptor(), sendfileOffset, sendfileLeft);
+    });
+    ssize_t sent = bytesSent.get();
+    state = CLIENT_IDLE;
+    return sent;
+}
+
+bool Client::writeDataFrame(Stream* strm) {
+    size_t maxChunk = std::min<size_t>(DATA_CHUNK_SIZE, settings.max_frame_size());
+    int64_t window = std::min(sendWindow, strm->sendWindow);
+    size_t remaining = strm->body->remaining();
+    size_t len = std::min<size_t>(remaining, maxChunk);
+
+    if (remaining > 0) {
+        if (window <= 0) return false;
+        len = std::min<size_t>(len, window);
+    }
+
+    int fd = strm->body->fileDescriptor();
+    if (fd >= 0 && len > 0 && transport->canSendfile()) {
+        // only the header is queued, the kernel sends the payload straight from the page cache
+        if (sendfileLeft > 0) return false;
+
+        size_t headerAt = outBuffer.size();
+        outBuffer.resize(headerAt + 9);
+
+        sendfileBody = strm->body;
+        sendfileOffset = strm->body->fileOffset();
+        sendfileLeft = len;
+        sendfileAt = outBuffer.size();
+        strm->body->skip(len);
+
+        bool last = strm->body->remaining() == 0;
+        http2::protocol::Frame::encodeHeader(
+            outBuffer.data() + headerAt, len,
+            http2::protocol::DATA_FRAME,
+            last ? http2::protocol::END_STREAM : http2::protocol::NO_FLAGS,
+            strm->id
+        );
+
+        sendWindow -= len;
+        strm->sendWindow -= len;
+        framesOut.add(http2::protocol::DATA_FRAME);
+        if (last) {
+            streamFinished(strm);
+            strm->body.reset();
+        }
+
+        return true;
+    }
+
+    // the payload is read straight into the output buffer behind its frame header
+    size_t headerAt = outBuffer.size();
+    outBuffer.resize(headerAt + 9 + len);
+    ssize_t n;
+    {
+        TraceSpan span(traced, "body_read", id, strm->id);
+        n = strm->body->read(outBuffer.data() + headerAt + 9, len);
+    }
+    if (n == BodyStream::WOULD_BLOCK) {
+        // the body is produced on a worker, the stream resumes once BodyStream::readyFD fires
+        outBuffer.resize(headerAt);
+        waitingOnBody = true;
+        return false;
+    }
+    if (n < 0) {
+        // dropping the body without END_STREAM tells pumpStreams to reset the stream
+        outBuffer.resize(headerAt);
+        strm->body.reset();
+        return false;
+    }
+    outBuffer.resize(headerAt + 9 + n);
+
+    bool last = strm->body->remaining() == 0;
+    http2::protocol::Frame::encodeHeader(
+        outBuffer.data() + headerAt, n,
+        http2::protocol::DATA_FRAME,
+        last ? http2::protocol::END_STREAM : http2::protocol::NO_FLAGS,
+        strm->id
+    );
+
+    sendWindow -= n;
+    strm->sendWindow -= n;
+    framesOut.add(http2::protocol::DATA_FRAME);
+    if (last) {
+        streamFinished(strm);
+        strm->body.reset();
+    }
+
+    return true;
+}
+
+void Client::pumpStreams() {
+    waitingOnBody = false;
+    bool progress = true;
+    while (outBuffer.size() < OUTPUT_HIGH_WATER) {
+        if (!progress) {
+            // a spliced payload holds back the next one until the kernel has taken it
+            if (sendfileLeft == 0 || !flushOutput() || sendfileLeft > 0) break;
+        }
+        progress = false;
+        std::vector<int> finished, failed;
+
+        // one frame per stream per round, so a large file cannot starve the other streams
+        for (auto& [sid, strm] : streams) {
+            if (outBuffer.size() >= OUTPUT_HIGH_WATER) break;
+            if (!strm->body) continue;
+
+            bool wrote = writeDataFrame(strm);
+            if (wrote) progress = true;
+            if (!strm->body) (wrote ? finished : failed).push_back(sid);
+        }
+
+        for (int sid : failed) {
+            resetStream(sid, http2::protocol::INTERNAL_ERROR);
+        }
+
+        for (int sid : finished) {
+            finishStream(sid);
+        }
+    }
+
+    if (!flushOutput()) {
+        LOG_ERROR("Failed to flush output for client ID: " + std::to_string(id));
+    }
+}
+
+bool Client::resetStream(int streamId, http2::protocol::Error error) {
+    http2::protocol::Frame rstFrame(
+        http2::protocol::RST_STREAM_FRAME,
+        http2::protocol::NO_FLAGS,
+        streamId,
+        {
+            uint8_t(error >> 24), uint8_t(error >> 16),
+            uint8_t(error >> 8), uint8_t(error)
+        }
+    );
+
+    if (error != http2::protocol::NO_ERROR) {
+        LOG_WARNING("Resetting stream ID: " + std::to_string(streamId) +
+                        " for client ID: " + std::to_string(id) +
+                        ", error code: " + std::to_string(error));
+    }
+    closeStream(streamId);
+    return sendFrame(rstFrame);
+}
+
+void Client::finishStream(int streamId) {
+    auto it = streams.find(streamId);
+    if (it == streams.end()) return;
+
+    if (it->second->endStream) {
+        closeStream(streamId);
+    } else {
+        // the answer is complete, the rest of the request is not needed (RFC 9113 8.1)
+        resetStream(streamId, http2::protocol::NO_ERROR);
+    }
+}
+
+void Client::closeStream(int streamId) {
+    auto it = streams.find(streamId);
+    if (it == streams.end()) return;
+
+    it->second->state = StreamState::CLOSED;
+    if (it->second->admitted) {
+        --peerStreams;
+        --Admission::openStreams;
+    }
+    delete it->second;
+    streams.erase(it);
+    LOG_DEBUG("Stream ID " + std::to_string(streamId) + " closed");
+}
+
+bool Client::sendGoaway(http2::protocol::Error error) {
+    uint32_t lastStream = lastProcessedStream > 0 ? lastProcessedStream : 0;
+    http2::protocol::Frame goawayFrame(
+        http2::protocol::GOAWAY_FRAME,
+        http2::protocol::NO_FLAGS,
+        0,
+        {
+            uint8_t(lastStream >> 24), uint8_t(lastStream >> 16),
+            uint8_t(lastStream >> 8), uint8_t(lastStream),
+            uint8_t(error >> 24), uint8_t(error >> 16),
+            uint8_t(error >> 8), uint8_t(error)
+        }
+    );
+
+    LOG_INFO("Sending GOAWAY to client ID: " + std::to_string(id) + ", error code: " + std::to_string(error));
+    return sendFrame(goawayFrame);
+}
+
+void Client::connectionError(http2::protocol::Error error) {
+    sendGoaway(error);
+    errorCode = error;
+    clientFD.setState(FdState::FD_CLOSED);
 }
 
 bool Client::sendFrame(const http2::protocol::Frame& frame, int weight) {
@@ -51,17 +326,19 @@ bool Client::sendFrame(const http2::protocol::Frame& frame, int weight) {
 }
 
 bool Client::ackSettings(const http2::protocol::Frame& frame) {
-    http2::protocol::Settings settings;
+    // a SETTINGS frame only carries the parameters that change, the others keep their last value
+    http2::protocol::Settings settings = this->settings;
     http2::protocol::Error err = settings.decode(frame.payload());
 
     if (err != http2::protocol::NO_ERROR) {
-        Logger::error("Error decoding settings frame for client ID: " + std::to_string(id) +
+        LOG_ERROR("Error decoding settings frame for client ID: " + std::to_string(id) +
                       ", error code: " + std::to_string(err));
+        connectionError(err);
         return false;
     }
 
 
-    Logger::debug("Received settings from client ID: " + std::to_string(id) +
+    LOG_DEBUG("Received settings from client ID: " + std::to_string(id) +
                  ", Header Table Size: " + std::to_string(settings.header_table_size()) +
                  ", Enable Push: " + std::to_string(settings.enable_push()) +
                  ", Max Concurrent Streams: " + std::to_string(settings.max_concurrent_streams()) +
@@ -77,7 +354,23 @@ bool Client::ackSettings(const http2::protocol::Frame& frame) {
 
     settingsAck.mutable_payload().resize(0);
 
-    this->settings = settings;    
+    // a new initial window size applies retroactively to every open stream (RFC 9113 6.9.2),
+    // settings that leave it out leave the windows alone
+    int64_t delta = (int64_t) settings.initial_window_size() - this->settings.initial_window_size();
+    if (delta != 0) {
+        for (const auto& [sid, strm] : streams) {
+            if (strm->sendWindow + delta > 0x7FFFFFFF) {
+                LOG_ERROR("Initial window size overflows flow control window for stream ID: " + std::to_string(sid));
+                connectionError(http2::protocol::FLOW_CONTROL_ERROR);
+                return false;
+            }
+        }
+        for (auto& [sid, strm] : streams) {
+            strm->sendWindow += delta;
+        }
+    }
+
+    this->settings = settings;
     sendFrame(settingsAck);
 
     return true;
@@ -85,6 +378,7 @@ bool Client::ackSettings(const http2::protocol::Frame& frame) {
 
 bool Client::applySettings() {
     http2::protocol::Settings settigns;
+    settigns.set_max_concurrent_streams(Admission::maxConcurrentStreams);
     vector<uint8_t> encodedSettings;
     settigns.encode(encodedSettings);
 
@@ -97,7 +391,7 @@ bool Client::applySettings() {
     settingsFrame.mutable_payload() = std::move(encodedSettings);
 
     if (!sendFrame(settingsFrame)) {
-        Logger::error("Failed to send settings frame to client ID: " + std::to_string(id));
+        LOG_ERROR("Failed to send settings frame to client ID: " + std::to_string(id));
         return false;
     }
 
@@ -105,56 +399,74 @@ bool Client::applySettings() {
 }
 
 void Client::doRequest(epoll_event& event) {
-    recvBuffer.resize(BUFFER_SIZE);
+    // bytes of a frame cut off by the previous read are kept at the front of the buffer
+    recvBuffer.resize(recvPending + BUFFER_SIZE);
     // ssize_t bytesRead = recv(clientFD.fd, recvBuffer.data(), recvBuffer.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
     state = READING;
-    ssize_t bytesRead = SSL_read(ssl, recvBuffer.data(), recvBuffer.size());
+    int64_t readNs = traced ? Metrics::now() : 0;
+    ssize_t bytesRead = transport->read(recvBuffer.data() + recvPending, BUFFER_SIZE);
     state = CLIENT_IDLE;
-    // Logger::debug("Client ID: " + std::to_string(id) + " received data, bytes read: " + std::to_string(bytesRead));
+    // LOG_DEBUG("Client ID: " + std::to_string(id) + " received data, bytes read: " + std::to_string(bytesRead));
 
     if (bytesRead < 0) {
-        // Logger::error("Error reading from client ID: " + std::to_string(id) + 
+        // LOG_ERROR("Error reading from client ID: " + std::to_string(id) + 
                     //   ", error code: " + std::to_string(errno));
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return;
         } else {
             errorCode = errno;
-            Logger::error("Error reading from client: " + std::to_string(errorCode));
+            LOG_ERROR("Error reading from client: " + std::to_string(errorCode));
+            clientFD.setState(FdState::FD_CLOSED);
             return;
         }
     } else if (bytesRead == 0) {
-        Logger::error("Client closed connection");
+        LOG_ERROR("Client closed connection");
         clientFD.setState(FdState::FD_CLOSED);
         return;
     }
 
-    Logger::debug("Client ID: " + std::to_string(id) + " received data, bytes read: " + std::to_string(bytesRead));
-    Logger::debug("Data: " + toHex(recvBuffer.data(), bytesRead, 512));
+    if (traced) Trace::span("read", id, 0, readNs);
+
+    LOG_DEBUG("Client ID: " + std::to_string(id) + " received data, bytes read: " + std::to_string(bytesRead));
+    LOG_DEBUG("Data: " + toHex(recvBuffer.data() + recvPending, bytesRead, 512));
+
+    size_t available = recvPending + bytesRead;
 
-    std::string prefaceStr = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
-    if (recvBuffer.size() >= prefaceStr.size() && 
-        std::equal(prefaceStr.begin(), prefaceStr.end(), recvBuffer.begin())) {
-        Logger::info("HTTP/2 preface received from client ID: " + std::to_string(id));
+    using http2::protocol::kConnectionPreface;
+    if (available >= sizeof(kConnectionPreface) &&
+        std::equal(std::begin(kConnectionPreface), std::end(kConnectionPreface), recvBuffer.begin())) {
+        LOG_INFO("HTTP/2 preface received from client ID: " + std::to_string(id));
         applySettings();
-        recvBuffer.erase(recvBuffer.begin(), recvBuffer.begin() + prefaceStr.size());
-        bytesRead -= prefaceStr.size();
+        recvBuffer.erase(recvBuffer.begin(), recvBuffer.begin() + sizeof(kConnectionPreface));
+        available -= sizeof(kConnectionPreface);
     }
 
-    std::vector<http2::protocol::Frame> frames = http2::protocol::Frame::toFrames(
-        recvBuffer.data(),
-        recvBuffer.data() + bytesRead);
+    size_t consumed = 0;
+    std::vector<http2::protocol::Frame> frames;
+    {
+        TraceSpan span(traced, "frame_parse", id);
+        frames = http2::protocol::Frame::toFrames(
+            recvBuffer.data(),
+            recvBuffer.data() + available,
+            consumed);
+    }
+
+    std::copy(recvBuffer.begin() + consumed, recvBuffer.begin() + available, recvBuffer.begin());
+    recvPending = available - consumed;
 
-    Logger::info("Received " + std::to_string(frames.size()) + " frames from client ID: " + std::to_string(id));
+    LOG_DEBUG("Received " + std::to_string(frames.size()) + " frames from client ID: " + std::to_string(id));
 
     for(const auto& frame: frames) {
+        // a GOAWAY either way ends the connection, the rest of the batch is not worth the work
+        if(clientFD.state == FD_CLOSED) break;
         if(frame.isPriority()) {
-            Logger::debug("Priority frame received for stream ID: " + std::to_string(frame.stream_id()));
+            LOG_DEBUG("Priority frame received for stream ID: " + std::to_string(frame.stream_id()));
         }
         if(FrameHandler::handleFrame(this, frame)) {
-            Logger::info("Handled frame of type: " + std::to_string(frame.type()) + 
+            LOG_DEBUG("Handled frame of type: " + std::to_string(frame.type()) + 
                          " for client ID: " + std::to_string(id));
         } else {
-            Logger::error("Error handling frame of type: " + std::to_string(frame.type()) + 
+            LOG_ERROR("Error handling frame of type: " + std::to_string(frame.type()) + 
                           " for client ID: " + std::to_string(id));
         }
     }
@@ -163,34 +475,15 @@ void Client::doRequest(epoll_event& event) {
 int Client::continueHandshake() {
     if(state != State::HANDSHAKE) return 1;
 
-    int ret = SSL_accept(ssl);
+    return handshakeStepDone(transport->handshake());
+}
 
-    if(ret > 0) {
-        const unsigned char* alpn = NULL;
-        unsigned int alpnLen = 0;
-        SSL_get0_alpn_selected(ssl, &alpn, &alpnLen);
-        
-        if (alpnLen == 2 && alpn[0] == 'h' && alpn[1] == '2') {
-            Logger::info("HTTP/2 negotiated via ALPN for client ID: " + std::to_string(id));
-            return 1;
-        } else {
-            Logger::error("HTTP/2 not negotiated via ALPN for client ID: " + std::to_string(id));
-            SSL_free(ssl);
-            state = State::CLIENT_CLOSED;
-            return -1;
-        }
-    } else {
-        int err = SSL_get_error(ssl, ret);
-        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
-            // Logger::debug("SSL_accept wants more data for client ID: " + std::to_string(id));
-            return 0;
-        } else {
-            ERR_print_errors_fp(stdout);
-            Logger::error("SSL_accept failed for client ID: " + std::to_string(id) + 
-                          ", error code: " + std::to_string(err));
-            SSL_free(ssl);
-            state = State::CLIENT_CLOSED;
-            return -1;
-        }
+int Client::handshakeStepDone(int ret) {
+    if (ret > 0) {
+        LOG_INFO("Client ID: " + std::to_string(id) + " connected over " + transport->name());
+        if (traced) Trace::span("handshake", id, 0, acceptedNs);
+    } else if (ret < 0) {
+        state = State::CLIENT_CLOSED;
     }
-}
\ No newline at end of file
+    return ret;
+}
@@ -10,9 +10,11 @@
 #include "http2/protocol/error.h"
 #include "http2/headers/headers.h"
 #include "Multithreading/threadPool.h"
+#include "Utils/Metrics/metrics.h"
+#include "Utils/Tracing/trace.h"
 #include "stream.h"
-#include <openssl/ssl.h>
-#include <openssl/err.h>
+#include "floodGuard.h"
+#include "Networking/Transport/transport.h"
 #include "Utils/toHex.cpp"
 #include "WebBinder/webBinder.h"
 #include "Response/response.h"
@@ -22,13 +24,16 @@
 
 #define TIMEOUT 600
 #define BUFFER_SIZE 4096
+#define DATA_CHUNK_SIZE 16384
+#define OUTPUT_HIGH_WATER (4 * DATA_CHUNK_SIZE) // stop producing DATA frames once this much is waiting on the socket
 
 enum State {
     CLIENT_IDLE,
     READING,
     WRITING,
     CLIENT_CLOSED,
-    HANDSHAKE
+    HANDSHAKE,
+    HANDSHAKING // a handshake step runs on a worker, which owns the transport until it is done
 };
 
 class Client {
@@ -42,9 +47,28 @@ public:
     Fd clientFD;
     std::map<int, Stream*> streams;
     int lastProcessedStream;
+    size_t peerStreams; // admitted streams the peer opened, limited by SETTINGS_MAX_CONCURRENT_STREAMS
+    bool admitted;      // counted by Admission, released when the client is removed
+    FloodGuard floodGuard;
+    bool waitingOnBody; // a stream's body returned WOULD_BLOCK in the last pumpStreams
+    int64_t drainDeadlineNs; // set once shed, the connection closes when its GOAWAY is out or at this time
+    uint32_t epollEvents;    // what the connection is registered for, kept by ClientManager::updateInterest
     ThreadPool* threadPool;
     std::vector<uint8_t> recvBuffer;
-    SSL* ssl;
+    size_t recvPending;
+    std::vector<uint8_t> outBuffer;
+    int64_t sendWindow;
+    int nextPushId; // server initiated streams use even IDs
+    int64_t acceptedNs;
+    bool traced; // sampled for Trace, spans of this connection and its streams are recorded
+
+    // when the transport can sendfile, DATA payloads of file bodies skip user space, the payload
+    // of the pending frame belongs at sendfileAt in outBuffer, right behind its header
+    std::shared_ptr<BodyStream> sendfileBody;
+    off_t sendfileOffset;
+    size_t sendfileLeft;
+    size_t sendfileAt;
+    std::unique_ptr<Transport> transport;
     WebBinder* binder;
     http2::protocol::Settings settings;
     State state;
@@ -69,29 +93,72 @@ public:
     };
 
 
+    // indexed by frame type
+    static const LabeledCounter framesIn;
+    static const LabeledCounter framesOut;
+
     static std::string getIp(const sockaddr_in6& addr); 
 
-    Client(int id, int fd, const sockaddr_in6& addr, socklen_t addrLen, SSL* ssl, WebBinder* binder);
+    // takes ownership of the transport, which closes the connection when the client is deleted
+    Client(int id, const sockaddr_in6& addr, socklen_t addrLen, Transport* transport, WebBinder* binder);
 
-    Client(int id, int fd, const sockaddr_in6& addr, socklen_t addrLen, ThreadPool* thPool, SSL* ssl, WebBinder* binder)
-        : Client(id, fd, addr, addrLen, ssl, binder) {
+    Client(int id, const sockaddr_in6& addr, socklen_t addrLen, ThreadPool* thPool, Transport* transport, WebBinder* binder)
+        : Client(id, addr, addrLen, transport, binder) {
         threadPool = thPool;
     }
 
+    ~Client();
+
     bool isTimedOut(const int timeout=TIMEOUT) const;
 
+    // handshake done, no streams and nothing left to send, safe to shed under overload
+    bool isIdle() const;
+
+    // nothing is queued for the socket
+    bool isDrained() const { return outBuffer.empty() && sendfileLeft == 0; }
+
     void doRequest(epoll_event& event);
 
     bool sendFrame(const http2::protocol::Frame& frame, int weight = 0);
 
+    // the last frame of the response went out
+    void streamFinished(Stream* strm);
+
+    // closes a stream whose response was sent in full, with RST_STREAM(NO_ERROR) if its request
+    // body is still on its way
+    void finishStream(int streamId);
+
     bool sendData(const std::vector<uint8_t>& data, int weight = 0);
 
+    bool flushOutput(int weight = 0);
+
+    ssize_t writeOut(size_t len, int weight);
+
+    ssize_t sendfileOut(int weight);
+
+    void pumpStreams();
+
+    bool writeDataFrame(Stream* stream);
+
+    bool resetStream(int streamId, http2::protocol::Error error);
+
+    void closeStream(int streamId);
+
+    bool sendGoaway(http2::protocol::Error error);
+
+    // GOAWAY with the error, the connection closes once the batch of frames is done
+    void connectionError(http2::protocol::Error error);
+
     bool acceptPreface();
 
     bool ackSettings(const http2::protocol::Frame& frame);
 
     bool applySettings();
 
+    // runs one handshake step on the calling thread
     int continueHandshake();
 
+    // bookkeeping for the result of a step, which may have run on another thread
+    int handshakeStepDone(int ret);
+
 };
\ No newline at end of file
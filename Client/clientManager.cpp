@@ -1,83 +1,109 @@
 #include "clientManager.h"
 #include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include "Networking/Transport/tlsTransport.h"
+#include "Networking/Transport/plainTransport.h"
 #include "fcntl.h"
+#include <cstdlib>
+#include <sys/eventfd.h>
+#include <netinet/tcp.h>
 
 int ClientManager::ctr = 0;
 std::map<int, Client*> ClientManager::clients;
-ThreadPool ClientManager::threadPool = ThreadPool(4);
 
+// SERVER_THREADS sizes the pool the responses are written from, 4 by default
+static size_t workerThreads() {
+    const char* threads = std::getenv("SERVER_THREADS");
+    int n = threads ? std::atoi(threads) : 0;
+    return n > 0 ? n : 4;
+}
+
+ThreadPool ClientManager::threadPool = ThreadPool(workerThreads());
+
+// HANDSHAKE_THREADS sizes the handshake pool, 2 by default, 0 runs handshakes on the event loop
+static size_t handshakeThreads() {
+    const char* threads = std::getenv("HANDSHAKE_THREADS");
+    int n = threads ? std::atoi(threads) : 2;
+    return n > 0 ? n : 0;
+}
+
+ThreadPool ClientManager::handshakePool = ThreadPool(handshakeThreads());
+bool ClientManager::offloadHandshakes = handshakeThreads() > 0;
+int ClientManager::wakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+int ClientManager::epollFD = -1;
+std::mutex ClientManager::handshakesMutex;
+std::vector<std::pair<int, int>> ClientManager::handshakesDone;
+std::set<int> ClientManager::waitingOnBodies;
+std::set<int> ClientManager::drainingClients;
+
+
+static const Counter connectionsAccepted("http2_connections_accepted_total", "Accepted TCP connections");
 
 Client* ClientManager::acceptClient(int socket, SSL_CTX* ctx, WebBinder* binder) {
-    struct sockaddr addr;
+    // the listeners are IPv6, a plain sockaddr would cut the address off
+    sockaddr_in6 addr{};
     socklen_t addrLen = sizeof(addr);
     
-    int clientFD = accept(socket, &addr, &addrLen);
+    int clientFD = accept(socket, reinterpret_cast<sockaddr*>(&addr), &addrLen);
 
     if(clientFD < 0) {
-        Logger::error("Failed to accept client connection: " + std::to_string(errno));
+        LOG_ERROR("Failed to accept client connection: " + std::to_string(errno));
         return nullptr;
     }
+    connectionsAccepted.add();
 
     int flags = fcntl(clientFD, F_GETFL, 0);
     if (flags < 0) {
-        Logger::error("Failed to get flags for client FD: " + std::to_string(clientFD));
+        LOG_ERROR("Failed to get flags for client FD: " + std::to_string(clientFD));
         close(clientFD);
         return nullptr;
     }
 
     flags |= O_NONBLOCK;
     if (fcntl(clientFD, F_SETFL, flags) < 0) {
-        Logger::error("Failed to set non-blocking mode for client FD: " + std::to_string(clientFD));
+        LOG_ERROR("Failed to set non-blocking mode for client FD: " + std::to_string(clientFD));
         close(clientFD);
         return nullptr;
     }
 
-    SSL* ssl = SSL_new(ctx);
-    SSL_set_fd(ssl, clientFD);
-    SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
-        
-    // if (SSL_accept(ssl) <= 0) {
-    //     ERR_print_errors_fp(stdout);
-    //     Logger::error("SSL_accept failed for client FD: " + std::to_string(clientFD));
-    //     SSL_free(ssl);
-    //     close(clientFD);
-    //     return nullptr;
-    // }
-    
-    // const unsigned char* alpn = NULL;
-    // unsigned int alpnLen = 0;
-    // SSL_get0_alpn_selected(ssl, &alpn, &alpnLen);
-    
-    // if (alpnLen == 2 && alpn[0] == 'h' && alpn[1] == '2') {
-    //     Logger::info("HTTP/2 negotiated via ALPN for client FD: " + std::to_string(clientFD));
-    // } else {
-    //     Logger::error("HTTP/2 not negotiated via ALPN for client FD: " + std::to_string(clientFD));
-    //     SSL_free(ssl);
-    //     close(clientFD);
-    //     return nullptr;
-    // } -> shift all this to be non blocking
+    // frames are written whole, Nagle would only hold back the tail of a response (and small
+    // TLS records) until the previous segment is acknowledged
+    int noDelay = 1;
+    if (setsockopt(clientFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) < 0) {
+        LOG_WARNING("Failed to set TCP_NODELAY for client FD: " + std::to_string(clientFD));
+    }
+
+    if (!Admission::admit(Client::getIp(addr))) {
+        close(clientFD);
+        return nullptr;
+    }
+
+    // cleartext listeners have no context, the client has to open with the preface right away
+    Transport* transport = ctx ? static_cast<Transport*>(new TlsTransport(ctx, clientFD))
+                               : new PlainTransport(clientFD);
 
-    Client* client = new Client(++ctr, clientFD, *reinterpret_cast<sockaddr_in6*>(&addr), addrLen, &threadPool, ssl, binder);
+    Client* client = new Client(++ctr, addr, addrLen, &threadPool, transport, binder);
+    client->admitted = true;
     clients[clientFD] = client;
 
-    Logger::info("Accepted new client with ID: " + std::to_string(client->id) + 
+    LOG_INFO("Accepted new client with ID: " + std::to_string(client->id) + 
                  " from IP: " + client->ip + 
                  " on socket with FD: " + std::to_string(socket));
 
     // if(!client->sendUpgradeHeader()) { // no update header for HTTP/2
-    //     Logger::error("Failed to send upgrade header to client ID: " + std::to_string(client->id));
+    //     LOG_ERROR("Failed to send upgrade header to client ID: " + std::to_string(client->id));
     //     removeClient(client->id);
     //     return nullptr;
     // }
 
     // if (!client->sendPreface()) {
-    //     Logger::error("Failed to send preface to client ID: " + std::to_string(client->id));
+    //     LOG_ERROR("Failed to send preface to client ID: " + std::to_string(client->id));
     //     removeClient(client->id);
     //     return nullptr;
     // }
 
     // if(!client->applySettings()) {
-    //     Logger::error("Failed to apply settings for client ID: " + std::to_string(client->id));
+    //     LOG_ERROR("Failed to apply settings for client ID: " + std::to_string(client->id));
     //     removeClient(client->id);
     //     return nullptr;
     // }
@@ -89,48 +115,214 @@ void ClientManager::clientLoop() {
     for (auto& pair : clients) {
         Client* client = pair.second;
         if (client->isTimedOut()) {
-            Logger::warning("Client ID: " + std::to_string(client->id) + " timed out.");
+            LOG_WARNING("Client ID: " + std::to_string(client->id) + " timed out.");
             removeClient(client->id);
         }
     }
 }
 
+static const Counter connectionsShed("http2_connections_shed_total", "Idle connections sent a GOAWAY under overload");
+static const Counter handshakesTimedOut("http2_handshakes_timed_out_total", "Connections closed under overload for a stalled handshake");
+
+void ClientManager::shedIdle() {
+    int64_t now = Metrics::now();
+    std::vector<int> idle, stalled;
+    for (const auto& [fd, client] : clients) {
+        if (client->drainDeadlineNs > 0) continue;
+        if (client->isIdle()) {
+            idle.push_back(fd);
+        } else if (client->state == State::HANDSHAKE && now - client->acceptedNs > HANDSHAKE_TIMEOUT_MS * 1000000LL) {
+            // HANDSHAKING ones belong to a worker, they are back in HANDSHAKE once it is done
+            stalled.push_back(client->id);
+        }
+    }
+    if (idle.empty() && stalled.empty()) return;
+
+    LOG_WARNING("Overloaded, shedding " + std::to_string(idle.size()) + " idle connections and " +
+                std::to_string(stalled.size()) + " stalled handshakes");
+    for (int id : stalled) {
+        handshakesTimedOut.add();
+        removeClient(id);
+    }
+    // closed once the GOAWAY has been sent, closing right away could lose it to a reset
+    for (int fd : idle) {
+        Client* client = clients[fd];
+        client->sendGoaway(http2::protocol::NO_ERROR);
+        updateInterest(client);
+        client->drainDeadlineNs = now + DRAIN_TIMEOUT_MS * 1000000LL;
+        drainingClients.insert(fd);
+        connectionsShed.add();
+    }
+    closeDrained();
+}
+
+void ClientManager::closeDrained() {
+    int64_t now = Metrics::now();
+    for (auto it = drainingClients.begin(); it != drainingClients.end(); ) {
+        auto client = clients.find(*it);
+        // gone already, or the FD was reused by a connection that is not draining
+        if (client == clients.end() || client->second->drainDeadlineNs == 0) {
+            it = drainingClients.erase(it);
+            continue;
+        }
+        if (client->second->isDrained() || now >= client->second->drainDeadlineNs) {
+            removeClient(client->second->id);
+            it = drainingClients.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+void ClientManager::resumeBodies() {
+    uint64_t count;
+    if (read(BodyStream::readyFD, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Failed to read body wakeups: " + std::to_string(errno));
+    }
+
+    // a signal does not say whose body is ready, every waiting client gets one non-blocking pass
+    std::set<int> waiting = std::move(waitingOnBodies);
+    waitingOnBodies.clear();
+    for (int fd : waiting) {
+        auto it = clients.find(fd);
+        if (it == clients.end()) continue;
+
+        Client* client = it->second;
+        client->pumpStreams();
+        if (client->waitingOnBody) waitingOnBodies.insert(fd);
+        updateInterest(client);
+    }
+}
+
+void ClientManager::updateInterest(Client* client) {
+    uint32_t events = EPOLLIN;
+    if (client->state == State::HANDSHAKING) {
+        // reports a hangup at most once, data that arrives meanwhile is read after the step
+        events = EPOLLONESHOT;
+    } else if (!client->isDrained()) {
+        events |= EPOLLOUT;
+    }
+    if (events == client->epollEvents) return;
+
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = client->clientFD.fd;
+    if (epoll_ctl(epollFD, EPOLL_CTL_MOD, client->clientFD.fd, &event) == -1) {
+        LOG_ERROR("Failed to update epoll events for client ID: " + std::to_string(client->id) +
+                  ", errno: " + std::to_string(errno));
+        return;
+    }
+    client->epollEvents = events;
+}
+
+void ClientManager::startHandshake(Client* client) {
+    client->state = State::HANDSHAKING;
+    updateInterest(client);
+    int fd = client->clientFD.fd;
+    Transport* transport = client->transport.get();
+
+    // the client is neither touched nor removed by the event loop until finishHandshakes
+    handshakePool.enqueue(0, [fd, transport]() {
+        int ret = transport->handshake();
+        {
+            std::lock_guard<std::mutex> lock(handshakesMutex);
+            handshakesDone.emplace_back(fd, ret);
+        }
+        uint64_t one = 1;
+        if (write(wakeFD, &one, sizeof(one)) < 0) {
+            LOG_ERROR("Failed to wake the event loop for client FD: " + std::to_string(fd));
+        }
+    });
+}
+
+void ClientManager::finishHandshakes() {
+    uint64_t count;
+    if (read(wakeFD, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        LOG_ERROR("Failed to read handshake wakeups: " + std::to_string(errno));
+    }
+
+    std::vector<std::pair<int, int>> done;
+    {
+        std::lock_guard<std::mutex> lock(handshakesMutex);
+        done.swap(handshakesDone);
+    }
+
+    for (const auto& [fd, ret] : done) {
+        auto it = clients.find(fd);
+        if (it == clients.end()) continue;
+
+        Client* client = it->second;
+        client->state = State::HANDSHAKE;
+        updateInterest(client);
+        if (!handshakeResult(client, client->handshakeStepDone(ret))) continue;
+
+        // the handshake may have read the preface and the first requests along with the
+        // Finished message, they are buffered in the transport where epoll cannot see them
+        epoll_event event{};
+        handleClient(client, event);
+        if (clients.count(fd) && client->clientFD.state == FD_CLOSED) {
+            removeClient(client->id);
+        }
+    }
+}
+
+bool ClientManager::handshakeResult(Client* client, int val) {
+    if(val == 1) {
+        LOG_INFO("Client ID: " + std::to_string(client->id) + " handshake completed.");
+        client->state = State::CLIENT_IDLE;
+        return true;
+    } else if(val < 0) {
+        LOG_ERROR("Error during handshake for client ID: " + std::to_string(client->id));
+        removeClient(client->id);
+        return false;
+    }
+    // LOG_DEBUG("Continuing handshake for client ID: " + std::to_string(client->id));
+    return false;
+}
+
 void ClientManager::handleClient(Client* client, epoll_event& event) {
+    if (client->state == State::HANDSHAKING) {
+        // a worker owns the transport until finishHandshakes hands the client back
+        return;
+    }
+
     if (client->isTimedOut()) {
-        Logger::warning("Client ID: " + std::to_string(client->id) + " timed out.");
+        LOG_WARNING("Client ID: " + std::to_string(client->id) + " timed out.");
         removeClient(client->id);
         return;
     }
 
     if(client->state == State::CLIENT_CLOSED) {
-        Logger::info("Client ID: " + std::to_string(client->id) + " is closed, removing from epoll.");
+        LOG_INFO("Client ID: " + std::to_string(client->id) + " is closed, removing from epoll.");
         removeClient(client->id);
         return;
     }
 
     try {
         if(client->state == HANDSHAKE) {
-            int val = client->continueHandshake();
-            if(val == 1) {
-                Logger::info("Client ID: " + std::to_string(client->id) + " handshake completed.");
-                client->state = State::CLIENT_IDLE;
-            } else if(val < 0) {
-                Logger::error("Error during handshake for client ID: " + std::to_string(client->id));
-                removeClient(client->id);
-                return;
-            } else {
-                // Logger::debug("Continuing handshake for client ID: " + std::to_string(client->id));
+            if (offloadHandshakes && client->transport->offloadHandshake()) {
+                startHandshake(client);
                 return;
             }
+            if (!handshakeResult(client, client->continueHandshake())) return;
         }
 
         if(client->state != State::CLIENT_IDLE) {
-            Logger::debug("Client ID: " + std::to_string(client->id) + " is not idle, skipping request handling.");
+            LOG_DEBUG("Client ID: " + std::to_string(client->id) + " is not idle, skipping request handling.");
             return;
         }
-        client->doRequest(event);
+        // epoll only reports what is still on the socket, a record the transport holds goes now
+        do {
+            client->doRequest(event);
+        } while (client->clientFD.state != FD_CLOSED && client->transport->hasBuffered());
+
+        if(client->clientFD.state != FD_CLOSED) {
+            client->pumpStreams();
+            if (client->waitingOnBody) waitingOnBodies.insert(client->clientFD.fd);
+            updateInterest(client);
+        }
     } catch (const std::exception& e) {
-        Logger::error("Error handling client ID: " + std::to_string(client->id) + " - " + e.what());
+        LOG_ERROR("Error handling client ID: " + std::to_string(client->id) + " - " + e.what());
         removeClient(client->id);
     }
 }
\ No newline at end of file
@@ -3,12 +3,16 @@
 #include <map>
 #include <netinet/in.h>
 #include "client.h"
+#include "admission.h"
 #include "Networking/Epoller/fileDescriptor.h"
 #include <algorithm>
 #include "Networking/Socket/socket.h"
 #include <sys/epoll.h>
 #include "Multithreading/threadPool.h"
 #include <openssl/ssl.h>
+#include <mutex>
+#include <vector>
+#include <set>
 #include "unistd.h"
 
 class ClientManager {
@@ -18,6 +22,20 @@ public:
 
     static ThreadPool threadPool;
 
+    // TLS handshakes run here so their public key crypto does not hold up established
+    // connections, a worker signals wakeFD when a step is done
+    static ThreadPool handshakePool;
+    static bool offloadHandshakes;
+    static int wakeFD;
+
+    // the event loop's epoll instance, set by the Epoller
+    static int epollFD;
+
+    // Level-triggered EPOLLOUT fires on every wait while the socket has room, so it is only
+    // registered while output is queued. A client whose handshake step is on a worker is
+    // disarmed with EPOLLONESHOT until finishHandshakes hands it back.
+    static void updateInterest(Client* client);
+
     static Client* getClient(int id) {
         auto functor = Client::findById(id);
         auto it = std::find_if(clients.begin(), clients.end(),
@@ -36,6 +54,7 @@ public:
     static void removeClient(Fd fd) {
         auto it = clients.find(fd.fd);
         if (it != clients.end()) {
+            if (it->second->admitted) Admission::release(it->second->ip);
             delete it->second;
             clients.erase(it);
         }
@@ -49,14 +68,42 @@ public:
                                });
 
         if (it != clients.end()) {
-            Logger::info("Removing client with ID: " + std::to_string(it->second->id));
+            LOG_INFO("Removing client with ID: " + std::to_string(it->second->id));
             it->second->clientFD.setState(FD_CLOSED);
-            clients.erase(it);
+            if (it->second->admitted) Admission::release(it->second->ip);
             delete it->second;
+            clients.erase(it);
         }
     }
 
     static void handleClient(Client* client, epoll_event& event);
 
+    // hands the next handshake step of the client to handshakePool
+    static void startHandshake(Client* client);
+
+    // on wakeFD: applies the steps the workers finished, on the event loop
+    static void finishHandshakes();
+
+    // false when the client is not ready for requests yet or was removed
+    static bool handshakeResult(Client* client, int val);
+
     static void clientLoop();
+
+    // on BodyStream::readyFD: pumps the clients whose streams were waiting for a body
+    static void resumeBodies();
+
+    // under overload: GOAWAY to every idle connection and closes the ones whose handshake
+    // stalled, their slots go to new ones
+    static void shedIdle();
+
+    // closes the shed connections whose GOAWAY went out or whose DRAIN_TIMEOUT_MS passed
+    static void closeDrained();
+
+    static bool draining() { return !drainingClients.empty(); }
+
+private:
+    static std::mutex handshakesMutex;
+    static std::vector<std::pair<int, int>> handshakesDone; // client FD, result of the step
+    static std::set<int> waitingOnBodies; // client FDs, only touched by the event loop
+    static std::set<int> drainingClients; // client FDs shed with a GOAWAY that is not out yet
 };
\ No newline at end of file
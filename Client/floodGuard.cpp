@@ -0,0 +1,50 @@
+#include "floodGuard.h"
+
+const LabeledCounter FloodGuard::floods("http2_flood_goaways_total", "Connections sent GOAWAY(ENHANCE_YOUR_CALM) by the budget they exhausted",
+                                        "budget", {"streams", "resets", "pings", "settings", "empty_data"});
+
+bool TokenBucket::take(int64_t nowNs) {
+    tokens = std::min(burst, tokens + (nowNs - lastNs) * rate / 1e9);
+    lastNs = nowNs;
+    if (tokens < 1) return false;
+
+    tokens -= 1;
+    return true;
+}
+
+FloodGuard::FloodGuard()
+    : buckets{
+        TokenBucket(STREAM_BUDGET_BURST, STREAM_BUDGET_RATE),
+        TokenBucket(RESET_BUDGET_BURST, RESET_BUDGET_RATE),
+        TokenBucket(PING_BUDGET_BURST, PING_BUDGET_RATE),
+        TokenBucket(SETTINGS_BUDGET_BURST, SETTINGS_BUDGET_RATE),
+        TokenBucket(EMPTY_DATA_BUDGET_BURST, EMPTY_DATA_BUDGET_RATE),
+    } {}
+
+FloodKind FloodGuard::charge(const http2::protocol::Frame& frame, bool opensStream) {
+    FloodKind kind = FLOOD_NONE;
+    switch (frame.type()) {
+        case http2::protocol::HEADERS_FRAME:
+            if (opensStream) kind = FLOOD_STREAMS;
+            break;
+        case http2::protocol::RST_STREAM_FRAME:
+            kind = FLOOD_RESETS;
+            break;
+        case http2::protocol::PING_FRAME:
+            // our own PINGs are not answered by more work, only the peer's cost an ACK
+            if (!frame.has_flag(http2::protocol::ACK)) kind = FLOOD_PINGS;
+            break;
+        case http2::protocol::SETTINGS_FRAME:
+            if (!frame.has_flag(http2::protocol::ACK)) kind = FLOOD_SETTINGS;
+            break;
+        case http2::protocol::DATA_FRAME:
+            if (frame.payload().empty() && !frame.has_flag(http2::protocol::END_STREAM)) kind = FLOOD_EMPTY_DATA;
+            break;
+        default:
+            break;
+    }
+
+    if (kind == FLOOD_NONE || buckets[kind].take(Metrics::now())) return FLOOD_NONE;
+    floods.add(kind);
+    return kind;
+}
@@ -0,0 +1,65 @@
+#include <cstdint>
+#include <algorithm>
+#include "http2/protocol/frame.h"
+#include "Utils/Metrics/metrics.h"
+
+// per connection budgets, a burst followed by a sustained rate per second, generous enough for
+// a browser loading a page and cancelling navigations. A stream we answered in full gives its
+// token back, so only streams the peer abandons count against the stream rate
+#define STREAM_BUDGET_BURST 500
+#define STREAM_BUDGET_RATE 200
+#define RESET_BUDGET_BURST 100
+#define RESET_BUDGET_RATE 50
+#define PING_BUDGET_BURST 20
+#define PING_BUDGET_RATE 5
+#define SETTINGS_BUDGET_BURST 20
+#define SETTINGS_BUDGET_RATE 5
+#define EMPTY_DATA_BUDGET_BURST 50
+#define EMPTY_DATA_BUDGET_RATE 20
+
+#pragma once
+
+enum FloodKind {
+    FLOOD_STREAMS,
+    FLOOD_RESETS,
+    FLOOD_PINGS,
+    FLOOD_SETTINGS,
+    FLOOD_EMPTY_DATA,
+    FLOOD_NONE
+};
+
+class TokenBucket {
+public:
+    TokenBucket(double burst, double rate) : tokens(burst), burst(burst), rate(rate), lastNs(Metrics::now()) {}
+
+    // false when the bucket is empty, a failed take costs nothing
+    bool take(int64_t nowNs);
+
+    void give() { tokens = std::min(burst, tokens + 1); }
+
+private:
+    double tokens;
+    double burst;
+    double rate;
+    int64_t lastNs;
+};
+
+// Frames that are cheap to send but make the server do work on every one: HEADERS opening a
+// stream, RST_STREAM (opening and resetting streams in a loop is CVE-2023-44487, rapid reset),
+// PING and SETTINGS that each need an ACK, and empty DATA frames without END_STREAM. Each kind
+// draws from its own bucket, a connection that drains one gets GOAWAY(ENHANCE_YOUR_CALM).
+class FloodGuard {
+public:
+    FloodGuard();
+
+    // FLOOD_NONE while the frame fits its budget, otherwise the budget it exhausted
+    FloodKind charge(const http2::protocol::Frame& frame, bool opensStream);
+
+    // the response of a peer stream went out completely
+    void streamAnswered() { buckets[FLOOD_STREAMS].give(); }
+
+    static const LabeledCounter floods;
+
+private:
+    TokenBucket buckets[FLOOD_NONE];
+};
@@ -1,6 +1,9 @@
 #include <vector>
+#include <memory>
 #include "http2/protocol/hpack/hpack.h"
 #include "http2/headers/headers.h"
+#include "http2/protocol/error.h"
+#include "Response/bodyStream.h"
 
 #pragma once
 
@@ -31,7 +34,19 @@ public:
     int dependency = UNSET;
 
     bool endHeader;
-    bool endStream;
+    bool endStream;     // the peer is done sending, END_STREAM arrived on HEADERS or DATA
+    bool responseSent = false; // the last frame of the response is queued
+
+    // response body still to be sent, produced one DATA frame at a time
+    std::shared_ptr<BodyStream> body;
+    int64_t sendWindow = 65535;
+
+    int64_t startNs = 0; // Metrics::now() when the request headers arrived, 0 for pushed streams
+
+    // a peer stream counted against the concurrency limits, or the code it is reset with once
+    // its headers are decoded (they still go through HPACK to keep the table in sync)
+    bool admitted = false;
+    http2::protocol::Error refusal = http2::protocol::NO_ERROR;
 
     Stream(int id, char weight = 0, StreamState state = IDLE)
         : id(id), weight(weight), state(state) {}
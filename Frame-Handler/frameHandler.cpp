@@ -1,23 +1,55 @@
 #include "frameHandler.h"
 #include "Client/client.h"
+#include "Client/admission.h"
+#include "Response/compressedBodyStream.h"
+#include "util.cpp"
+#include <algorithm>
+
+static const Counter hpackSavedIn("http2_hpack_bytes_saved_total", "Header bytes HPACK saved over sending them literally", "direction=\"in\"");
+static const Counter hpackSavedOut("http2_hpack_bytes_saved_total", "Header bytes HPACK saved over sending them literally", "direction=\"out\"");
+static const Histogram timeToFirstByte("http2_time_to_first_byte_seconds", "Request headers received to response headers queued");
+
+static size_t literalSize(const std::vector<http2::headers::Header>& headers) {
+    size_t size = 0;
+    for(const auto& header : headers) size += header.name.size() + header.value.size();
+    return size;
+}
+
 
+// a stream answered in full once its request headers are processed ends right away
+static void finishAnswered(Client* client, int streamId) {
+    auto it = client->streams.find(streamId);
+    if(it == client->streams.end() || it->second->body) return;
+    if(it->second->endStream || it->second->responseSent) {
+        client->finishStream(streamId);
+    }
+}
 
 bool FrameHandler::handleDataFrame(Client* client, const http2::protocol::Frame& frame) {
     if(client->streams.find(frame.stream_id()) == client->streams.end()) {
-        Logger::error("Data frame received for unknown stream ID: " + std::to_string(frame.stream_id()));
+        if((int) frame.stream_id() <= client->lastProcessedStream) {
+            // the rest of a request body sent before our RST_STREAM(NO_ERROR) arrived
+            LOG_DEBUG("Data frame received for closed stream ID: " + std::to_string(frame.stream_id()));
+            return true;
+        }
+        LOG_ERROR("Data frame received for unknown stream ID: " + std::to_string(frame.stream_id()));
         return false;
     }
 
     Stream* stream = client->streams[frame.stream_id()];
     if(stream->state != StreamState::OPEN) {
-        Logger::error("Data frame received for stream ID: " + std::to_string(frame.stream_id()) +
+        LOG_ERROR("Data frame received for stream ID: " + std::to_string(frame.stream_id()) +
                       " in open state");
         return false;
     }
 
     stream->data.insert(stream->data.end(), frame.payload().begin(), frame.payload().end());
-    stream->endStream = frame.has_flag(http2::protocol::END_STREAM);
-    stream->endHeader = frame.has_flag(http2::protocol::END_HEADERS);
+    if(frame.has_flag(http2::protocol::END_STREAM)) {
+        stream->endStream = true;
+        stream->state = StreamState::HALF_CLOSED_REMOTE;
+        // a response still being sent closes the stream once its last frame is out
+        finishAnswered(client, frame.stream_id());
+    }
     return true;
 }
 
@@ -28,7 +60,17 @@ bool FrameHandler::handleHeadersFrame(Client* client, const http2::protocol::Fra
     bool ok = true;
 
     if(client->streams.find(streamId) == client->streams.end()) {
-        client->streams[streamId] = new Stream(streamId);
+        Stream* created = new Stream(streamId);
+        created->sendWindow = client->settings.initial_window_size();
+        created->startNs = Metrics::now();
+        created->refusal = Admission::admitStream(client->peerStreams);
+        if(created->refusal == http2::protocol::NO_ERROR) {
+            created->admitted = true;
+            ++client->peerStreams;
+            ++Admission::openStreams;
+        }
+        client->streams[streamId] = created;
+        client->lastProcessedStream = std::max(client->lastProcessedStream, streamId);
     }
 
     client->streams[streamId]->state = StreamState::OPEN;
@@ -44,12 +86,7 @@ bool FrameHandler::handleHeadersFrame(Client* client, const http2::protocol::Fra
 
     if(endHeaders) {
         ok |= processEndHeader(client, strm);
-    }
-
-    if(endStream) {
-        strm->state = StreamState::CLOSED;
-        client->streams.erase(streamId);
-        Logger::debug("Stream ID " + std::to_string(streamId) + " closed");
+        finishAnswered(client, streamId);
     }
 
     return ok;
@@ -57,32 +94,44 @@ bool FrameHandler::handleHeadersFrame(Client* client, const http2::protocol::Fra
 
 bool FrameHandler::processEndHeader(Client* client, Stream* strm) {
     try {
-        client->hpackDecoder->decode_lowmem(
-            strm->headerFragments.data(),
-            strm->headerFragments.data() + strm->headerFragments.size(),
-            [&strm](http2::headers::Header header) {
-                strm->headers.add(std::move(header));
-            }
-        );
-        strm->state = StreamState::HALF_CLOSED_REMOTE;
+        {
+            TraceSpan span(client->traced, "hpack_decode", client->id, strm->id);
+            client->hpackDecoder->decode_lowmem(
+                strm->headerFragments.data(),
+                strm->headerFragments.data() + strm->headerFragments.size(),
+                [&strm](http2::headers::Header header) {
+                    strm->headers.add(std::move(header));
+                }
+            );
+        }
+        // a request body may follow in DATA frames
+        strm->state = strm->endStream ? StreamState::HALF_CLOSED_REMOTE : StreamState::OPEN;
         strm->endHeader = true;
+        size_t literal = literalSize(strm->headers.all());
+        if(literal > strm->headerFragments.size()) hpackSavedIn.add(literal - strm->headerFragments.size());
         strm->headerFragments.clear();
 
+        if(strm->refusal != http2::protocol::NO_ERROR) {
+            // not an error of the connection, the peer may retry the request later
+            client->resetStream(strm->id, strm->refusal);
+            return true;
+        }
+
         for (const auto& header : strm->headers.all()) {
-            Logger::debug("Header received: " + header.name + ": " + header.value);
+            LOG_DEBUG("Header received: " + header.name + ": " + header.value);
         }
 
         int i = client->hpackDecoder->table().best_match(":method");
         if(!i) {
-            Logger::error("No :method header found in headers for stream ID: " + std::to_string(strm->id));
+            LOG_ERROR("No :method header found in headers for stream ID: " + std::to_string(strm->id));
             return false;
         }
         string method = client->hpackDecoder->table().at(i).value;
-        Logger::debug("Method for stream ID " + std::to_string(strm->id) + ": " + method);
+        LOG_DEBUG("Method for stream ID " + std::to_string(strm->id) + ": " + method);
         if(method == "GET") {
             auto [found, p] = strm->headers.first(":path");
             if(!found) {
-                Logger::error("No :path header found in headers for stream ID: " + std::to_string(strm->id));
+                LOG_ERROR("No :path header found in headers for stream ID: " + std::to_string(strm->id));
                 return false;
             }
 
@@ -95,25 +144,59 @@ bool FrameHandler::processEndHeader(Client* client, Stream* strm) {
 
         return true;
     } catch (const std::exception& e) {
-        Logger::error("Error processing end header: " + std::string(e.what()));
+        LOG_ERROR("Error processing end header: " + std::string(e.what()));
         return false;
     }
 }
 
-bool FrameHandler::handleWindowUpdateFrame(Client* client, const http2::protocol::Frame &frame) {return true;}
-bool FrameHandler::handlePushPromiseFrame(Client* client, const http2::protocol::Frame &frame) {return true;}
+bool FrameHandler::handleWindowUpdateFrame(Client* client, const http2::protocol::Frame &frame) {
+    const std::vector<uint8_t>& p = frame.payload();
+    if(p.size() != 4) {
+        LOG_ERROR("Window update frame with invalid size: " + std::to_string(p.size()));
+        return false;
+    }
+
+    uint32_t increment = ((p[0] & 0x7F) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    if(increment == 0) {
+        LOG_ERROR("Window update frame with zero increment for stream ID: " + std::to_string(frame.stream_id()));
+        return false;
+    }
+
+    int64_t* window = &client->sendWindow;
+    if(frame.stream_id() != 0) {
+        auto it = client->streams.find(frame.stream_id());
+        if(it == client->streams.end()) {
+            // updates can race with the end of the stream, nothing left to send
+            return true;
+        }
+        window = &it->second->sendWindow;
+    }
+
+    if(*window + increment > 0x7FFFFFFF) {
+        LOG_ERROR("Window update overflows flow control window for stream ID: " + std::to_string(frame.stream_id()));
+        return false;
+    }
+
+    *window += increment;
+    return true;
+}
+bool FrameHandler::handlePushPromiseFrame(Client* client, const http2::protocol::Frame &frame) {
+    // only servers push, RFC 9113 section 8.4
+    LOG_ERROR("PUSH_PROMISE received from client ID: " + std::to_string(client->id));
+    return false;
+}
 
 bool FrameHandler::handleSettingsFrame(Client* client, const http2::protocol::Frame &frame) {
     if (frame.stream_id() != 0) {
-        Logger::error("Settings frame received with non-zero stream ID: " + std::to_string(frame.stream_id()));
+        LOG_ERROR("Settings frame received with non-zero stream ID: " + std::to_string(frame.stream_id()));
         return false;
     }
 
     if (!frame.has_flag(http2::protocol::ACK)) {
-        Logger::info("Received settings frame, applying settings");
+        LOG_DEBUG("Received settings frame, applying settings");
         return client->ackSettings(frame);
     } else {
-        Logger::info("Received settings ACK from client ID: " + std::to_string(client->id));
+        LOG_DEBUG("Received settings ACK from client ID: " + std::to_string(client->id));
     }
 
     return true;
@@ -121,7 +204,7 @@ bool FrameHandler::handleSettingsFrame(Client* client, const http2::protocol::Fr
 
 bool FrameHandler::handlePingFrame(Client* client, const http2::protocol::Frame &frame) {
     if (frame.stream_id() != 0) {
-        Logger::error("Ping frame received with non-zero stream ID: " + std::to_string(frame.stream_id()));
+        LOG_ERROR("Ping frame received with non-zero stream ID: " + std::to_string(frame.stream_id()));
         return false;
     }
 
@@ -134,7 +217,7 @@ bool FrameHandler::handlePingFrame(Client* client, const http2::protocol::Frame
     pingAck.mutable_payload() = frame.payload();
 
     if (!client->sendFrame(pingAck)) {
-        Logger::error("Failed to send PING ACK for client ID: " + std::to_string(client->id));
+        LOG_ERROR("Failed to send PING ACK for client ID: " + std::to_string(client->id));
         return false;
     }
 
@@ -142,36 +225,366 @@ bool FrameHandler::handlePingFrame(Client* client, const http2::protocol::Frame
 }
 
 bool FrameHandler::respondGet(Client* client, Stream* strm) {
+    TraceSpan span(client->traced, "respond_get", client->id, strm->id);
     auto [found, path] = strm->headers.first(":path");
     if(!found) {
-        Logger::error("No :path header found in headers for stream ID: " + std::to_string(strm->id));
+        LOG_ERROR("No :path header found in headers for stream ID: " + std::to_string(strm->id));
         return false;
     }
     
+    // a client that takes no pushes learns about the assets of the page before any work is done
+    // on the page itself, unless the request could end in a 304 or a 206 that needs none of them
+    if(strm->id % 2 == 1 && !client->settings.enable_push() && !strm->headers.first("range").first &&
+       !strm->headers.first("if-none-match").first && !strm->headers.first("if-modified-since").first) {
+        std::string links = preloadLinks(client->binder->pushAssets(path));
+        if(!links.empty() && sendEarlyHints(client, strm, links)) {
+            client->flushOutput(strm->weight);
+        }
+    }
+
+    int64_t lookupNs = client->traced ? Metrics::now() : 0;
     ResponseData content = client->binder->getContent(path);
-    if(content.data.empty()) {
-        Logger::error("No content found for path: " + path);
+    if(client->traced) Trace::span("content_lookup", client->id, strm->id, lookupNs);
+    if(content.empty()) {
+        LOG_ERROR("No content found for path: " + path);
         return false;
     }
 
-    // Logger::debug("Content for path " + path + ": " + htmlContent);
+    // LOG_DEBUG("Content for path " + path + ": " + htmlContent);
 
-    http2::protocol::Frame headerFrame(
-        http2::protocol::HEADERS_FRAME,
-        http2::protocol::END_HEADERS,
-        strm->id
-    );
+    // ranges are served from the identity representation of files only
+    auto [hasRange, range] = strm->headers.first("range");
+    bool ranged = hasRange && content.isFile() && ifRangeMatches(strm, content);
+
+    auto [hasAcceptEncoding, acceptEncoding] = strm->headers.first("accept-encoding");
+    if(hasAcceptEncoding && !ranged) {
+        TraceSpan span(client->traced, "apply_encoding", client->id, strm->id);
+        client->binder->applyEncoding(content, acceptEncoding);
+    }
+
+    bool dynamic = !content.isFile() && !content.sharedData;
+    if(!dynamic && isNotModified(strm, content)) {
+        return sendNotModified(client, strm, content);
+    }
+
+    if(ranged) {
+        std::vector<ByteRange> ranges;
+        switch(ByteRanges::parse(range, content.fileSize, ranges)) {
+            case ByteRanges::SATISFIABLE:
+                return sendPartialContent(client, strm, content, ranges);
+            case ByteRanges::UNSATISFIABLE:
+                return sendRangeNotSatisfiable(client, strm, content);
+            case ByteRanges::IGNORED:
+                break;
+        }
+    }
+
+    std::unique_ptr<BodyStream> body = content.takeBody();
+    if(!body) {
+        LOG_ERROR("Failed to open content for path: " + path);
+        return false;
+    }
+
+    // generated bodies such as directory listings cannot be compressed ahead of time
+    if(dynamic && hasAcceptEncoding) {
+        body = CompressedBodyStream::wrap(std::move(body), content.mimeType,
+                                          EncodingCache::acceptedEncodings(acceptEncoding), content.contentEncoding);
+    }
 
     http2::headers::Headers responseHeaders;
     responseHeaders.add(":status", "200");
     responseHeaders.add("cache-control", "private");
-    responseHeaders.add("content-type", content.mimeType);
-    responseHeaders.add("content-length", std::to_string(content.data.size()));
+    addContentHeaders(responseHeaders, content, body.get());
+    addValidatorHeaders(responseHeaders, content);
+    if(!dynamic) {
+        responseHeaders.add("accept-ranges", "bytes");
+    }
     responseHeaders.add("location", path);
     responseHeaders.add("server", "HTTP2Server/1.0");
+
+    // promised before the page goes out, so the client never requests the assets itself
+    std::vector<Stream*> pushed;
+    if(strm->id % 2 == 1) {
+        pushed = promisePushes(client, strm, path, responseHeaders);
+    }
+
+    if(!sendResponse(client, strm, responseHeaders, std::move(body))) {
+        return false;
+    }
+
+    for(Stream* push : pushed) {
+        sendPushedResponse(client, push);
+    }
+    return true;
+}
+
+std::vector<Stream*> FrameHandler::promisePushes(Client* client, Stream* strm, const std::string& path,
+                                                 http2::headers::Headers& responseHeaders) {
+    std::vector<Stream*> pushed;
+    if(!client->settings.enable_push()) return pushed;
+
+    std::vector<std::string> assets = client->binder->pushAssets(path);
+    if(assets.empty()) return pushed;
+
+    // the cookie names this exact set of asset versions, a client sending it back most likely has them cached
+    std::string token = client->binder->pushDigest(path);
+    char name[32];
+    snprintf(name, sizeof(name), "h2push-%08x", (unsigned) std::hash<std::string>{}(path.substr(0, path.find('?'))));
+
+    for(const auto& cookies : strm->headers.every("cookie")) {
+        size_t start = 0;
+        while(start < cookies.length()) {
+            size_t end = cookies.find(';', start);
+            if(end == std::string::npos) end = cookies.length();
+            if(Util::strip(cookies.substr(start, end - start)) == std::string(name) + "=" + token) {
+                LOG_DEBUG("Client already has the pushed assets of " + path + ", not pushing");
+                return pushed;
+            }
+            start = end + 1;
+        }
+    }
+
+    size_t active = 0;
+    for(const auto& [sid, stream] : client->streams) {
+        if(sid % 2 == 0) active++;
+    }
+
+    auto [hasAuthority, authority] = strm->headers.first(":authority");
+    auto [hasAcceptEncoding, acceptEncoding] = strm->headers.first("accept-encoding");
+
+    for(const auto& asset : assets) {
+        if(active + pushed.size() >= client->settings.max_concurrent_streams()) break;
+
+        Stream* push = new Stream(client->nextPushId, strm->weight, StreamState::RESERVED_LOCAL);
+        client->nextPushId += 2;
+        push->sendWindow = client->settings.initial_window_size();
+        push->endStream = true; // a promised stream never carries a request body
+        push->headers.add(":method", "GET");
+        push->headers.add(":scheme", "https");
+        if(hasAuthority) push->headers.add(":authority", authority);
+        push->headers.add(":path", asset);
+        if(hasAcceptEncoding) push->headers.add("accept-encoding", acceptEncoding);
+
+        std::vector<uint8_t> payload = {
+            uint8_t(push->id >> 24), uint8_t(push->id >> 16), uint8_t(push->id >> 8), uint8_t(push->id)
+        };
+        encodeHeaders(push->headers, payload);
+
+        http2::protocol::Frame promise(
+            http2::protocol::PUSH_PROMISE_FRAME,
+            http2::protocol::END_HEADERS,
+            strm->id
+        );
+        promise.mutable_payload() = std::move(payload);
+        if(!client->sendFrame(promise, strm->weight)) {
+            LOG_ERROR("Failed to send PUSH_PROMISE for " + asset + " on stream ID: " + std::to_string(strm->id));
+            delete push;
+            break;
+        }
+
+        LOG_DEBUG("Promised " + asset + " on stream ID: " + std::to_string(push->id));
+        client->streams[push->id] = push;
+        pushed.push_back(push);
+    }
+
+    if(!pushed.empty()) {
+        responseHeaders.add("set-cookie", std::string(name) + "=" + token +
+                            "; Path=/; Max-Age=86400; Secure; HttpOnly; SameSite=Lax");
+    }
+    return pushed;
+}
+
+std::string FrameHandler::preloadLinks(const std::vector<std::string>& assets) {
+    std::string links;
+    for(const auto& asset : assets) {
+        std::string mimeType = ResponseData::getMimeType(asset);
+        std::string as = "fetch";
+        if(mimeType == "text/css") as = "style";
+        else if(mimeType == "application/javascript") as = "script";
+        else if(mimeType.compare(0, 6, "image/") == 0) as = "image";
+        else if(mimeType.compare(0, 5, "font/") == 0) as = "font";
+
+        if(!links.empty()) links += ", ";
+        links += "<" + asset + ">; rel=preload; as=" + as;
+        if(as == "font" || as == "fetch") links += "; crossorigin";
+    }
+    return links;
+}
+
+bool FrameHandler::sendEarlyHints(Client* client, Stream* strm, const std::string& links) {
+    http2::headers::Headers hintHeaders;
+    hintHeaders.add(":status", "103");
+    hintHeaders.add("link", links);
+
+    // an informational response is a HEADERS frame that leaves the stream open for the final one
+    http2::protocol::Frame hints(http2::protocol::HEADERS_FRAME, http2::protocol::END_HEADERS, strm->id);
+    encodeHeaders(hintHeaders, hints.mutable_payload());
+
+    LOG_DEBUG("Sending early hints on stream ID: " + std::to_string(strm->id) + ": " + links);
+    if(!client->sendFrame(hints, strm->weight)) {
+        LOG_ERROR("Failed to send early hints for stream ID: " + std::to_string(strm->id));
+        return false;
+    }
+    return true;
+}
+
+void FrameHandler::sendPushedResponse(Client* client, Stream* push) {
+    int pushId = push->id;
+    push->state = StreamState::HALF_CLOSED_REMOTE;
+
+    if(!respondGet(client, push)) {
+        LOG_ERROR("Failed to respond to pushed stream ID: " + std::to_string(pushId));
+        client->resetStream(pushId, http2::protocol::CANCEL);
+        return;
+    }
+
+    auto it = client->streams.find(pushId);
+    if(it != client->streams.end() && !it->second->body) {
+        client->closeStream(pushId);
+    }
+}
+
+void FrameHandler::addContentHeaders(http2::headers::Headers& responseHeaders, const ResponseData& content,
+                                     const BodyStream* body) {
+    responseHeaders.add("content-type", content.mimeType);
+    if(body->remaining() != BodyStream::UNKNOWN_LENGTH) {
+        responseHeaders.add("content-length", std::to_string(body->remaining()));
+    }
+    if(!content.contentEncoding.empty()) {
+        responseHeaders.add("content-encoding", content.contentEncoding);
+    }
+    if(ResponseData::isCompressible(content.mimeType)) {
+        responseHeaders.add("vary", "accept-encoding");
+    }
+}
+
+void FrameHandler::addValidatorHeaders(http2::headers::Headers& responseHeaders, const ResponseData& content) {
+    if(!content.etag.empty()) {
+        responseHeaders.add("etag", content.etag);
+    }
+    if(content.mtimeNs > 0) {
+        responseHeaders.add("last-modified", Util::formatHttpDate(content.mtimeNs / 1000000000));
+    }
+}
+
+bool FrameHandler::isNotModified(const Stream* strm, const ResponseData& content) {
+    auto [hasIfNoneMatch, ifNoneMatch] = strm->headers.first("if-none-match");
+    if(hasIfNoneMatch) {
+        // if-none-match takes precedence over if-modified-since and uses the weak comparison
+        size_t start = 0;
+        while(start < ifNoneMatch.length()) {
+            size_t end = ifNoneMatch.find(',', start);
+            if(end == std::string::npos) end = ifNoneMatch.length();
+            std::string tag = Util::strip(ifNoneMatch.substr(start, end - start));
+            start = end + 1;
+
+            if(tag.compare(0, 2, "W/") == 0) tag = tag.substr(2);
+            if(tag == "*" || tag == content.etag) return true;
+        }
+        return false;
+    }
+
+    auto [hasIfModifiedSince, ifModifiedSince] = strm->headers.first("if-modified-since");
+    time_t since;
+    if(hasIfModifiedSince && content.mtimeNs > 0 && Util::parseHttpDate(ifModifiedSince, since)) {
+        return content.mtimeNs / 1000000000 <= since;
+    }
+
+    return false;
+}
+
+bool FrameHandler::sendNotModified(Client* client, Stream* strm, const ResponseData& content) {
+    LOG_DEBUG("Not modified, answering stream ID: " + std::to_string(strm->id) + " with 304");
+
+    http2::headers::Headers responseHeaders;
+    responseHeaders.add(":status", "304");
+    responseHeaders.add("cache-control", "private");
+    addValidatorHeaders(responseHeaders, content);
+    if(ResponseData::isCompressible(content.mimeType)) {
+        responseHeaders.add("vary", "accept-encoding");
+    }
+    responseHeaders.add("server", "HTTP2Server/1.0");
+
+    return sendResponse(client, strm, responseHeaders,
+                        std::make_unique<MemoryBodyStream>(std::make_shared<const std::vector<uint8_t>>()));
+}
+
+bool FrameHandler::ifRangeMatches(const Stream* strm, const ResponseData& content) {
+    auto [hasIfRange, ifRange] = strm->headers.first("if-range");
+    if(!hasIfRange) return true;
+
+    // if-range needs a strong match, otherwise the parts could come from different versions of the file
+    std::string validator = Util::strip(ifRange);
+    if(!validator.empty() && validator[0] == '"') {
+        return validator == content.etag;
+    }
+    if(validator.compare(0, 2, "W/") == 0) return false;
+
+    time_t date;
+    return content.mtimeNs > 0 && Util::parseHttpDate(validator, date) &&
+           content.mtimeNs / 1000000000 == date;
+}
+
+bool FrameHandler::sendPartialContent(Client* client, Stream* strm, const ResponseData& content,
+                                      const std::vector<ByteRange>& ranges) {
+    LOG_DEBUG("Answering stream ID: " + std::to_string(strm->id) + " with " +
+                  std::to_string(ranges.size()) + " byte range(s)");
+
+    http2::headers::Headers responseHeaders;
+    responseHeaders.add(":status", "206");
+    responseHeaders.add("cache-control", "private");
+
+    std::unique_ptr<BodyStream> body;
+    if(ranges.size() == 1) {
+        auto file = std::make_unique<FileBodyStream>(content.filePath, ranges[0].length(), ranges[0].first);
+        if(!file->isOpen()) return false;
+        body = std::move(file);
+        responseHeaders.add("content-type", content.mimeType);
+        responseHeaders.add("content-range", ByteRanges::contentRange(ranges[0], content.fileSize));
+    } else {
+        std::string boundary;
+        body = ByteRanges::multipartBody(content.filePath, content.fileSize, content.mimeType, ranges, boundary);
+        if(!body) return false;
+        responseHeaders.add("content-type", "multipart/byteranges; boundary=" + boundary);
+    }
+
+    responseHeaders.add("content-length", std::to_string(body->remaining()));
+    responseHeaders.add("accept-ranges", "bytes");
+    addValidatorHeaders(responseHeaders, content);
+    if(ResponseData::isCompressible(content.mimeType)) {
+        responseHeaders.add("vary", "accept-encoding");
+    }
+    responseHeaders.add("server", "HTTP2Server/1.0");
+
+    return sendResponse(client, strm, responseHeaders, std::move(body));
+}
+
+bool FrameHandler::sendRangeNotSatisfiable(Client* client, Stream* strm, const ResponseData& content) {
+    LOG_DEBUG("Unsatisfiable range, answering stream ID: " + std::to_string(strm->id) + " with 416");
+
+    http2::headers::Headers responseHeaders;
+    responseHeaders.add(":status", "416");
+    responseHeaders.add("content-range", "bytes */" + std::to_string(content.fileSize));
+    responseHeaders.add("accept-ranges", "bytes");
+    responseHeaders.add("server", "HTTP2Server/1.0");
+
+    return sendResponse(client, strm, responseHeaders,
+                        std::make_unique<MemoryBodyStream>(std::make_shared<const std::vector<uint8_t>>()));
+}
+
+bool FrameHandler::sendResponse(Client* client, Stream* strm, const http2::headers::Headers& responseHeaders,
+                                std::unique_ptr<BodyStream> body) {
+    bool endStream = body->remaining() == 0;
+    int64_t headersNs = client->traced ? Metrics::now() : 0;
+
+    http2::protocol::Frame headerFrame(
+        http2::protocol::HEADERS_FRAME,
+        http2::protocol::END_HEADERS | (endStream ? http2::protocol::END_STREAM : 0),
+        strm->id
+    );
+
     std::vector<uint8_t> encodedHeaders;
-    http2::protocol::hpack::Encoder hpackEncoder;
-    hpackEncoder.encode_all(responseHeaders.all(), encodedHeaders);
+    encodeHeaders(responseHeaders, encodedHeaders);
 
     headerFrame.mutable_payload().insert(
         headerFrame.mutable_payload().end(),
@@ -179,36 +592,45 @@ bool FrameHandler::respondGet(Client* client, Stream* strm) {
         encodedHeaders.end()
     );
 
-    http2::protocol::Frame dataFrame(
-        http2::protocol::DATA_FRAME,
-        http2::protocol::END_STREAM,
-        strm->id
-    );
-
-    dataFrame.mutable_payload().insert(
-        dataFrame.mutable_payload().end(),
-        content.data.begin(),
-        content.data.end()
-    );
-
     Response resp;
     resp.addFrame(headerFrame);
-    resp.addFrame(dataFrame);
     resp.processFrames();
     
     for(const auto& frame : resp.encodeFrames()) {
         if(!client->sendData(frame, strm->weight)) {
-            Logger::error("Failed to send response frame for stream ID: " + std::to_string(strm->id));
+            LOG_ERROR("Failed to send response frame for stream ID: " + std::to_string(strm->id));
             return false;
         }
     }
 
+    if(strm->startNs > 0) timeToFirstByte.recordSince(strm->startNs);
+    if(client->traced) Trace::span("send_headers", client->id, strm->id, headersNs);
+
+    // DATA frames are produced by the client as its flow control windows allow
+    if(!endStream) {
+        strm->body = std::move(body);
+        client->pumpStreams();
+    } else {
+        client->streamFinished(strm);
+    }
+
     return true;
 }
 
+void FrameHandler::encodeHeaders(const http2::headers::Headers& headers, std::vector<uint8_t>& out) {
+    size_t before = out.size();
+    http2::protocol::hpack::Encoder hpackEncoder;
+    hpackEncoder.encode_all(headers.all(), out);
+
+    size_t literal = literalSize(headers.all());
+    if(literal > out.size() - before) hpackSavedOut.add(literal - (out.size() - before));
+}
+
 bool FrameHandler::handleGoAwayFrame(Client* client, const http2::protocol::Frame &frame) {
-    Logger::info("Received GOAWAY frame from client ID: " + std::to_string(client->id));
-    client->streams.clear();
+    LOG_INFO("Received GOAWAY frame from client ID: " + std::to_string(client->id));
+    while(!client->streams.empty()) {
+        client->closeStream(client->streams.begin()->first);
+    }
     client->errorCode = http2::protocol::NO_ERROR;
     client->clientFD.setState(FdState::FD_CLOSED);
     return true;
@@ -218,13 +640,13 @@ bool FrameHandler::handleContinuationFrame(Client* client, const http2::protocol
     int sid = frame.stream_id();
 
     if(client->streams.find(sid) == client->streams.end()) {
-        Logger::error("Continuation frame received for unknown stream ID: " + std::to_string(sid));
+        LOG_ERROR("Continuation frame received for unknown stream ID: " + std::to_string(sid));
         return false;
     }
 
     Stream* stream = client->streams[sid];
     if(stream->state != StreamState::OPEN && stream->state != StreamState::HALF_CLOSED_REMOTE) {
-        Logger::error("Continuation frame received for stream ID: " + std::to_string(sid) +
+        LOG_ERROR("Continuation frame received for stream ID: " + std::to_string(sid) +
                       " in state: " + std::to_string(stream->state));
         return false;
     }
@@ -234,11 +656,13 @@ bool FrameHandler::handleContinuationFrame(Client* client, const http2::protocol
         frame.payload().begin(),
         frame.payload().end()
     );
+    // END_STREAM is only defined on the HEADERS frame, CONTINUATION leaves it as it was
     stream->endHeader = frame.has_flag(http2::protocol::END_HEADERS);
-    stream->endStream = frame.has_flag(http2::protocol::END_STREAM);
 
     if(stream->endHeader) {
-        return processEndHeader(client, stream);
+        bool ok = processEndHeader(client, stream);
+        finishAnswered(client, sid);
+        return ok;
     }
 
     return true;
@@ -247,13 +671,13 @@ bool FrameHandler::handleContinuationFrame(Client* client, const http2::protocol
 bool FrameHandler::handlePriorityFrame(Client* client, const http2::protocol::Frame &frame) {
     int streamId = frame.stream_id();
     if(client->streams.find(streamId) == client->streams.end()) {
-        Logger::error("Priority frame received for unknown stream ID: " + std::to_string(streamId));
+        LOG_ERROR("Priority frame received for unknown stream ID: " + std::to_string(streamId));
         return false;
     }
 
     Stream* stream = client->streams[streamId];
     if(!frame.isPriority()) {
-        Logger::error("Priority frame received without priority flag for stream ID: " + std::to_string(streamId));
+        LOG_ERROR("Priority frame received without priority flag for stream ID: " + std::to_string(streamId));
         return false;
     }
 
@@ -261,7 +685,7 @@ bool FrameHandler::handlePriorityFrame(Client* client, const http2::protocol::Fr
     stream->dependency = frame.streamDependency();
     stream->exclusive = frame.isExclusive();
 
-    Logger::debug("Priority frame processed for stream ID: " + std::to_string(streamId) +
+    LOG_DEBUG("Priority frame processed for stream ID: " + std::to_string(streamId) +
                   ", weight: " + std::to_string(stream->weight) +
                   ", dependency: " + std::to_string(stream->dependency) +
                   ", exclusive: " + (stream->exclusive ? "true" : "false"));
@@ -271,61 +695,37 @@ bool FrameHandler::handlePriorityFrame(Client* client, const http2::protocol::Fr
 
 
 bool FrameHandler::showErrorPage(Client* client, Stream* stream, int errorCode) {
-    Logger::error("Showing error page for client ID: " + std::to_string(client->id) + 
+    LOG_ERROR("Showing error page for client ID: " + std::to_string(client->id) + 
                   ", stream ID: " + std::to_string(stream->id) + 
                   ", error code: " + std::to_string(errorCode));
     
     ResponseData content = client->binder->getErrorPage(errorCode);
-    if(content.data.empty()) {
-        Logger::error("No error page found for error code: " + std::to_string(errorCode));
+    if(content.empty()) {
+        LOG_ERROR("No error page found for error code: " + std::to_string(errorCode));
         return false;
     }
 
-    http2::protocol::Frame headerFrame(
-        http2::protocol::HEADERS_FRAME,
-        http2::protocol::END_HEADERS,
-        stream->id
-    );
+    std::unique_ptr<BodyStream> body = content.takeBody();
+    if(!body) {
+        LOG_ERROR("Failed to open error page for error code: " + std::to_string(errorCode));
+        return false;
+    }
+
+    auto [hasAcceptEncoding, acceptEncoding] = stream->headers.first("accept-encoding");
+    if(hasAcceptEncoding) {
+        body = CompressedBodyStream::wrap(std::move(body), content.mimeType,
+                                          EncodingCache::acceptedEncodings(acceptEncoding), content.contentEncoding);
+    }
 
     http2::headers::Headers responseHeaders;
     responseHeaders.add(":status", std::to_string(errorCode));
     responseHeaders.add("cache-control", "private");
-    responseHeaders.add("content-type", content.mimeType);
-    responseHeaders.add("content-length", std::to_string(content.data.size()));
+    addContentHeaders(responseHeaders, content, body.get());
     responseHeaders.add("server", "HTTP2Server/1.0");
-    
-    std::vector<uint8_t> encodedHeaders;
-    http2::protocol::hpack::Encoder hpackEncoder;
-    hpackEncoder.encode_all(responseHeaders.all(), encodedHeaders);
-
-    headerFrame.mutable_payload().insert(
-        headerFrame.mutable_payload().end(),
-        encodedHeaders.begin(),
-        encodedHeaders.end()
-    );
-
-    http2::protocol::Frame dataFrame(
-        http2::protocol::DATA_FRAME,
-        http2::protocol::END_STREAM,
-        stream->id
-    );
-
-    dataFrame.mutable_payload().insert(
-        dataFrame.mutable_payload().end(),
-        content.data.begin(),
-        content.data.end()
-    );
 
-    Response resp;
-    resp.addFrame(headerFrame);
-    resp.addFrame(dataFrame);
-    resp.processFrames();
-    
-    for(const auto& frame : resp.encodeFrames()) {
-        if(!client->sendData(frame, stream->weight)) {
-            Logger::error("Failed to send error response frame for stream ID: " + std::to_string(stream->id));
-            return false;
-        }
+    if(!sendResponse(client, stream, responseHeaders, std::move(body))) {
+        LOG_ERROR("Failed to send error response frame for stream ID: " + std::to_string(stream->id));
+        return false;
     }
 
     return true;
@@ -334,25 +734,37 @@ bool FrameHandler::showErrorPage(Client* client, Stream* stream, int errorCode)
 bool FrameHandler::handleResetFrame(Client* client, const http2::protocol::Frame & frame) {
     int streamId = frame.stream_id();
     if(client->streams.find(streamId) == client->streams.end()) {
-        Logger::warning("Reset frame received for unknown stream ID: " + std::to_string(streamId));
+        LOG_WARNING("Reset frame received for unknown stream ID: " + std::to_string(streamId));
         return false;
     }
 
     Stream* stream = client->streams[streamId];
     if(stream->state == StreamState::CLOSED) {
-        Logger::warning("Reset frame received for already closed stream ID: " + std::to_string(streamId));
+        LOG_WARNING("Reset frame received for already closed stream ID: " + std::to_string(streamId));
         return false;
     }
 
-    stream->state = StreamState::CLOSED;
-    client->streams.erase(streamId);
-    Logger::info("Stream ID: " + std::to_string(streamId) + " has been reset and closed.");
+    client->closeStream(streamId);
+    LOG_DEBUG("Stream ID: " + std::to_string(streamId) + " has been reset and closed.");
     return true;
 }
 
 
 bool FrameHandler::handleFrame(Client* client, const http2::protocol::Frame &frame) {
-    Logger::debug("Handling frame of type: " + std::to_string(frame.type()) + 
+    Client::framesIn.add(frame.type());
+
+    // peer stream IDs only grow, a HEADERS frame past the last one opens a stream
+    FloodKind flood = client->floodGuard.charge(frame, (int) frame.stream_id() > client->lastProcessedStream);
+    if (flood != FLOOD_NONE) {
+        LOG_WARNING("Client ID: " + std::to_string(client->id) + " exceeded its budget for frame type " +
+                        std::to_string(frame.type()) + ", sending GOAWAY");
+        client->sendGoaway(http2::protocol::ENHANCE_YOUR_CALM);
+        client->errorCode = http2::protocol::ENHANCE_YOUR_CALM;
+        client->clientFD.setState(FdState::FD_CLOSED);
+        return false;
+    }
+
+    LOG_DEBUG("Handling frame of type: " + std::to_string(frame.type()) + 
                     " for client ID: " + std::to_string(client->id));
     switch (frame.type()) {
         case http2::protocol::DATA_FRAME:
@@ -376,7 +788,7 @@ bool FrameHandler::handleFrame(Client* client, const http2::protocol::Frame &fra
         case http2::protocol::CONTINUATION_FRAME:
             return handleContinuationFrame(client, frame);
         default:
-            Logger::error("Unknown frame type: " + std::to_string(frame.type()));
+            LOG_ERROR("Unknown frame type: " + std::to_string(frame.type()));
             return false;
     }
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include "http2/protocol/frame.h"
 #include "Utils/Logger/logger.h"
 #include "Client/stream.h"
+#include "Response/bodyStream.h"
+#include "Response/responseData.h"
+#include "Response/byteRanges.h"
+#include "http2/headers/headers.h"
+#include <memory>
 #pragma once
 
 
@@ -23,4 +28,22 @@ public:
     static bool respondGet(Client* client, Stream* stream);
     static bool processEndHeader(Client* client, Stream* stream);
     static bool showErrorPage(Client* client, Stream* stream, int errorCode = 404);
+    static void addContentHeaders(http2::headers::Headers& responseHeaders, const ResponseData& content,
+                                  const BodyStream* body);
+    static void addValidatorHeaders(http2::headers::Headers& responseHeaders, const ResponseData& content);
+    static bool isNotModified(const Stream* stream, const ResponseData& content);
+    static bool sendNotModified(Client* client, Stream* stream, const ResponseData& content);
+    static bool ifRangeMatches(const Stream* stream, const ResponseData& content);
+    static bool sendPartialContent(Client* client, Stream* stream, const ResponseData& content,
+                                   const std::vector<ByteRange>& ranges);
+    static bool sendRangeNotSatisfiable(Client* client, Stream* stream, const ResponseData& content);
+    static std::vector<Stream*> promisePushes(Client* client, Stream* stream, const std::string& path,
+                                              http2::headers::Headers& responseHeaders);
+    static void sendPushedResponse(Client* client, Stream* push);
+    static std::string preloadLinks(const std::vector<std::string>& assets);
+    static bool sendEarlyHints(Client* client, Stream* stream, const std::string& links);
+    // HPACK encodes headers onto the end of out
+    static void encodeHeaders(const http2::headers::Headers& headers, std::vector<uint8_t>& out);
+    static bool sendResponse(Client* client, Stream* stream, const http2::headers::Headers& responseHeaders,
+                             std::unique_ptr<BodyStream> body);
 };
\ No newline at end of file
@@ -1,6 +1,12 @@
 #include "threadPool.h"
 // see https://www.geeksforgeeks.org/cpp/thread-pool-in-cpp/
 
+std::atomic<int64_t> ThreadPool::queued{0};
+
+static const Histogram waitTime("http2_threadpool_wait_seconds", "Time tasks spend queued before a worker runs them");
+static const bool queueGauge = (Metrics::gauge("http2_threadpool_queued_tasks", "Tasks waiting for a worker",
+    [] { return (double) ThreadPool::queuedTasks(); }), true);
+
 ThreadPool::ThreadPool(size_t n) : stop(false) {
     for (size_t i = 0; i < n; ++i) {
         workers.emplace_back([this] {
@@ -12,7 +18,9 @@ ThreadPool::ThreadPool(size_t n) : stop(false) {
                         [this]{ return stop || !tasks.empty(); });
                     if (stop && tasks.empty()) return;
                     task = std::move(tasks.top().task);
+                    waitTime.recordSince(tasks.top().enqueuedNs);
                     tasks.pop();
+                    queued.fetch_sub(1, std::memory_order_relaxed);
                 }
                 task();
             }
@@ -7,6 +7,7 @@
 #include <atomic>
 #include <future>
 #include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
 
 #pragma once
 
@@ -14,8 +15,9 @@ class Task {
 public:
     std::function<void()> task;
     int weight;
+    int64_t enqueuedNs;
 
-    Task(std::function<void()> t, int w = 0) : task(t), weight(w) {}
+    Task(std::function<void()> t, int w = 0) : task(t), weight(w), enqueuedNs(Metrics::now()) {}
 
     bool operator<(const Task& other) const {
         return weight < other.weight;
@@ -38,17 +40,21 @@ public:
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
             if (stop) {
-                Logger::error("enqueue on stopped ThreadPool");
+                LOG_ERROR("enqueue on stopped ThreadPool");
                 throw std::runtime_error("enqueue on stopped ThreadPool");
             }
 
             tasks.push(Task([task](){ (*task)(); }, weight));
+            queued.fetch_add(1, std::memory_order_relaxed);
         }
         condition.notify_one();
         return res;
     }
 
 
+    // tasks waiting for a worker, over all pools
+    static int64_t queuedTasks() { return queued.load(std::memory_order_relaxed); }
+
     ~ThreadPool() {
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
@@ -65,4 +71,6 @@ private:
     std::mutex queue_mutex;
     std::condition_variable condition;
     std::atomic<bool> stop;
+
+    static std::atomic<int64_t> queued;
 };
\ No newline at end of file
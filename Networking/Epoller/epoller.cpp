@@ -1,6 +1,7 @@
 #include "epoller.h"
 #include "Utils/Logger/logger.h"
 #include <algorithm>
+#include <cerrno>
 
 
 Epoller::Epoller() {
@@ -10,20 +11,31 @@ Epoller::Epoller() {
     if (epollFD == -1) {
         Logger::fatal("Failed to create epoll file descriptor");
     }
-    Logger::info("Epoll file descriptor created with ID: " + std::to_string(epollFD));
+    LOG_INFO("Epoll file descriptor created with ID: " + std::to_string(epollFD));
+    ClientManager::epollFD = epollFD;
+
+    // handshake workers hand finished steps back through this one
+    addFD(ClientManager::wakeFD, EPOLLIN);
+    // and compression workers the chunks a stream was waiting for
+    addFD(BodyStream::readyFD, EPOLLIN);
 }
 
+// EPOLLOUT is only asked for while a client has output queued, see ClientManager::updateInterest
 bool Epoller::addFD(int fd) {
+    return addFD(fd, EPOLLIN);
+}
+
+bool Epoller::addFD(int fd, uint32_t events) {
     struct epoll_event event;
     event.data.fd = fd;
-    event.events = EPOLLIN | EPOLLOUT;
+    event.events = events;
 
     if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event) == -1) {
-        Logger::error("Failed to add file descriptor to epoll: " + std::to_string(fd));
+        LOG_ERROR("Failed to add file descriptor to epoll: " + std::to_string(fd));
         return false;
     }
 
-    Logger::info("Added file descriptor to epoll: " + std::to_string(fd));
+    LOG_DEBUG("Added file descriptor to epoll: " + std::to_string(fd));
     return true;
 }
 
@@ -31,32 +43,32 @@ bool Epoller::addFD(int fd, Client* client) {
     bool result = addFD(fd);
 
     if(!result) {
-        Logger::error("Failed to add file descriptor for client with ID: " + std::to_string(client->id));
+        LOG_ERROR("Failed to add file descriptor for client with ID: " + std::to_string(client->id));
         return false;
     }
 
-    Logger::info("Added file descriptor for client with ID: " + std::to_string(client->id));
+    LOG_DEBUG("Added file descriptor for client with ID: " + std::to_string(client->id));
     return true;
 }
 
 bool Epoller::removeFD(int fd) {
     if(epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, events.data()) == -1) {
-        Logger::error("Failed to remove file descriptor to epoll: " + std::to_string(fd));
+        LOG_ERROR("Failed to remove file descriptor to epoll: " + std::to_string(fd));
         return false;
     }
 
-    Logger::info("Removed file decriptor to epoll: " + std::to_string(fd));
+    LOG_DEBUG("Removed file decriptor to epoll: " + std::to_string(fd));
     return true;
 }
 
 bool Epoller::removeFD(int fd, Client* client) {
     bool result = removeFD(fd);
     if(!result) {
-        Logger::error("Faield to remove file descriptor for client with ID: " + std::to_string(client->id));
+        LOG_ERROR("Faield to remove file descriptor for client with ID: " + std::to_string(client->id));
         return false;
     }
 
-    Logger::info("Removed file descriptor for client with ID: " + std::to_string(client->id));
+    LOG_DEBUG("Removed file descriptor for client with ID: " + std::to_string(client->id));
     return true;
 }
 
@@ -82,21 +94,31 @@ EpollFdType Epoller::getType(int fd) {
 
     if(functor(epollFD)) return SERVER;
 
+    if(functor(ClientManager::wakeFD)) return WAKEUP;
+
+    if(functor(BodyStream::readyFD)) return BODY_READY;
+
     return NONE;
 }
 
 
 void Epoller::epollLoop() {
 
-    int nfd = epoll_wait(epollFD, events.data(), MAX_EVENTS, -1);
+    // while overloaded the loop wakes up on its own, idle connections have to be shed even
+    // when none of them sends anything, and shed ones closed once their drain deadline passes
+    int timeout = -1;
+    if (Admission::overloaded()) timeout = SHED_INTERVAL_MS;
+    if (ClientManager::draining()) timeout = DRAIN_TIMEOUT_MS / 4;
+    int nfd = epoll_wait(epollFD, events.data(), MAX_EVENTS, timeout);
 
     if (nfd == -1) {
-        Logger::error("Epoll wait failed");
+        // SIGHUP for a certificate reload interrupts the wait, that is not an error
+        if (errno != EINTR) LOG_ERROR("Epoll wait failed");
         return;
     }
 
     // if(nfd > 0) {
-    //     Logger::debug("Epoll wait returned " + std::to_string(nfd) + " events");
+    //     LOG_DEBUG("Epoll wait returned " + std::to_string(nfd) + " events");
     // }
 
     for(int i = 0; i < nfd; ++i) {
@@ -108,36 +130,62 @@ void Epoller::epollLoop() {
             if (it != ClientManager::clients.end()) {
                 Client* client = it->second;
                 ClientManager::handleClient(client, events[i]);
-                // Logger::info("Handling client event for client ID: " + std::to_string(client->id));
-                
+                // LOG_INFO("Handling client event for client ID: " + std::to_string(client->id));
+
+                // handleClient deletes clients it gives up on, closing their connection with them
+                if (ClientManager::clients.count(fd) == 0) continue;
+
                 if(client->clientFD.state == FD_CLOSED) {
-                    Logger::info("Client with ID " + std::to_string(client->id) + " is closed, removing from epoll");
+                    LOG_DEBUG("Client with ID " + std::to_string(client->id) + " is closed, removing from epoll");
                     removeFD(client->clientFD.fd, client);
                     ClientManager::removeClient(client->id);
                 }
                 
             } else {
-                Logger::warning("Unknown Client with FD " + std::to_string(fd));
+                LOG_WARNING("Unknown Client with FD " + std::to_string(fd));
             }
         } else if (type == SOCKET) {
             auto it1 = std::find_if(Socket::sockets.begin(), Socket::sockets.end(),
                                     [fd](Socket* socket) { return socket->sockFD == fd; });
             if (it1 != Socket::sockets.end()) {
                 Socket* socket = *it1;
-                Logger::info("Handling socket event for socket ID: " + std::to_string(socket->id));
+                LOG_DEBUG("Handling socket event for socket ID: " + std::to_string(socket->id));
                 Client* newClient = ClientManager::acceptClient(socket->sockFD, socket->ctx, binder);
                 if(newClient == nullptr) {
-                    Logger::error("Failed to accept new client from socket with FD: " + std::to_string(socket->sockFD));
+                    LOG_ERROR("Failed to accept new client from socket with FD: " + std::to_string(socket->sockFD));
                     continue;
                 }
                 addFD(newClient->clientFD.fd);
             } else {
-                Logger::warning("Unknown Socket with FD " + std::to_string(fd));
+                LOG_WARNING("Unknown Socket with FD " + std::to_string(fd));
             }
+        } else if (type == WAKEUP) {
+            ClientManager::finishHandshakes();
+        } else if (type == BODY_READY) {
+            ClientManager::resumeBodies();
         } else if (type == SERVER) {
-            Logger::info("Server event for epoll FD: " + std::to_string(epollFD));
+            LOG_DEBUG("Server event for epoll FD: " + std::to_string(epollFD));
+        } else {
+            LOG_WARNING("Unknown file descriptor type for FD: " + std::to_string(fd));
+        }
+    }
+
+    admitConnections();
+}
+
+void Epoller::admitConnections() {
+    if (Admission::shedDue()) ClientManager::shedIdle();
+    if (ClientManager::draining()) ClientManager::closeDrained();
+
+    // at the connection cap the listeners are not polled, new connections wait in the backlog
+    bool wasPaused = Admission::paused;
+    if (Admission::acceptPaused() == wasPaused) return;
+
+    for (Socket* socket : Socket::sockets) {
+        if (Admission::paused) {
+            removeFD(socket->sockFD);
         } else {
-            Logger::warning("Unknown file descriptor type for FD: " + std::to_string(fd));
+            addFD(socket->sockFD);
         }
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Networking/Socket/socket.h"
 #include "Client/client.h"
 #include "Client/clientManager.h"
+#include "Client/admission.h"
 #include "Networking/Epoller/fileDescriptor.h"
 #include <unistd.h>
 
@@ -20,6 +21,7 @@ public:
 
     bool addFD(int fd);
     bool addFD(int fd, Client* client);
+    bool addFD(int fd, uint32_t events);
     bool removeFD(int fd);
     bool removeFD(int fd, Client* client);
 
@@ -38,4 +40,7 @@ public:
     }
 
     void epollLoop();
+
+    // sheds idle connections under overload, pauses and resumes accepting at the connection cap
+    void admitConnections();
 };
\ No newline at end of file
@@ -12,7 +12,9 @@ enum EpollFdType {
     NONE = 0,
     SOCKET = 1,
     CLIENT = 2,
-    SERVER = 3
+    SERVER = 3,
+    WAKEUP = 4,
+    BODY_READY = 5
 };
 
 class Fd {
@@ -0,0 +1,242 @@
+#include "certStore.h"
+#include "socket.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include <set>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+std::shared_ptr<const CertStore::Contexts> CertStore::current;
+std::string CertStore::certDir;
+int CertStore::reloadFD = -1;
+
+static const LabeledCounter serverNames("http2_tls_sni_total", "Handshakes by how the certificate was chosen",
+                                        "result", {"matched", "fallback"});
+static const LabeledCounter reloads("http2_tls_cert_reloads_total", "Certificate reloads on SIGHUP",
+                                    "result", {"ok", "failed"});
+
+bool CertStore::install(SSL_CTX* listenerCtx, const std::string& dir) {
+    if (!current) {
+        certDir = dir;
+        std::shared_ptr<const Contexts> loaded = load();
+        if (!loaded) return false;
+        std::atomic_store(&current, loaded);
+
+        reloadFD = eventfd(0, EFD_CLOEXEC);
+        if (reloadFD < 0) {
+            LOG_ERROR("Failed to create the certificate reload eventfd, SIGHUP reloads are off");
+        } else {
+            std::thread(reloadLoop).detach();
+        }
+    }
+
+    // the listener's own context only carries the callbacks, every handshake moves to a loaded one
+    SSL_CTX_set_tlsext_servername_callback(listenerCtx, serverNameCb);
+    return true;
+}
+
+void CertStore::requestReload(int) {
+    uint64_t one = 1;
+    if (reloadFD >= 0 && write(reloadFD, &one, sizeof(one)) < 0) {
+        // nothing that is async-signal-safe can report this
+    }
+}
+
+void CertStore::reloadLoop() {
+    uint64_t count;
+    while (true) {
+        if (read(reloadFD, &count, sizeof(count)) < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Certificate reload thread stopped: " + std::to_string(errno));
+            return;
+        }
+
+        LOG_INFO("Reloading certificates");
+        std::shared_ptr<const Contexts> loaded = load();
+        if (!loaded) {
+            LOG_ERROR("Certificate reload failed, keeping the certificates already loaded");
+            reloads.add(1);
+            continue;
+        }
+        // connections already past the SNI callback hold references to the old contexts
+        std::atomic_store(&current, loaded);
+        reloads.add(0);
+    }
+}
+
+std::shared_ptr<SSL_CTX> CertStore::newContext() {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) return nullptr;
+
+    static const unsigned char sessionContext[] = "http2-server";
+    SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1);
+    SSL_CTX_set_alpn_select_cb(ctx, Socket::alpnSelectCb, NULL);
+    return std::shared_ptr<SSL_CTX>(ctx, SSL_CTX_free);
+}
+
+bool CertStore::usePair(SSL_CTX* ctx, const std::string& certFile, const std::string& keyFile) {
+    // a context keeps one certificate per key type, the chain file decides which slot it fills
+    if (SSL_CTX_use_certificate_chain_file(ctx, certFile.c_str()) <= 0 ||
+        SSL_CTX_use_PrivateKey_file(ctx, keyFile.c_str(), SSL_FILETYPE_PEM) <= 0 ||
+        SSL_CTX_check_private_key(ctx) <= 0) {
+        LOG_ERROR("Failed to load certificate " + certFile + " with key " + keyFile);
+        ERR_print_errors_fp(stdout);
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> CertStore::hostNames(X509* cert) {
+    std::vector<std::string> names;
+
+    GENERAL_NAMES* altNames = static_cast<GENERAL_NAMES*>(X509_get_ext_d2i(cert, NID_subject_alt_name, nullptr, nullptr));
+    for (int i = 0; altNames && i < sk_GENERAL_NAME_num(altNames); ++i) {
+        const GENERAL_NAME* name = sk_GENERAL_NAME_value(altNames, i);
+        if (name->type != GEN_DNS) continue;
+        const unsigned char* data = ASN1_STRING_get0_data(name->d.dNSName);
+        names.emplace_back(reinterpret_cast<const char*>(data), ASN1_STRING_length(name->d.dNSName));
+    }
+    GENERAL_NAMES_free(altNames);
+
+    if (names.empty()) {
+        char commonName[256];
+        if (X509_NAME_get_text_by_NID(X509_get_subject_name(cert), NID_commonName, commonName, sizeof(commonName)) > 0) {
+            names.emplace_back(commonName);
+        }
+    }
+
+    for (auto& name : names) {
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    }
+    return names;
+}
+
+std::shared_ptr<const CertStore::Contexts> CertStore::load() {
+    auto contexts = std::make_shared<Contexts>();
+
+    // pairs covering the same names share a context, one slot per key type (RSA, ECDSA, ...)
+    struct Group {
+        std::shared_ptr<SSL_CTX> ctx;
+        std::set<int> keyTypes;
+    };
+    std::map<std::string, Group> groups;
+
+    auto add = [&](const std::string& certFile, const std::string& keyFile) -> std::shared_ptr<SSL_CTX> {
+        FILE* file = fopen(certFile.c_str(), "r");
+        if (!file) {
+            LOG_ERROR("Failed to open certificate " + certFile);
+            return nullptr;
+        }
+        X509* cert = PEM_read_X509(file, nullptr, nullptr, nullptr);
+        fclose(file);
+        if (!cert) {
+            LOG_ERROR("No PEM certificate in " + certFile);
+            return nullptr;
+        }
+        std::vector<std::string> names = hostNames(cert);
+        int keyType = EVP_PKEY_get_base_id(X509_get0_pubkey(cert));
+        X509_free(cert);
+
+        std::vector<std::string> sorted = names;
+        std::sort(sorted.begin(), sorted.end());
+        std::string groupKey;
+        for (const auto& name : sorted) groupKey += name + " ";
+
+        Group& group = groups[groupKey];
+        if (group.ctx && group.keyTypes.count(keyType)) {
+            LOG_ERROR("Certificate " + certFile + " repeats the key type of another one for the same names");
+            return nullptr;
+        }
+        if (!group.ctx) group.ctx = newContext();
+        if (!group.ctx || !usePair(group.ctx.get(), certFile, keyFile)) return nullptr;
+        group.keyTypes.insert(keyType);
+
+        for (const auto& name : names) {
+            if (name.rfind("*.", 0) == 0) {
+                contexts->wildcards.emplace(name.substr(2), group.ctx);
+            } else {
+                contexts->exact.emplace(name, group.ctx);
+            }
+        }
+        LOG_INFO("Loaded certificate " + certFile + " for " + (groupKey.empty() ? "no names" : groupKey) +
+                 (keyType == EVP_PKEY_EC ? "(ECDSA)" : keyType == EVP_PKEY_RSA ? "(RSA)" : ""));
+        return group.ctx;
+    };
+
+    if (access(DEFAULT_CERT_FILE, R_OK) == 0) {
+        contexts->fallback = add(DEFAULT_CERT_FILE, DEFAULT_KEY_FILE);
+        if (!contexts->fallback) return nullptr;
+    }
+
+    if (!certDir.empty()) {
+        std::error_code ec;
+        std::vector<std::filesystem::path> certFiles;
+        for (const auto& entry : std::filesystem::directory_iterator(certDir, ec)) {
+            if (entry.path().extension() == ".crt") certFiles.push_back(entry.path());
+        }
+        if (ec) {
+            LOG_ERROR("Failed to read certificate directory " + certDir + ": " + ec.message());
+            return nullptr;
+        }
+        std::sort(certFiles.begin(), certFiles.end());
+
+        for (const auto& certFile : certFiles) {
+            std::filesystem::path keyFile = certFile;
+            keyFile.replace_extension(".key");
+            std::shared_ptr<SSL_CTX> ctx = add(certFile.string(), keyFile.string());
+            if (!ctx) {
+                // all or nothing, a half-written deployment must not drop the names it touches
+                return nullptr;
+            }
+            if (!contexts->fallback) contexts->fallback = ctx;
+        }
+    }
+
+    if (!contexts->fallback) {
+        LOG_ERROR("No TLS certificate could be loaded");
+        return nullptr;
+    }
+
+    for (auto& [key, group] : groups) {
+        if (group.ctx) contexts->all.push_back(group.ctx);
+    }
+    return contexts;
+}
+
+SSL_CTX* CertStore::Contexts::find(const char* serverName) const {
+    if (!serverName) return nullptr;
+
+    std::string name(serverName);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    auto it = exact.find(name);
+    if (it != exact.end()) return it->second.get();
+
+    // a wildcard covers exactly one label
+    size_t dot = name.find('.');
+    if (dot != std::string::npos) {
+        auto wildcard = wildcards.find(name.substr(dot + 1));
+        if (wildcard != wildcards.end()) return wildcard->second.get();
+    }
+    return nullptr;
+}
+
+int CertStore::serverNameCb(SSL* ssl, int* alert, void* arg) {
+    std::shared_ptr<const Contexts> contexts = std::atomic_load(&current);
+    if (!contexts) return SSL_TLSEXT_ERR_NOACK;
+
+    SSL_CTX* ctx = contexts->find(SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name));
+    serverNames.add(ctx ? 0 : 1);
+
+    // SSL_set_SSL_CTX takes its own reference, a reload cannot free the context under the connection
+    SSL_set_SSL_CTX(ssl, ctx ? ctx : contexts->fallback.get());
+    return SSL_TLSEXT_ERR_OK;
+}
@@ -0,0 +1,53 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <openssl/ssl.h>
+
+#define DEFAULT_CERT_FILE "server.crt"
+#define DEFAULT_KEY_FILE "server.key"
+
+#pragma once
+
+// Certificates for every hostname the server answers to, picked per connection by SNI. Each set
+// of names gets its own preloaded SSL_CTX, which can hold an RSA and an ECDSA certificate side by
+// side, OpenSSL signs with ECDSA whenever the client supports it. SIGHUP loads everything again
+// on a thread of its own and swaps the result in, handshakes in flight keep the contexts they
+// already switched to.
+class CertStore {
+public:
+    // server.crt/server.key in the working directory are the fallback for clients without SNI or
+    // with an unknown name. certDir adds every <name>.crt with a <name>.key next to it, matched
+    // by the DNS names of its subjectAltName (or its CN). False when no certificate loaded at all.
+    static bool install(SSL_CTX* listenerCtx, const std::string& certDir);
+
+    // SIGHUP handler, only signals the reload thread
+    static void requestReload(int signal);
+
+private:
+    struct Contexts {
+        std::shared_ptr<SSL_CTX> fallback;
+        std::map<std::string, std::shared_ptr<SSL_CTX>> exact;     // lower case host names
+        std::map<std::string, std::shared_ptr<SSL_CTX>> wildcards; // "*.example.com" stored as "example.com"
+        std::vector<std::shared_ptr<SSL_CTX>> all;
+
+        SSL_CTX* find(const char* serverName) const;
+    };
+
+    static std::shared_ptr<const Contexts> current;
+    static std::string certDir;
+    static int reloadFD;
+
+    static std::shared_ptr<const Contexts> load();
+
+    // a context configured like the listener's, ALPN and session ID context included
+    static std::shared_ptr<SSL_CTX> newContext();
+
+    static bool usePair(SSL_CTX* ctx, const std::string& certFile, const std::string& keyFile);
+
+    static std::vector<std::string> hostNames(X509* cert);
+
+    static void reloadLoop();
+
+    static int serverNameCb(SSL* ssl, int* alert, void* arg);
+};
@@ -1,5 +1,9 @@
 #include "socket.h"
 #include "Utils/Logger/logger.h"
+#include "ticketKeys.h"
+#include "certStore.h"
+#include <cstdlib>
+#include <fstream>
 #include <unistd.h>
 #include "fcntl.h"
 
@@ -11,27 +15,24 @@ const unsigned char Socket::alpnProtocol[] = {
     // 8, 'h', 't', 't', 'p', '/', '1', '.', '1'
 };
 
-Socket::Socket(int port) : port(port), id(ctr++), sockFD(-1) {
+Socket::Socket(int port, bool tls) : port(port), id(ctr++), sockFD(-1), ctx(nullptr) {
 
-    ctx = SSL_CTX_new(TLS_server_method());
-    if (!ctx) {
-        Logger::error("Failed to create SSL context");
-        ERR_print_errors_fp(stdout);
-        return;
-    }
+    if (tls) {
+        ctx = SSL_CTX_new(TLS_server_method());
+        if (!ctx) {
+            LOG_ERROR("Failed to create SSL context");
+            ERR_print_errors_fp(stdout);
+            return;
+        }
 
-    if (SSL_CTX_use_certificate_file(ctx, "server.crt", SSL_FILETYPE_PEM) <= 0) {
-        Logger::error("Failed to load certificate");
-        ERR_print_errors_fp(stdout);
-        return;
-    }
-    if (SSL_CTX_use_PrivateKey_file(ctx, "server.key", SSL_FILETYPE_PEM) <= 0) {
-        Logger::error("Failed to load private key");
-        ERR_print_errors_fp(stdout);
-        return;
-    }
+        SSL_CTX_set_alpn_select_cb(ctx, alpnSelectCb, NULL);
 
-    SSL_CTX_set_alpn_select_cb(ctx, alpnSelectCb, NULL);
+        const char* certDir = std::getenv("TLS_CERT_DIR");
+        if (!CertStore::install(ctx, certDir ? certDir : "")) {
+            LOG_ERROR("Failed to load certificates");
+            return;
+        }
+    }
 
 
     addr.sin6_family = AF_INET6;
@@ -42,7 +43,7 @@ Socket::Socket(int port) : port(port), id(ctr++), sockFD(-1) {
     sockFD = socket(AF_INET6, SOCK_STREAM, 0);
     
     if (sockFD < 0) {
-        Logger::error("Failed to create socket");
+        LOG_ERROR("Failed to create socket");
         close(sockFD);
         return;
     }
@@ -50,19 +51,19 @@ Socket::Socket(int port) : port(port), id(ctr++), sockFD(-1) {
     int opt = 1;
     if(setsockopt(sockFD, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
         // so that we can run on the same port without waiting
-        Logger::error("Failed to set socket options");
+        LOG_ERROR("Failed to set socket options");
         close(sockFD);
         return;
     }
 
     if (bind(sockFD, (struct sockaddr*)&addr, addrLen) < 0) {
-        Logger::error("Failed to bind socket");
+        LOG_ERROR("Failed to bind socket");
         close(sockFD);
         return;
     }
 
     if (listen(sockFD, MAX_QUEUE) < 0) {
-        Logger::error("Failed to listen on socket");
+        LOG_ERROR("Failed to listen on socket");
         close(sockFD);
         return;
     }
@@ -70,16 +71,64 @@ Socket::Socket(int port) : port(port), id(ctr++), sockFD(-1) {
     int flags = fcntl(sockFD, F_GETFL, O_NONBLOCK | O_CLOEXEC);
     
     if (flags == -1) {
-        Logger::error("Failed to get socket flags");
+        LOG_ERROR("Failed to get socket flags");
         close(sockFD);
         return;
     }
 
 
-    Logger::info("Socket created and listening on port " + std::to_string(port));
+    LOG_INFO(std::string(tls ? "TLS" : "Cleartext h2c") + " socket created and listening on port " + std::to_string(port));
     sockets.push_back(this);
 }
 
+bool Socket::enableKtls() {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (!ctx) return false;
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+
+    // the tls module may still be loaded on the first connection, each handshake logs the outcome
+    std::ifstream ulps("/proc/sys/net/ipv4/tcp_available_ulp");
+    std::string ulp;
+    bool available = false;
+    while (ulps >> ulp) available = available || ulp == "tls";
+    if (available) {
+        LOG_INFO("Kernel TLS requested for socket ID: " + std::to_string(id));
+    } else {
+        LOG_WARNING("Kernel TLS requested for socket ID: " + std::to_string(id) +
+                    ", but the kernel has no tls module loaded yet (modprobe tls)");
+    }
+    return true;
+#else
+    LOG_WARNING("Kernel TLS is not supported by this OpenSSL build");
+    return false;
+#endif
+}
+
+bool Socket::enableSessionResumption(const std::string& ticketKeyFile, int rotateSeconds, long cacheSize) {
+    if (!ctx) return false;
+
+    if (!TicketKeys::install(ctx, ticketKeyFile, rotateSeconds)) {
+        LOG_ERROR("Session tickets disabled for socket ID: " + std::to_string(id));
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        return false;
+    }
+    // a ticket outlives the rotation that retires its key by one period
+    SSL_CTX_set_timeout(ctx, 2 * (rotateSeconds > 0 ? rotateSeconds : TICKET_ROTATE_SECONDS));
+
+    if (cacheSize > 0) {
+        static const unsigned char sessionContext[] = "http2-server";
+        SSL_CTX_set_session_id_context(ctx, sessionContext, sizeof(sessionContext) - 1);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, cacheSize);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    LOG_INFO("Session resumption enabled for socket ID: " + std::to_string(id) +
+             (ticketKeyFile.empty() ? ", generated ticket keys" : ", ticket keys from " + ticketKeyFile) +
+             ", session cache size: " + std::to_string(cacheSize));
+    return true;
+}
 
 int Socket::alpnSelectCb(SSL *ssl, const unsigned char **out, 
                                     unsigned char *outlen, const unsigned char *in, 
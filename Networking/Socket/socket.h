@@ -2,6 +2,7 @@
 #include <vector>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <string>
 
 #define PORT 8080
 #define MAX_QUEUE 5
@@ -15,7 +16,7 @@ public:
     int sockFD;
     sockaddr_in6 addr;
     socklen_t addrLen;
-    SSL_CTX* ctx;
+    SSL_CTX* ctx; // nullptr on cleartext listeners
 
     static std::vector<Socket*> sockets;
     static int ctr;
@@ -26,7 +27,17 @@ public:
                             unsigned char *outlen, const unsigned char *in, 
                             unsigned int inlen, void *arg); 
 
-    Socket(int port);
+    // tls = false listens for cleartext HTTP/2 with prior knowledge (h2c), no certificate is loaded
+    Socket(int port, bool tls = true);
+
+    // asks OpenSSL to hand record encryption to the kernel, connections fall back
+    // to user-space TLS when the kernel or the negotiated cipher does not support it
+    bool enableKtls();
+
+    // stateless session tickets under TicketKeys (shared keys from ticketKeyFile, or generated
+    // ones when it is empty), plus a server-side session cache of cacheSize entries for clients
+    // that resume by session ID, 0 leaves the cache off
+    bool enableSessionResumption(const std::string& ticketKeyFile, int rotateSeconds, long cacheSize);
 
     Socket(): Socket(PORT) {}
 
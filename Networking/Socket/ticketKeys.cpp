@@ -0,0 +1,133 @@
+#include "ticketKeys.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
+
+std::mutex TicketKeys::mutex;
+std::vector<TicketKeys::Key> TicketKeys::keys;
+std::string TicketKeys::file;
+int TicketKeys::rotateSeconds = TICKET_ROTATE_SECONDS;
+time_t TicketKeys::nextRotation = 0;
+
+static const LabeledCounter ticketsUsed("http2_tls_tickets_total", "Session tickets issued and presented", "result",
+                                        {"issued", "accepted", "renewed", "unknown_key"});
+enum { TICKET_ISSUED, TICKET_ACCEPTED, TICKET_RENEWED, TICKET_UNKNOWN_KEY };
+
+bool TicketKeys::install(SSL_CTX* ctx, const std::string& keyFile, int rotate) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (keys.empty()) {
+        file = keyFile;
+        rotateSeconds = rotate > 0 ? rotate : TICKET_ROTATE_SECONDS;
+        if (file.empty()) {
+            generate();
+        } else if (!load()) {
+            return false;
+        }
+        nextRotation = time(nullptr) + rotateSeconds;
+    }
+
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, callback);
+    return true;
+}
+
+bool TicketKeys::load() {
+    std::ifstream in(file, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    if (!in.good() && !in.eof()) {
+        LOG_ERROR("Failed to read session ticket keys from " + file);
+        return false;
+    }
+    if (bytes.empty() || bytes.size() % TICKET_KEY_SIZE != 0) {
+        LOG_ERROR("Session ticket key file " + file + " must hold a multiple of " +
+                  std::to_string(TICKET_KEY_SIZE) + " bytes, it has " + std::to_string(bytes.size()));
+        return false;
+    }
+
+    std::vector<Key> loaded(bytes.size() / TICKET_KEY_SIZE);
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        memcpy(&loaded[i], bytes.data() + i * TICKET_KEY_SIZE, TICKET_KEY_SIZE);
+    }
+    OPENSSL_cleanse(bytes.data(), bytes.size());
+
+    keys.swap(loaded);
+    OPENSSL_cleanse(loaded.data(), loaded.size() * sizeof(Key));
+    LOG_INFO("Loaded " + std::to_string(keys.size()) + " session ticket keys from " + file);
+    return true;
+}
+
+void TicketKeys::generate() {
+    Key key;
+    if (RAND_bytes(reinterpret_cast<unsigned char*>(&key), sizeof(key)) <= 0) {
+        LOG_ERROR("Failed to generate a session ticket key, keeping the current ones");
+        return;
+    }
+    keys.insert(keys.begin(), key);
+    if (keys.size() > TICKET_KEYS_KEPT) {
+        OPENSSL_cleanse(&keys.back(), sizeof(Key));
+        keys.pop_back();
+    }
+    OPENSSL_cleanse(&key, sizeof(key));
+    LOG_INFO("Generated a new session ticket key");
+}
+
+void TicketKeys::rotateIfDue() {
+    time_t now = time(nullptr);
+    if (now < nextRotation) return;
+    nextRotation = now + rotateSeconds;
+
+    // a file that went missing or is being rewritten keeps the keys from the last good read
+    if (file.empty()) {
+        generate();
+    } else {
+        load();
+    }
+}
+
+int TicketKeys::callback(SSL* ssl, unsigned char* keyName, unsigned char* iv,
+                         EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    rotateIfDue();
+    if (keys.empty()) return 0;
+
+    const Key* key = nullptr;
+    int result = 1;
+
+    if (encrypt) {
+        key = &keys.front();
+        if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) <= 0) return -1;
+        memcpy(keyName, key->name, sizeof(key->name));
+        if (!EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->aes, iv)) return -1;
+        ticketsUsed.add(TICKET_ISSUED);
+    } else {
+        for (const Key& candidate : keys) {
+            if (memcmp(candidate.name, keyName, sizeof(candidate.name)) == 0) {
+                key = &candidate;
+                break;
+            }
+        }
+        if (!key) {
+            // rotated out or issued elsewhere, the client falls back to a full handshake
+            ticketsUsed.add(TICKET_UNKNOWN_KEY);
+            return 0;
+        }
+        if (!EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->aes, iv)) return -1;
+
+        // still valid, but the client gets a new ticket under the current key
+        result = key == &keys.front() ? 1 : 2;
+        ticketsUsed.add(result == 1 ? TICKET_ACCEPTED : TICKET_RENEWED);
+    }
+
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key->hmac), sizeof(key->hmac)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0),
+        OSSL_PARAM_construct_end()
+    };
+    if (!EVP_MAC_CTX_set_params(mac, params)) return -1;
+
+    return result;
+}
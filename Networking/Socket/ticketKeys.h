@@ -0,0 +1,46 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <ctime>
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+
+#define TICKET_KEY_SIZE 80        // 16 bytes key name, 32 bytes HMAC secret, 32 bytes AES key
+#define TICKET_KEYS_KEPT 3        // generated keys: the current one and two that still decrypt
+#define TICKET_ROTATE_SECONDS 3600
+
+#pragma once
+
+// Keys for stateless TLS session tickets, shared by every TLS listener. They are loaded from a
+// file the whole fleet gets, so a ticket issued by one server resumes on any other behind the
+// load balancer, or generated in-process when there is no file. The first key encrypts new
+// tickets, the rest only decrypt tickets issued before the last rotation.
+class TicketKeys {
+public:
+    struct Key {
+        unsigned char name[16];
+        unsigned char hmac[32];
+        unsigned char aes[32];
+    };
+
+    // file holds one or more 80 byte keys back to back (`openssl rand 240 > ticket.keys`). It is
+    // read again every rotateSeconds, so the fleet rotates by rewriting it with a new key first.
+    // Without a file a new random key is generated every rotateSeconds instead.
+    static bool install(SSL_CTX* ctx, const std::string& file, int rotateSeconds = TICKET_ROTATE_SECONDS);
+
+private:
+    static std::mutex mutex;
+    static std::vector<Key> keys;
+    static std::string file;
+    static int rotateSeconds;
+    static time_t nextRotation;
+
+    static bool load();
+
+    static void generate();
+
+    static void rotateIfDue();
+
+    static int callback(SSL* ssl, unsigned char* keyName, unsigned char* iv,
+                        EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int encrypt);
+};
@@ -0,0 +1,19 @@
+#include "memoryTransport.h"
+#include "Utils/Logger/logger.h"
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+MemoryTransport::MemoryTransport() : PlainTransport(-1), peerFD(-1) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) < 0) {
+        LOG_ERROR("Failed to create socketpair for memory transport: " + std::to_string(errno));
+        return;
+    }
+    fd = pair[0];
+    peerFD = pair[1];
+}
+
+MemoryTransport::~MemoryTransport() {
+    if (peerFD >= 0) close(peerFD);
+}
@@ -0,0 +1,16 @@
+#include "plainTransport.h"
+
+#pragma once
+
+// One end of a local socketpair, peerFD is the other end for whoever plays the client. Runs the
+// frame, HPACK and handler stack without a network or TLS in the way, for benchmarks and profiling.
+class MemoryTransport : public PlainTransport {
+public:
+    int peerFD;
+
+    MemoryTransport();
+
+    ~MemoryTransport() override;
+
+    const char* name() const override { return "memory"; }
+};
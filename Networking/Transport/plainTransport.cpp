@@ -0,0 +1,52 @@
+#include "plainTransport.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include "http2/protocol/constants.h"
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+static const Counter prefacesRejected("http2_cleartext_prefaces_rejected_total", "Cleartext connections that did not open with the HTTP/2 preface");
+
+PlainTransport::~PlainTransport() {
+    if (fd >= 0) close(fd);
+}
+
+int PlainTransport::handshake() {
+    using http2::protocol::kConnectionPreface;
+
+    uint8_t head[sizeof(kConnectionPreface)];
+    ssize_t n = recv(fd, head, sizeof(head), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    if (n == 0) return -1;
+
+    if (memcmp(head, kConnectionPreface, n) != 0) {
+        LOG_WARNING("Cleartext connection FD: " + std::to_string(fd) + " did not open with the HTTP/2 preface");
+        prefacesRejected.add();
+        return -1;
+    }
+    // a preface split across segments is checked again once the rest arrives
+    return (size_t) n == sizeof(head) ? 1 : 0;
+}
+
+ssize_t PlainTransport::read(uint8_t* buf, size_t len) {
+    return recv(fd, buf, len, MSG_DONTWAIT);
+}
+
+ssize_t PlainTransport::write(const uint8_t* buf, size_t len) {
+    ssize_t sent = send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (sent < 0) LOG_ERROR("Error writing to connection FD: " + std::to_string(fd) + ", errno: " + std::to_string(errno));
+    return sent;
+}
+
+ssize_t PlainTransport::sendfile(int fileFD, off_t offset, size_t len) {
+    ssize_t sent = ::sendfile(fd, fileFD, &offset, len);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (sent < 0) LOG_ERROR("Error sending file to connection FD: " + std::to_string(fd) + ", errno: " + std::to_string(errno));
+    return sent;
+}
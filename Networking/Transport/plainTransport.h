@@ -0,0 +1,26 @@
+#include "transport.h"
+
+#pragma once
+
+// HTTP/2 straight over TCP, for listeners behind a proxy that already terminated TLS
+class PlainTransport : public Transport {
+public:
+    explicit PlainTransport(int fd) : Transport(fd) {}
+
+    ~PlainTransport() override;
+
+    // prior knowledge: the first bytes have to be the client connection preface, it is only
+    // peeked at and left for the client to read, HTTP/1.1 and Upgrade: h2c are not served
+    int handshake() override;
+
+    ssize_t read(uint8_t* buf, size_t len) override;
+
+    ssize_t write(const uint8_t* buf, size_t len) override;
+
+    // nothing is encrypted, the kernel copies file bodies straight from the page cache
+    bool canSendfile() const override { return true; }
+
+    ssize_t sendfile(int fileFD, off_t offset, size_t len) override;
+
+    const char* name() const override { return "tcp"; }
+};
@@ -0,0 +1,146 @@
+#include "tlsTransport.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+
+static const Histogram fullHandshakes("http2_tls_handshake_seconds", "Accept to completed TLS handshake", "type=\"full\"");
+static const Histogram resumedHandshakes("http2_tls_handshake_seconds", "Accept to completed TLS handshake", "type=\"resumed\"");
+static const LabeledCounter recordBytes("http2_tls_record_bytes_total", "Bytes written in small and full size TLS records",
+                                       "size", {"small", "full"});
+static const Counter handshakesFailed("http2_tls_handshakes_failed_total", "TLS handshakes that failed or did not negotiate h2");
+
+TlsTransport::TlsTransport(SSL_CTX* ctx, int fd)
+    : Transport(fd), ssl(SSL_new(ctx)), acceptedNs(Metrics::now()), ktlsSend(false),
+      smallRecords(false), smallBytesLeft(0), lastWriteNs(0), writePending(false) {
+    SSL_set_fd(ssl, fd);
+    SSL_set_mode(ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
+}
+
+TlsTransport::~TlsTransport() {
+    // close_notify keeps the session in the cache, OpenSSL drops sessions of unclean closes
+    if (SSL_is_init_finished(ssl)) SSL_shutdown(ssl);
+    SSL_free(ssl);
+    if (fd >= 0) close(fd);
+}
+
+// SSL_get_error reads the calling thread's error queue, anything left there by an earlier call
+// on another connection would turn a plain WANT_READ into a failure, so every call starts clean
+
+int TlsTransport::handshake() {
+    ERR_clear_error();
+    int ret = SSL_accept(ssl);
+
+    if (ret <= 0) {
+        int err = SSL_get_error(ssl, ret);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            return 0;
+        }
+        ERR_print_errors_fp(stdout);
+        handshakesFailed.add();
+        LOG_ERROR("SSL_accept failed for FD: " + std::to_string(fd) + ", error code: " + std::to_string(err));
+        return -1;
+    }
+
+    const unsigned char* alpn = NULL;
+    unsigned int alpnLen = 0;
+    SSL_get0_alpn_selected(ssl, &alpn, &alpnLen);
+
+    if (alpnLen != 2 || alpn[0] != 'h' || alpn[1] != '2') {
+        LOG_ERROR("HTTP/2 not negotiated via ALPN for FD: " + std::to_string(fd));
+        handshakesFailed.add();
+        return -1;
+    }
+
+    LOG_INFO("HTTP/2 negotiated via ALPN for FD: " + std::to_string(fd));
+    // the histogram counts make up the full versus resumed handshake totals
+    (SSL_session_reused(ssl) ? resumedHandshakes : fullHandshakes).recordSince(acceptedNs);
+
+#ifndef OPENSSL_NO_KTLS
+    ktlsSend = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    if (ktlsSend) {
+        LOG_INFO("Kernel TLS send offload active for FD: " + std::to_string(fd));
+    } else if (SSL_get_options(ssl) & SSL_OP_ENABLE_KTLS) {
+        LOG_INFO("Kernel declined TLS send offload for FD: " + std::to_string(fd) + ", encrypting in user space");
+    }
+#endif
+    return 1;
+}
+
+ssize_t TlsTransport::read(uint8_t* buf, size_t len) {
+    ERR_clear_error();
+    int bytesRead = SSL_read(ssl, buf, len);
+    if (bytesRead >= 0) return bytesRead;
+
+    int err = SSL_get_error(ssl, bytesRead);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+    } else if (err == SSL_ERROR_ZERO_RETURN) {
+        return 0;
+    } else if (errno == 0 || errno == EAGAIN) {
+        // a protocol error, errno is whatever the last syscall left behind
+        errno = EPROTO;
+    }
+    return -1;
+}
+
+void TlsTransport::sizeRecords() {
+    int64_t now = Metrics::now();
+    bool idle = now - lastWriteNs > TLS_RECORD_IDLE_MS * 1000000LL;
+    lastWriteNs = now;
+    if (writePending) return;
+
+    if (idle) smallBytesLeft = TLS_SMALL_RECORDS * TLS_SMALL_RECORD;
+    bool small = smallBytesLeft > 0;
+    if (small != smallRecords) {
+        // lowering the maximum lowers the split size as well, growing has to raise both
+        size_t recordSize = small ? TLS_SMALL_RECORD : SSL3_RT_MAX_PLAIN_LENGTH;
+        SSL_set_max_send_fragment(ssl, recordSize);
+        SSL_set_split_send_fragment(ssl, recordSize);
+        smallRecords = small;
+    }
+}
+
+ssize_t TlsTransport::write(const uint8_t* buf, size_t len) {
+    sizeRecords();
+
+    ERR_clear_error();
+    int bytesSent = SSL_write(ssl, buf, len);
+    if (bytesSent > 0) {
+        writePending = false;
+        if (smallRecords) {
+            smallBytesLeft -= std::min<size_t>(smallBytesLeft, bytesSent);
+        }
+        recordBytes.add(smallRecords ? 0 : 1, bytesSent);
+        return bytesSent;
+    }
+
+    int err = SSL_get_error(ssl, bytesSent);
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        // socket buffer is full, the same bytes are retried on the next event
+        writePending = true;
+        return 0;
+    }
+    LOG_ERROR("Error writing TLS record to FD: " + std::to_string(fd) + ", errno: " + std::to_string(errno));
+    return -1;
+}
+
+ssize_t TlsTransport::sendfile(int fileFD, off_t offset, size_t len) {
+#ifndef OPENSSL_NO_KTLS
+    ERR_clear_error();
+    ossl_ssize_t bytesSent = SSL_sendfile(ssl, fileFD, offset, len, 0);
+    if (bytesSent > 0) {
+        // the kernel sizes these records itself, the transfer still keeps the connection busy
+        lastWriteNs = Metrics::now();
+        return bytesSent;
+    }
+
+    int err = SSL_get_error(ssl, bytesSent);
+    if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+        return 0;
+    }
+    LOG_ERROR("Error sending file to FD: " + std::to_string(fd) + ", errno: " + std::to_string(errno));
+#endif
+    return -1;
+}
@@ -0,0 +1,53 @@
+#include "transport.h"
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+// records that fit one TCP segment, each can be decrypted as soon as it arrives
+#define TLS_SMALL_RECORD 1400
+// small records sent before growing to the 16 KB maximum, about once the congestion window opened
+#define TLS_SMALL_RECORDS 40
+// a pause this long lets the congestion window collapse, the next burst starts small again
+#define TLS_RECORD_IDLE_MS 1000
+
+#pragma once
+
+// TLS through OpenSSL, the handshake has to negotiate h2 via ALPN
+class TlsTransport : public Transport {
+public:
+    SSL* ssl;
+    int64_t acceptedNs;
+
+    // kernel TLS lets file bodies go out through SSL_sendfile, known once the handshake is done
+    bool ktlsSend;
+
+    // dynamic record sizing: small records at the start and after idle, full ones once the
+    // connection is streaming
+    bool smallRecords;
+    size_t smallBytesLeft;
+    int64_t lastWriteNs;
+    bool writePending; // a retried SSL_write must not change the record size under it
+
+    TlsTransport(SSL_CTX* ctx, int fd);
+
+    ~TlsTransport() override;
+
+    int handshake() override;
+
+    bool offloadHandshake() const override { return true; }
+
+    ssize_t read(uint8_t* buf, size_t len) override;
+
+    // the rest of a record that did not fit the last read
+    bool hasBuffered() const override { return SSL_has_pending(ssl); }
+
+    ssize_t write(const uint8_t* buf, size_t len) override;
+
+    // picks the record size for the next write
+    void sizeRecords();
+
+    bool canSendfile() const override { return ktlsSend; }
+
+    ssize_t sendfile(int fileFD, off_t offset, size_t len) override;
+
+    const char* name() const override { return "tls"; }
+};
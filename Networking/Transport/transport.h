@@ -0,0 +1,42 @@
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+#pragma once
+
+// The byte stream a Client speaks HTTP/2 over. It owns the connection's file descriptor and
+// never blocks, calls that cannot make progress are retried on the next epoll event.
+class Transport {
+public:
+    int fd;
+
+    explicit Transport(int fd) : fd(fd) {}
+
+    virtual ~Transport() = default;
+
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    // 1 once the connection is ready for the preface, 0 while waiting on the peer, -1 on failure
+    virtual int handshake() = 0;
+
+    // whether handshake() does enough work (public key crypto) to be run off the event loop
+    virtual bool offloadHandshake() const { return false; }
+
+    // bytes read, 0 once the peer closed, -1 with errno set (EAGAIN when nothing is buffered)
+    virtual ssize_t read(uint8_t* buf, size_t len) = 0;
+
+    // data already taken off the socket that read() has not returned yet, epoll cannot see it
+    virtual bool hasBuffered() const { return false; }
+
+    // bytes written, 0 when the socket buffer is full, -1 on error
+    virtual ssize_t write(const uint8_t* buf, size_t len) = 0;
+
+    // whether file bodies can be handed to sendfile instead of being read into user space
+    virtual bool canSendfile() const { return false; }
+
+    // same contract as write, for len bytes of fileFD starting at offset
+    virtual ssize_t sendfile(int fileFD, off_t offset, size_t len) { return -1; }
+
+    virtual const char* name() const = 0;
+};
@@ -0,0 +1,108 @@
+#include "bodyStream.h"
+#include "Utils/Logger/logger.h"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+int BodyStream::readyFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+void BodyStream::signalReady() {
+    uint64_t one = 1;
+    if (write(readyFD, &one, sizeof(one)) < 0) {
+        LOG_ERROR("Failed to signal a ready body: " + std::to_string(errno));
+    }
+}
+
+ssize_t MemoryBodyStream::read(uint8_t* dst, size_t maxLen) {
+    size_t len = std::min(maxLen, remaining());
+    std::memcpy(dst, data->data() + offset, len);
+    offset += len;
+    return len;
+}
+
+OpenFile::OpenFile(const std::string& path) : fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+    if (fd < 0) {
+        LOG_ERROR("Failed to open file: " + path + ", errno: " + std::to_string(errno));
+    }
+}
+
+OpenFile::~OpenFile() {
+    if (fd >= 0) close(fd);
+}
+
+FileBodyStream::FileBodyStream(const std::string& path, size_t size, off_t offset)
+    : FileBodyStream(std::make_shared<const OpenFile>(path), size, offset) {}
+
+FileBodyStream::FileBodyStream(std::shared_ptr<const OpenFile> file, size_t size, off_t offset)
+    : file(std::move(file)), offset(offset), left(size) {
+    if (!this->file->isOpen()) {
+        left = 0;
+        return;
+    }
+    posix_fadvise(this->file->fd, offset, size, POSIX_FADV_SEQUENTIAL);
+}
+
+ssize_t FileBodyStream::read(uint8_t* dst, size_t maxLen) {
+    size_t len = std::min(maxLen, left);
+    if (len == 0) return 0;
+
+    ssize_t n;
+    do {
+        n = pread(file->fd, dst, len, offset);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        // the file shrank underneath us, there is no way to honour the content-length anymore
+        LOG_ERROR("Failed to read from file descriptor: " + std::to_string(file->fd) + ", errno: " + std::to_string(errno));
+        return -1;
+    }
+
+    offset += n;
+    left -= n;
+    return n;
+}
+
+void FileBodyStream::skip(size_t len) {
+    len = std::min(len, left);
+    offset += len;
+    left -= len;
+}
+
+size_t ConcatBodyStream::remaining() const {
+    size_t total = 0;
+    for (size_t i = current; i < parts.size(); ++i) {
+        total += parts[i]->remaining();
+    }
+    return total;
+}
+
+ssize_t ConcatBodyStream::read(uint8_t* dst, size_t maxLen) {
+    size_t total = 0;
+    while (total < maxLen && current < parts.size()) {
+        if (parts[current]->remaining() == 0) {
+            parts[current++].reset();
+            continue;
+        }
+        ssize_t n = parts[current]->read(dst + total, maxLen - total);
+        if (n == WOULD_BLOCK && total > 0) break;
+        if (n < 0) return n;
+        total += n;
+    }
+    return total;
+}
+
+void ConcatBodyStream::wait() {
+    if (current < parts.size()) parts[current]->wait();
+}
+
+void ConcatBodyStream::skip(size_t len) {
+    while (len > 0 && current < parts.size()) {
+        size_t step = std::min(len, parts[current]->remaining());
+        parts[current]->skip(step);
+        len -= step;
+        if (parts[current]->remaining() == 0) current++;
+    }
+}
@@ -0,0 +1,110 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <sys/types.h>
+
+#pragma once
+
+// A response body that is produced a chunk at a time, so that a stream only
+// ever holds as many bytes as fit in the frame currently being written.
+class BodyStream {
+public:
+    virtual ~BodyStream() = default;
+
+    // bytes left to send, UNKNOWN_LENGTH while a generated body has not finished
+    static constexpr size_t UNKNOWN_LENGTH = SIZE_MAX;
+    virtual size_t remaining() const = 0;
+
+    // reads at most maxLen bytes into dst, returns the number of bytes read or -1 on error,
+    // WOULD_BLOCK when a body produced on another thread has nothing ready yet
+    virtual ssize_t read(uint8_t* dst, size_t maxLen) = 0;
+
+    static constexpr ssize_t WOULD_BLOCK = -2;
+
+    // blocks until read stops returning WOULD_BLOCK, for consumers running off the event loop
+    virtual void wait() {}
+
+    // eventfd the event loop polls, written by producers once a body that returned WOULD_BLOCK
+    // has data again
+    static int readyFD;
+    static void signalReady();
+
+    // bodies backed by a file can be handed to sendfile, -1 otherwise
+    virtual int fileDescriptor() const { return -1; }
+    virtual off_t fileOffset() const { return 0; }
+
+    // marks len bytes as consumed without reading them, once they are sent by other means
+    virtual void skip(size_t len) = 0;
+};
+
+class MemoryBodyStream : public BodyStream {
+private:
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    size_t offset = 0;
+public:
+    MemoryBodyStream(std::shared_ptr<const std::vector<uint8_t>> data) : data(std::move(data)) {}
+
+    size_t remaining() const override { return data->size() - offset; }
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override;
+
+    void skip(size_t len) override { offset += std::min(len, remaining()); }
+};
+
+// A read-only file descriptor, shared by the bodies that send parts of the same file.
+class OpenFile {
+public:
+    const int fd;
+
+    explicit OpenFile(const std::string& path);
+
+    ~OpenFile();
+
+    OpenFile(const OpenFile&) = delete;
+    OpenFile& operator=(const OpenFile&) = delete;
+
+    bool isOpen() const { return fd >= 0; }
+};
+
+class FileBodyStream : public BodyStream {
+private:
+    std::shared_ptr<const OpenFile> file;
+    off_t offset;
+    size_t left;
+public:
+    // sends size bytes of the file starting at offset
+    FileBodyStream(const std::string& path, size_t size, off_t offset = 0);
+
+    // reads at offsets of its own, several streams can send ranges of one file
+    FileBodyStream(std::shared_ptr<const OpenFile> file, size_t size, off_t offset);
+
+    bool isOpen() const { return file->isOpen(); }
+
+    size_t remaining() const override { return left; }
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override;
+
+    int fileDescriptor() const override { return file->fd; }
+    off_t fileOffset() const override { return offset; }
+
+    void skip(size_t len) override;
+};
+
+// Sends several bodies back to back, e.g. the parts of a multipart/byteranges response.
+class ConcatBodyStream : public BodyStream {
+private:
+    std::vector<std::unique_ptr<BodyStream>> parts;
+    size_t current = 0;
+public:
+    ConcatBodyStream(std::vector<std::unique_ptr<BodyStream>> parts) : parts(std::move(parts)) {}
+
+    size_t remaining() const override;
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override;
+
+    void wait() override;
+
+    void skip(size_t len) override;
+};
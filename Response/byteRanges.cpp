@@ -0,0 +1,117 @@
+#include "byteRanges.h"
+#include "util.cpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+static bool parseOffset(const std::string& str, size_t& out) {
+    if (str.empty()) return false;
+    out = 0;
+    for (char c : str) {
+        if (c < '0' || c > '9') return false;
+        size_t digit = c - '0';
+        if (out > (SIZE_MAX - digit) / 10) return false;
+        out = out * 10 + digit;
+    }
+    return true;
+}
+
+ByteRanges::Result ByteRanges::parse(const std::string& header, size_t size, std::vector<ByteRange>& ranges) {
+    ranges.clear();
+
+    std::string value = Util::strip(header);
+    if (Util::toLower(value.substr(0, 6)) != "bytes=") return IGNORED;
+
+    size_t specs = 0;
+    size_t start = 6;
+    while (start <= value.length()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) end = value.length();
+        std::string spec = Util::strip(value.substr(start, end - start));
+        start = end + 1;
+
+        if (spec.empty()) continue;
+        if (++specs > MAX_BYTE_RANGES) return IGNORED;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) return IGNORED;
+
+        size_t first, last;
+        if (dash == 0) {
+            // suffix range, the last n bytes
+            size_t suffix;
+            if (!parseOffset(spec.substr(1), suffix)) return IGNORED;
+            if (suffix == 0 || size == 0) continue;
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        } else {
+            if (!parseOffset(spec.substr(0, dash), first)) return IGNORED;
+            if (dash + 1 == spec.length()) {
+                last = SIZE_MAX;
+            } else if (!parseOffset(spec.substr(dash + 1), last) || last < first) {
+                return IGNORED;
+            }
+            if (first >= size) continue;
+            last = std::min(last, size - 1);
+        }
+
+        ranges.push_back({first, last});
+    }
+
+    if (specs == 0) return IGNORED;
+    if (ranges.empty()) return UNSATISFIABLE;
+
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) {
+        return a.first < b.first;
+    });
+
+    // overlapping ranges would make clients download the same bytes twice
+    std::vector<ByteRange> merged;
+    for (const ByteRange& range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().last + 1) {
+            merged.back().last = std::max(merged.back().last, range.last);
+        } else {
+            merged.push_back(range);
+        }
+    }
+    ranges = std::move(merged);
+
+    return SATISFIABLE;
+}
+
+std::string ByteRanges::contentRange(const ByteRange& range, size_t size) {
+    return "bytes " + std::to_string(range.first) + "-" + std::to_string(range.last) + "/" + std::to_string(size);
+}
+
+static std::shared_ptr<const std::vector<uint8_t>> toBytes(const std::string& str) {
+    return std::make_shared<const std::vector<uint8_t>>(str.begin(), str.end());
+}
+
+std::unique_ptr<BodyStream> ByteRanges::multipartBody(const std::string& path, size_t size,
+                                                      const std::string& mimeType,
+                                                      const std::vector<ByteRange>& ranges,
+                                                      std::string& boundary) {
+    static std::atomic<uint64_t> counter{0};
+    uint64_t seed = std::chrono::steady_clock::now().time_since_epoch().count();
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%016llx%08llx", (unsigned long long)seed,
+             (unsigned long long)(counter.fetch_add(1) & 0xffffffff));
+    boundary = buf;
+
+    // every part reads its own offsets of one descriptor, however many ranges were asked for
+    auto file = std::make_shared<const OpenFile>(path);
+    if (!file->isOpen()) return nullptr;
+
+    std::vector<std::unique_ptr<BodyStream>> parts;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::string partHeader = (i == 0 ? "--" : "\r\n--") + boundary + "\r\n" +
+                                 "Content-Type: " + mimeType + "\r\n" +
+                                 "Content-Range: " + contentRange(ranges[i], size) + "\r\n\r\n";
+        parts.push_back(std::make_unique<MemoryBodyStream>(toBytes(partHeader)));
+
+        parts.push_back(std::make_unique<FileBodyStream>(file, ranges[i].length(), ranges[i].first));
+    }
+    parts.push_back(std::make_unique<MemoryBodyStream>(toBytes("\r\n--" + boundary + "--\r\n")));
+
+    return std::make_unique<ConcatBodyStream>(std::move(parts));
+}
@@ -0,0 +1,36 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include "bodyStream.h"
+
+#pragma once
+
+#define MAX_BYTE_RANGES 16 // more ranges than this are answered with the whole file
+
+struct ByteRange {
+    size_t first;
+    size_t last; // inclusive, as written in content-range
+
+    size_t length() const { return last - first + 1; }
+};
+
+// Parses range requests (RFC 9110 section 14) and builds the matching partial bodies.
+class ByteRanges {
+public:
+    enum Result {
+        IGNORED,        // no usable range header, send the full body
+        SATISFIABLE,
+        UNSATISFIABLE   // answer with 416
+    };
+
+    // fills ranges sorted and with overlapping or adjacent ranges merged
+    static Result parse(const std::string& header, size_t size, std::vector<ByteRange>& ranges);
+
+    static std::string contentRange(const ByteRange& range, size_t size);
+
+    // multipart/byteranges body with one part per range, boundary is set to the separator used
+    static std::unique_ptr<BodyStream> multipartBody(const std::string& path, size_t size,
+                                                     const std::string& mimeType,
+                                                     const std::vector<ByteRange>& ranges,
+                                                     std::string& boundary);
+};
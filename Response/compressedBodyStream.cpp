@@ -0,0 +1,153 @@
+#include "compressedBodyStream.h"
+#include "responseData.h"
+#include "Utils/Logger/logger.h"
+#include <cstring>
+
+static const size_t poolSize = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+ThreadPool CompressedBodyStream::pool = ThreadPool(poolSize);
+std::atomic<int> CompressedBodyStream::jobsInFlight(0);
+
+CompressedBodyStream::ChunkEncoder::ChunkEncoder(std::unique_ptr<BodyStream> source, const std::string& encoding, int level)
+    : source(std::move(source)), zs{}, br(nullptr), chunkState(CHUNK_RUNNING), done(false) {
+    if (encoding == "br") {
+        br = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+        BrotliEncoderSetParameter(br, BROTLI_PARAM_QUALITY, level);
+        BrotliEncoderSetParameter(br, BROTLI_PARAM_MODE, BROTLI_MODE_TEXT);
+    } else {
+        deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+}
+
+CompressedBodyStream::ChunkEncoder::~ChunkEncoder() {
+    if (br) {
+        BrotliEncoderDestroyInstance(br);
+    } else {
+        deflateEnd(&zs);
+    }
+}
+
+CompressedBodyStream::CompressedBodyStream(std::unique_ptr<BodyStream> source, const std::string& encoding, int level)
+    : encoder(std::make_shared<ChunkEncoder>(std::move(source), encoding, level)), encoding(encoding),
+      readyOffset(0), inFlight(false), encoderDone(false) {
+    schedule();
+}
+
+// a job still in flight keeps the encoder alive, nothing waits for it here
+CompressedBodyStream::~CompressedBodyStream() = default;
+
+void CompressedBodyStream::schedule() {
+    jobsInFlight++;
+    inFlight = true;
+    encoder->chunkState.store(CHUNK_RUNNING, std::memory_order_relaxed);
+    pool.enqueue(0, [encoder = encoder]() {
+        bool ok = encoder->compressChunk();
+        jobsInFlight--;
+        encoder->chunkState.store(ok ? CHUNK_OK : CHUNK_FAILED, std::memory_order_release);
+        BodyStream::signalReady();
+    });
+}
+
+// runs on the worker pool, feeds source slices until a chunk worth sending has come out
+bool CompressedBodyStream::ChunkEncoder::compressChunk() {
+    uint8_t in[COMPRESS_CHUNK_SIZE];
+    next.clear();
+
+    while (next.size() < COMPRESS_CHUNK_SIZE && !done) {
+        ssize_t n = source->read(in, sizeof(in));
+        if (n == WOULD_BLOCK) {
+            source->wait();
+            continue;
+        }
+        if (n < 0) return false;
+        bool last = source->remaining() == 0;
+
+        if (br) {
+            size_t availIn = n;
+            const uint8_t* nextIn = in;
+            BrotliEncoderOperation op = last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+            do {
+                size_t availOut = 0;
+                if (!BrotliEncoderCompressStream(br, op, &availIn, &nextIn, &availOut, nullptr, nullptr)) return false;
+                size_t outSize = 0;
+                const uint8_t* out = BrotliEncoderTakeOutput(br, &outSize);
+                next.insert(next.end(), out, out + outSize);
+            } while (availIn > 0 || BrotliEncoderHasMoreOutput(br));
+            if (last) done = BrotliEncoderIsFinished(br);
+        } else {
+            zs.next_in = in;
+            zs.avail_in = n;
+            int ret;
+            do {
+                uint8_t out[COMPRESS_CHUNK_SIZE];
+                zs.next_out = out;
+                zs.avail_out = sizeof(out);
+                ret = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+                if (ret == Z_STREAM_ERROR) return false;
+                next.insert(next.end(), out, out + (sizeof(out) - zs.avail_out));
+            } while (zs.avail_out == 0 || (last && ret != Z_STREAM_END));
+            if (last) done = ret == Z_STREAM_END;
+        }
+    }
+
+    return true;
+}
+
+size_t CompressedBodyStream::remaining() const {
+    if (readyOffset < ready.size() || inFlight) return UNKNOWN_LENGTH;
+    return encoderDone ? 0 : UNKNOWN_LENGTH;
+}
+
+ssize_t CompressedBodyStream::read(uint8_t* dst, size_t maxLen) {
+    while (readyOffset == ready.size()) {
+        if (!inFlight) {
+            if (encoderDone) return 0;
+            schedule();
+        }
+        int state = encoder->chunkState.load(std::memory_order_acquire);
+        if (state == CHUNK_RUNNING) return WOULD_BLOCK;
+
+        inFlight = false;
+        if (state == CHUNK_FAILED) {
+            LOG_ERROR("Failed to compress response body with " + encoding);
+            return -1;
+        }
+
+        ready.swap(encoder->next);
+        readyOffset = 0;
+        encoderDone = encoder->done;
+        if (!encoderDone) schedule(); // compress the next chunk while this one is sent
+    }
+
+    size_t len = std::min(maxLen, ready.size() - readyOffset);
+    std::memcpy(dst, ready.data() + readyOffset, len);
+    readyOffset += len;
+    return len;
+}
+
+int CompressedBodyStream::chooseLevel() {
+    // the backlog of the compression pool is what tells us whether it keeps up,
+    // system load is useless here since the reactor alone keeps a core busy
+    double backlog = (double) jobsInFlight / poolSize;
+
+    if (backlog >= 8) return -1; // shed compression rather than queue requests behind it
+    if (backlog >= 4) return 1;
+    if (backlog >= 2) return 4;
+    return 6;
+}
+
+std::unique_ptr<BodyStream> CompressedBodyStream::wrap(std::unique_ptr<BodyStream> source, const std::string& mimeType,
+                                                       const std::vector<std::string>& accepted, std::string& encoding) {
+    encoding.clear();
+    if (accepted.empty() || !ResponseData::isCompressible(mimeType)) return source;
+    if (source->remaining() < MIN_COMPRESS_SIZE) return source;
+
+    int level = chooseLevel();
+    if (level < 0) {
+        LOG_WARNING("Server too busy, sending response uncompressed");
+        return source;
+    }
+
+    encoding = accepted.front();
+    return std::make_unique<CompressedBodyStream>(std::move(source), encoding, level);
+}
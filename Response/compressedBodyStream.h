@@ -0,0 +1,74 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <zlib.h>
+#include <brotli/encode.h>
+#include "bodyStream.h"
+#include "Multithreading/threadPool.h"
+
+#pragma once
+
+#define COMPRESS_CHUNK_SIZE 16384
+#define MIN_COMPRESS_SIZE 256 // below this the encoding overhead eats the savings
+
+// Compresses a dynamic body on the fly. Each chunk is compressed on the worker pool
+// while the previous one is being sent, so at most two chunks are held at a time and
+// the total length is unknown until the encoder finishes. The event loop never waits
+// for a chunk, read returns WOULD_BLOCK and the worker signals BodyStream::readyFD.
+class CompressedBodyStream : public BodyStream {
+private:
+    // Everything the worker touches. The job in flight owns it together with the stream,
+    // so a stream reset mid-chunk is destroyed at once and the job frees it when it ends,
+    // even if the source made it wait (a directory listing still being scanned).
+    struct ChunkEncoder {
+        std::unique_ptr<BodyStream> source;
+        z_stream zs;
+        BrotliEncoderState* br;
+        std::vector<uint8_t> next;   // the chunk being compressed
+        std::atomic<int> chunkState; // CHUNK_*, published by the worker once next is filled
+        bool done;                   // written by the worker, read after chunkState is published
+
+        ChunkEncoder(std::unique_ptr<BodyStream> source, const std::string& encoding, int level);
+        ~ChunkEncoder();
+
+        bool compressChunk();
+    };
+
+    enum { CHUNK_RUNNING, CHUNK_OK, CHUNK_FAILED };
+
+    std::shared_ptr<ChunkEncoder> encoder;
+    std::string encoding;
+
+    std::vector<uint8_t> ready;
+    size_t readyOffset;
+    bool inFlight;
+    bool encoderDone;
+
+    void schedule();
+
+    static ThreadPool pool;
+    static std::atomic<int> jobsInFlight;
+
+public:
+    CompressedBodyStream(std::unique_ptr<BodyStream> source, const std::string& encoding, int level);
+
+    ~CompressedBodyStream() override;
+
+    CompressedBodyStream(const CompressedBodyStream&) = delete;
+    CompressedBodyStream& operator=(const CompressedBodyStream&) = delete;
+
+    size_t remaining() const override;
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override;
+
+    void skip(size_t len) override {}
+
+    // compression level for the current load, -1 when the server is too busy to compress
+    static int chooseLevel();
+
+    // wraps the body if it is worth compressing and the client accepts an encoding,
+    // sets encoding to the chosen content-encoding or leaves it empty
+    static std::unique_ptr<BodyStream> wrap(std::unique_ptr<BodyStream> source, const std::string& mimeType,
+                                            const std::vector<std::string>& accepted, std::string& encoding);
+};
@@ -3,6 +3,8 @@
 #include "http2/protocol/frame.h"
 #include "vector"
 
+#pragma once
+
 #define MAX_BUFFER_SIZE 32768
 #define MAX_FRAME_SIZE 16384-15 // 15 bytes as a quick hack for the preceding 15 bytes
 
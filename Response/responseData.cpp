@@ -1,11 +1,58 @@
 #include "responseData.h"
+#include <sys/stat.h>
+#include <cstdio>
 
+bool ResponseData::statFile(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        LOG_ERROR("Failed to stat file: " + path);
+        return false;
+    }
+
+    setFile(path, st.st_size, (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec, st.st_ino);
+    return true;
+}
+
+void ResponseData::setFile(const std::string& path, size_t size, int64_t mtime, unsigned long inode) {
+    filePath = path;
+    fileSize = size;
+    mtimeNs = mtime;
+
+    // inode, size and mtime change whenever the file is replaced or rewritten
+    char tag[64];
+    snprintf(tag, sizeof(tag), "\"%lx-%zx-%lx\"", inode, fileSize, (unsigned long) mtimeNs);
+    etag = tag;
+}
+
+std::unique_ptr<BodyStream> ResponseData::takeBody() {
+    if (generator) {
+        return generator();
+    }
+    if (sharedData) {
+        return std::make_unique<MemoryBodyStream>(sharedData);
+    }
+    if (isFile()) {
+        auto body = std::make_unique<FileBodyStream>(filePath, fileSize);
+        if (!body->isOpen()) return nullptr;
+        return body;
+    }
+    return std::make_unique<MemoryBodyStream>(
+        std::make_shared<const std::vector<u_int8_t>>(std::move(data)));
+}
+
+bool ResponseData::isCompressible(const std::string& mimeType) {
+    if (mimeType.compare(0, 5, "text/") == 0) return true;
+    return mimeType == "application/javascript" ||
+           mimeType == "application/json" ||
+           mimeType == "application/xml" ||
+           mimeType == "image/svg+xml";
+}
 
 bool ResponseData::readFromFile(const std::string& filePath) {
     std::ifstream file(filePath, std::ios::binary);
 
     if (!file) {
-        Logger::error("Failed to open file: " + filePath);
+        LOG_ERROR("Failed to open file: " + filePath);
         return false;
     }
 
@@ -16,7 +63,7 @@ bool ResponseData::readFromFile(const std::string& filePath) {
     data.resize(size);
     file.read(reinterpret_cast<char*>(data.data()), size);
     if (!file) {
-        Logger::error("Failed to read file: " + filePath);
+        LOG_ERROR("Failed to read file: " + filePath);
         return false;
     }
 
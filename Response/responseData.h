@@ -1,14 +1,32 @@
 #include <string>
 #include <vector>
+#include <memory>
 #include <algorithm>
 #include <fstream>
+#include <functional>
 #include "Utils/Logger/logger.h"
+#include "bodyStream.h"
+
+#pragma once
 
 class ResponseData {
 public:
     std::string mimeType;
     std::vector<u_int8_t> data;
 
+    // set for file backed responses, the bytes are only read while the body is being sent
+    std::string filePath;
+    size_t fileSize = 0;
+    int64_t mtimeNs = 0;
+    std::string etag; // strong validator of this exact representation
+
+    // body already held in memory elsewhere (e.g. a cached compressed variant), shared instead of copied
+    std::shared_ptr<const std::vector<u_int8_t>> sharedData;
+    std::string contentEncoding;
+
+    // body produced only once it is sent, e.g. a directory listing rendered while it streams
+    std::function<std::unique_ptr<BodyStream>()> generator;
+
     ResponseData() = default;
 
     ResponseData(const std::string& mimeType, const std::vector<u_int8_t>& data)
@@ -17,12 +35,32 @@ public:
     static ResponseData fromPath(const std::string& path) {
         ResponseData resp;
         resp.mimeType = getMimeType(path);
-        resp.readFromFile(path);
+        resp.statFile(path);
         
         return resp;
     }
 
     static std::string getMimeType(const std::string& path); 
 
+    bool isFile() const { return !filePath.empty(); }
+
+    size_t size() const {
+        if (sharedData) return sharedData->size();
+        return isFile() ? fileSize : data.size();
+    }
+
+    bool empty() const { return !isFile() && !sharedData && !generator && data.empty(); }
+
+    // text formats worth compressing, images and pdfs are compressed already
+    static bool isCompressible(const std::string& mimeType);
+
+    // hands the body over to a stream, the in-memory data is moved out
+    std::unique_ptr<BodyStream> takeBody();
+
+    bool statFile(const std::string& filePath);
+
+    // for callers that already know the file's metadata, e.g. from a stat cache
+    void setFile(const std::string& filePath, size_t size, int64_t mtimeNs, unsigned long inode);
+
     bool readFromFile(const std::string& filePath); 
-};
\ No newline at end of file
+};
@@ -0,0 +1,1137 @@
+// Unit tests for the parsers and matchers the request path relies on, run with `make test`.
+//
+//   bin/unittests [-f filter]
+//
+// Each group prints one line, a failed check prints where it is and what it compared.
+// The exit status is 1 as soon as one check failed.
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "http2/protocol/hpack/hpack.h"
+#include "Response/byteRanges.h"
+#include "Response/responseData.h"
+#include "Frame-Handler/frameHandler.h"
+#include "WebBinder/router.h"
+#include "WebBinder/pushManifest.h"
+#include "Client/stream.h"
+#include "Client/floodGuard.h"
+#include "Client/clientManager.h"
+#include "Utils/Metrics/metrics.h"
+#include "Response/compressedBodyStream.h"
+#include "Networking/Transport/memoryTransport.h"
+#include "WebBinder/webBinder.h"
+#include "Utils/Logger/logger.h"
+#include "util.cpp"
+
+namespace protocol = http2::protocol;
+namespace hpack = http2::protocol::hpack;
+
+class Tests {
+private:
+    std::string filter;
+    std::string group;
+    int checks = 0;
+    int groupFailures = 0;
+    int failures = 0;
+
+    void endGroup() {
+        if (group.empty()) return;
+        printf("%-44s %s\n", group.c_str(), groupFailures ? "FAILED" : "ok");
+        group.clear();
+    }
+
+public:
+    explicit Tests(std::string filter) : filter(std::move(filter)) {}
+
+    // false when the filter skips the group
+    bool begin(const std::string& name) {
+        endGroup();
+        if (!filter.empty() && name.find(filter) == std::string::npos) return false;
+        group = name;
+        groupFailures = 0;
+        return true;
+    }
+
+    void check(bool ok, const std::string& what, const char* file, int line) {
+        checks++;
+        if (ok) return;
+        groupFailures++;
+        failures++;
+        printf("  %s:%d: %s\n", file, line, what.c_str());
+    }
+
+    template<class A, class B>
+    void checkEqual(const A& actual, const B& expected, const char* expr, const char* file, int line) {
+        if (actual == expected) {
+            check(true, expr, file, line);
+            return;
+        }
+        std::ostringstream what;
+        what << expr << ", got " << actual << ", expected " << expected;
+        check(false, what.str(), file, line);
+    }
+
+    int finish() {
+        endGroup();
+        printf("%d checks, %d failed\n", checks, failures);
+        return failures ? 1 : 0;
+    }
+};
+
+#define CHECK(t, cond) (t).check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(t, actual, expected) (t).checkEqual((actual), (expected), #actual " == " #expected, __FILE__, __LINE__)
+
+static std::string rangesOf(const std::vector<ByteRange>& ranges) {
+    std::string out;
+    for (const ByteRange& range : ranges) {
+        if (!out.empty()) out += ",";
+        out += std::to_string(range.first) + "-" + std::to_string(range.last);
+    }
+    return out;
+}
+
+static void byteRangeTests(Tests& t) {
+    std::vector<ByteRange> ranges;
+
+    if (t.begin("byteranges/parse")) {
+        CHECK_EQ(t, ByteRanges::parse("bytes=0-99", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-99");
+
+        // open ended and suffix ranges are clamped to the file
+        CHECK_EQ(t, ByteRanges::parse("bytes=900-", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "900-999");
+        CHECK_EQ(t, ByteRanges::parse("bytes=-100", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "900-999");
+        CHECK_EQ(t, ByteRanges::parse("bytes=-5000", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-999");
+        CHECK_EQ(t, ByteRanges::parse("bytes=990-5000", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "990-999");
+
+        // unit and spacing are not case or whitespace sensitive
+        CHECK_EQ(t, ByteRanges::parse("  Bytes=0-0 , 10-19 ", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-0,10-19");
+    }
+
+    if (t.begin("byteranges/merge")) {
+        CHECK_EQ(t, ByteRanges::parse("bytes=500-599,0-99,50-149", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-149,500-599");
+        // adjacent ranges become one part
+        CHECK_EQ(t, ByteRanges::parse("bytes=0-9,10-19", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-19");
+        CHECK_EQ(t, ByteRanges::parse("bytes=0-,100-199", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "0-999");
+    }
+
+    if (t.begin("byteranges/invalid")) {
+        CHECK_EQ(t, ByteRanges::parse("", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("items=0-1", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=5", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=9-5", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=a-5", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=-", 1000, ranges), ByteRanges::IGNORED);
+        CHECK_EQ(t, ByteRanges::parse("bytes=0-99999999999999999999999", 1000, ranges), ByteRanges::IGNORED);
+
+        std::string many = "bytes=";
+        for (int i = 0; i <= MAX_BYTE_RANGES; ++i) many += std::to_string(i * 10) + "-" + std::to_string(i * 10) + ",";
+        CHECK_EQ(t, ByteRanges::parse(many, 1000, ranges), ByteRanges::IGNORED);
+    }
+
+    if (t.begin("byteranges/unsatisfiable")) {
+        CHECK_EQ(t, ByteRanges::parse("bytes=1000-", 1000, ranges), ByteRanges::UNSATISFIABLE);
+        CHECK_EQ(t, ByteRanges::parse("bytes=-0", 1000, ranges), ByteRanges::UNSATISFIABLE);
+        CHECK_EQ(t, ByteRanges::parse("bytes=0-0", 0, ranges), ByteRanges::UNSATISFIABLE);
+        // one satisfiable range is enough
+        CHECK_EQ(t, ByteRanges::parse("bytes=2000-2100,5-9", 1000, ranges), ByteRanges::SATISFIABLE);
+        CHECK_EQ(t, rangesOf(ranges), "5-9");
+    }
+
+    if (t.begin("byteranges/content_range")) {
+        CHECK_EQ(t, ByteRanges::contentRange({0, 99}, 1000), "bytes 0-99/1000");
+        CHECK_EQ(t, ByteRange({10, 19}).length(), 10u);
+    }
+}
+
+static bool ifRange(const std::string& value, const ResponseData& content) {
+    Stream stream(1);
+    if (!value.empty()) stream.headers.add("if-range", value);
+    return FrameHandler::ifRangeMatches(&stream, content);
+}
+
+static void ifRangeTests(Tests& t) {
+    if (!t.begin("byteranges/if_range")) return;
+
+    ResponseData content;
+    content.etag = "\"abc-1\"";
+    content.mtimeNs = 784111777LL * 1000000000; // Sun, 06 Nov 1994 08:49:37 GMT
+
+    CHECK(t, ifRange("", content));
+    CHECK(t, ifRange("\"abc-1\"", content));
+    CHECK(t, !ifRange("\"abc-2\"", content));
+    // a weak tag can never vouch for the bytes being the same
+    CHECK(t, !ifRange("W/\"abc-1\"", content));
+    CHECK(t, ifRange("Sun, 06 Nov 1994 08:49:37 GMT", content));
+    CHECK(t, !ifRange("Sun, 06 Nov 1994 08:49:38 GMT", content));
+    CHECK(t, !ifRange("yesterday", content));
+}
+
+static void httpDateTests(Tests& t) {
+    if (!t.begin("util/http_date")) return;
+
+    time_t parsed = 0;
+    CHECK(t, Util::parseHttpDate("Sun, 06 Nov 1994 08:49:37 GMT", parsed));
+    CHECK_EQ(t, parsed, 784111777);
+    CHECK_EQ(t, Util::formatHttpDate(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+    CHECK_EQ(t, Util::formatHttpDate(0), "Thu, 01 Jan 1970 00:00:00 GMT");
+
+    // what is formatted parses back to the same second
+    time_t now = time(nullptr);
+    CHECK(t, Util::parseHttpDate(Util::formatHttpDate(now), parsed));
+    CHECK_EQ(t, parsed, now);
+
+    CHECK(t, !Util::parseHttpDate("", parsed));
+    CHECK(t, !Util::parseHttpDate("yesterday", parsed));
+    CHECK(t, !Util::parseHttpDate("Sun, 06 Nov 1994", parsed));
+    CHECK(t, !Util::parseHttpDate("Sun, 06 Nov 1994 08:49:37 PST", parsed));
+}
+
+static bool notModified(const std::string& name, const std::string& value, const ResponseData& content) {
+    Stream stream(1);
+    stream.headers.add(name, value);
+    return FrameHandler::isNotModified(&stream, content);
+}
+
+static void conditionalTests(Tests& t) {
+    if (!t.begin("conditional/if_none_match")) return;
+
+    ResponseData content;
+    content.etag = "\"abc-1\"";
+    content.mtimeNs = 784111777LL * 1000000000;
+
+    CHECK(t, notModified("if-none-match", "\"abc-1\"", content));
+    CHECK(t, !notModified("if-none-match", "\"abc-2\"", content));
+    // the weak comparison, a W/ prefix still matches
+    CHECK(t, notModified("if-none-match", "W/\"abc-1\"", content));
+    CHECK(t, notModified("if-none-match", "\"x\", \"abc-1\" ,\"y\"", content));
+    CHECK(t, notModified("if-none-match", "*", content));
+    CHECK(t, !notModified("if-none-match", "abc-1", content));
+
+    CHECK(t, notModified("if-modified-since", "Sun, 06 Nov 1994 08:49:37 GMT", content));
+    CHECK(t, notModified("if-modified-since", "Mon, 07 Nov 1994 08:49:37 GMT", content));
+    CHECK(t, !notModified("if-modified-since", "Sun, 06 Nov 1994 08:49:36 GMT", content));
+    CHECK(t, !notModified("if-modified-since", "yesterday", content));
+
+    // if-none-match decides alone when both are sent
+    Stream stream(1);
+    stream.headers.add("if-none-match", "\"abc-2\"");
+    stream.headers.add("if-modified-since", "Sun, 06 Nov 1994 08:49:37 GMT");
+    CHECK(t, !FrameHandler::isNotModified(&stream, content));
+
+    // without a modification time there is nothing to compare against
+    content.mtimeNs = 0;
+    CHECK(t, !notModified("if-modified-since", "Sun, 06 Nov 1994 08:49:37 GMT", content));
+}
+
+static void escapingTests(Tests& t) {
+    if (t.begin("util/percent_decode")) {
+        CHECK_EQ(t, Util::percentDecode("/a%20b%2Fc"), "/a b/c");
+        CHECK_EQ(t, Util::percentDecode("%e2%82%AC"), "\xe2\x82\xac");
+        CHECK_EQ(t, Util::percentDecode("a+b"), "a b");
+        // a '+' in a path is just a '+'
+        CHECK_EQ(t, Util::percentDecode("a+b", false), "a+b");
+        // broken escapes are kept as they are
+        CHECK_EQ(t, Util::percentDecode("100%"), "100%");
+        CHECK_EQ(t, Util::percentDecode("%4"), "%4");
+        CHECK_EQ(t, Util::percentDecode("%zz%41"), "%zzA");
+        CHECK_EQ(t, Util::percentDecode("%%41"), "%A");
+        CHECK_EQ(t, Util::percentDecode(""), "");
+    }
+
+    if (t.begin("util/percent_encode")) {
+        CHECK_EQ(t, Util::percentEncode("file-1.0_~x.txt"), "file-1.0_~x.txt");
+        CHECK_EQ(t, Util::percentEncode("a b/c?d#e"), "a%20b%2Fc%3Fd%23e");
+        CHECK_EQ(t, Util::percentEncode("\"<x>\""), "%22%3Cx%3E%22");
+        CHECK_EQ(t, Util::percentEncode("\xe2\x82\xac"), "%E2%82%AC");
+
+        // an encoded name decodes back to itself
+        std::string name = "50% off + more & <less>.html";
+        CHECK_EQ(t, Util::percentDecode(Util::percentEncode(name), false), name);
+    }
+
+    if (t.begin("util/html_escape")) {
+        CHECK_EQ(t, Util::htmlEscape("plain.txt"), "plain.txt");
+        CHECK_EQ(t, Util::htmlEscape("<script>alert('x') & \"y\"</script>"),
+                 "&lt;script&gt;alert(&#39;x&#39;) &amp; &quot;y&quot;&lt;/script&gt;");
+        CHECK_EQ(t, Util::htmlEscape("&amp;"), "&amp;amp;");
+    }
+}
+
+// the path of the route a URL resolves to, "" when none does, with a '=' in front of exact matches
+static std::string routed(const Router& router, const std::string& url) {
+    Router::Match match = router.match(url);
+    if (!match.route) return "";
+    return (match.exact ? "=" : "") + match.route->path;
+}
+
+static void routerTests(Tests& t) {
+    Router router({
+        {"/", "root", Router::DIRECTORY_ROUTE},
+        {"/html", "html", Router::DIRECTORY_ROUTE},
+        {"/html/index.html", "index", Router::FILE_ROUTE},
+        {"/htmlfile", "htmlfile", Router::FILE_ROUTE},
+        {"/static/", "static", Router::DIRECTORY_ROUTE},
+        {"/api/status", "status", Router::HANDLER_ROUTE},
+        {"/api/stats", "stats", Router::FILE_ROUTE},
+    });
+
+    if (t.begin("router/exact")) {
+        CHECK_EQ(t, router.size(), 7u);
+        CHECK_EQ(t, routed(router, "/"), "=root");
+        CHECK_EQ(t, routed(router, "/html"), "=html");
+        CHECK_EQ(t, routed(router, "/html/index.html"), "=index");
+        CHECK_EQ(t, routed(router, "/htmlfile"), "=htmlfile");
+        CHECK_EQ(t, routed(router, "/api/status"), "=status");
+        CHECK_EQ(t, routed(router, "/api/stats"), "=stats");
+        CHECK_EQ(t, router.match("/api/status").route->kind, Router::HANDLER_ROUTE);
+    }
+
+    if (t.begin("router/longest_prefix")) {
+        CHECK_EQ(t, routed(router, "/html/"), "html");
+        CHECK_EQ(t, routed(router, "/html/a/b.png"), "html");
+        CHECK_EQ(t, routed(router, "/html/index.html.bak"), "html");
+        CHECK_EQ(t, routed(router, "/static/app.js"), "static");
+        // a directory covers paths below it, not names it is a prefix of
+        CHECK_EQ(t, routed(router, "/htmlfoo"), "root");
+        CHECK_EQ(t, routed(router, "/htmlfile/x"), "root");
+        // file and handler routes only match themselves
+        CHECK_EQ(t, routed(router, "/api/status/x"), "root");
+        CHECK_EQ(t, routed(router, "/api/stat"), "root");
+        CHECK_EQ(t, routed(router, "/other"), "root");
+    }
+
+    if (t.begin("router/no_match")) {
+        Router empty({});
+        CHECK_EQ(t, routed(empty, "/"), "");
+
+        Router files({{"/a", "a", Router::FILE_ROUTE}, {"/dir", "dir", Router::DIRECTORY_ROUTE}});
+        CHECK_EQ(t, routed(files, "/"), "");
+        CHECK_EQ(t, routed(files, "/ab"), "");
+        CHECK_EQ(t, routed(files, "/di"), "");
+        CHECK_EQ(t, routed(files, "/dirt"), "");
+        CHECK_EQ(t, routed(files, "/dir/t"), "dir");
+        CHECK_EQ(t, routed(files, ""), "");
+    }
+}
+
+static void floodGuardTests(Tests& t) {
+    using namespace http2::protocol;
+
+    if (t.begin("flood/token_bucket")) {
+        const int64_t second = 1000000000;
+        TokenBucket bucket(3, 2);
+        int64_t now = Metrics::now(); // not before the bucket, it starts counting when it is made
+
+        // the burst, then nothing until time refills it
+        CHECK(t, bucket.take(now));
+        CHECK(t, bucket.take(now));
+        CHECK(t, bucket.take(now));
+        CHECK(t, !bucket.take(now));
+        CHECK(t, !bucket.take(now + second / 4));
+        CHECK(t, bucket.take(now + second / 2));
+        CHECK(t, !bucket.take(now + second / 2));
+
+        // a long pause refills no more than the burst
+        now += 10 * second;
+        int taken = 0;
+        while (bucket.take(now)) taken++;
+        CHECK_EQ(t, taken, 3);
+
+        // a given back token can be taken again, but never beyond the burst
+        bucket.give();
+        CHECK(t, bucket.take(now));
+        CHECK(t, !bucket.take(now));
+        for (int i = 0; i < 10; ++i) bucket.give();
+        taken = 0;
+        while (bucket.take(now)) taken++;
+        CHECK_EQ(t, taken, 3);
+    }
+
+    if (t.begin("flood/guard")) {
+        FloodGuard guard;
+        int charged = 0;
+        while (guard.charge(Frame(PING_FRAME), false) == FLOOD_NONE && charged <= PING_BUDGET_BURST) charged++;
+        CHECK_EQ(t, charged, PING_BUDGET_BURST);
+        CHECK_EQ(t, guard.charge(Frame(PING_FRAME), false), FLOOD_PINGS);
+
+        // acks, other budgets and frames that cost nothing are unaffected by the empty ping bucket
+        CHECK_EQ(t, guard.charge(Frame(PING_FRAME, ACK), false), FLOOD_NONE);
+        CHECK_EQ(t, guard.charge(Frame(SETTINGS_FRAME), false), FLOOD_NONE);
+        CHECK_EQ(t, guard.charge(Frame(WINDOW_UPDATE_FRAME, NO_FLAGS, 0, {0, 0, 0, 1}), false), FLOOD_NONE);
+
+        // a continued HEADERS opens nothing, an answered stream gives its token back
+        int refused = 0;
+        for (int i = 0; i < 2 * STREAM_BUDGET_BURST; ++i) {
+            if (guard.charge(Frame(HEADERS_FRAME, END_STREAM, 1), false) != FLOOD_NONE) refused++;
+            if (guard.charge(Frame(HEADERS_FRAME, END_STREAM, 2 * i + 1), true) != FLOOD_NONE) refused++;
+            guard.streamAnswered();
+        }
+        CHECK_EQ(t, refused, 0);
+
+        // empty DATA only counts without END_STREAM
+        for (int i = 0; i < 2 * EMPTY_DATA_BUDGET_BURST; ++i) {
+            if (guard.charge(Frame(DATA_FRAME, END_STREAM, 1), false) != FLOOD_NONE) refused++;
+            if (guard.charge(Frame(DATA_FRAME, NO_FLAGS, 1, {1}), false) != FLOOD_NONE) refused++;
+        }
+        CHECK_EQ(t, refused, 0);
+        charged = 0;
+        while (guard.charge(Frame(DATA_FRAME, NO_FLAGS, 1), false) == FLOOD_NONE && charged <= EMPTY_DATA_BUDGET_BURST) charged++;
+        CHECK_EQ(t, charged, EMPTY_DATA_BUDGET_BURST);
+
+        // rapid reset, resets run out long before streams would
+        charged = 0;
+        while (guard.charge(Frame(RST_STREAM_FRAME, NO_FLAGS, 1, {0, 0, 0, 8}), false) == FLOOD_NONE && charged <= RESET_BUDGET_BURST) charged++;
+        CHECK_EQ(t, charged, RESET_BUDGET_BURST);
+        CHECK_EQ(t, guard.charge(Frame(RST_STREAM_FRAME, NO_FLAGS, 3, {0, 0, 0, 8}), false), FLOOD_RESETS);
+    }
+}
+
+// a file holding contents for the duration of a test, removed again by the destructor
+class TempFile {
+public:
+    std::string path;
+
+    explicit TempFile(const std::string& contents) {
+        char name[] = "/tmp/unittestsXXXXXX";
+        int fd = mkstemp(name);
+        if (fd >= 0) close(fd);
+        path = name;
+        std::ofstream(path) << contents;
+    }
+
+    ~TempFile() { unlink(path.c_str()); }
+};
+
+static std::string joined(const std::vector<std::string>& list) {
+    std::string out;
+    for (const std::string& item : list) out += (out.empty() ? "" : " ") + item;
+    return out;
+}
+
+// stat() results the stat caches handed out so far, hits and misses
+static double statLookups() {
+    std::istringstream lines(Metrics::render());
+    std::string line;
+    double total = 0;
+    while (std::getline(lines, line)) {
+        if (line.rfind("http2_cache_lookups_total{cache=\"stat\",", 0) == 0) {
+            total += std::atof(line.substr(line.rfind(' ') + 1).c_str());
+        }
+    }
+    return total;
+}
+
+static void pushManifestTests(Tests& t) {
+    if (t.begin("push/scan_html")) {
+        TempFile html(
+            "<html><head>\n"
+            "<LINK REL=\"stylesheet\" HREF=\"/css/site.css\">\n"
+            "<link rel='preload' href='fonts/a.woff2' as='font'>\n"
+            "<link rel=icon href=/favicon.ico>\n"
+            "<link rel=modulepreload href=/js/mod.js>\n"
+            "<script src=\"app.js#v2\"></script>\n"
+            "<script>var inline = 1;</script>\n"
+            "</head><body>\n"
+            "<img alt=\"logo\" src=\"../img/logo.png\">\n"
+            "<img src=\"https://cdn.example.com/x.png\">\n"
+            "<img src=\"//cdn.example.com/y.png\">\n"
+            "<img src=\"data:image/png;base64,AAAA\">\n"
+            "<img src=\"/css/site.css\">\n"
+            "</body></html>\n");
+
+        PushManifest manifest;
+        manifest.scanHtml("/docs/index.html", html.path);
+        CHECK_EQ(t, joined(manifest.assetsFor("/docs/index.html")),
+                 "/css/site.css /docs/fonts/a.woff2 /js/mod.js /docs/app.js /docs/../img/logo.png");
+        CHECK_EQ(t, joined(manifest.assetsFor("/docs/other.html")), "");
+
+        PushManifest missing;
+        missing.scanHtml("/", "/nonexistent/index.html");
+        CHECK_EQ(t, joined(missing.assetsFor("/")), "");
+    }
+
+    if (t.begin("push/manifest")) {
+        TempFile file(
+            "# route asset asset ...\n"
+            "/html /html/style.css /html/app.js   # trailing comment\n"
+            "\n"
+            "   /html /html/style.css /html/logo.png\n"
+            "/lonely\n");
+
+        PushManifest manifest;
+        CHECK(t, manifest.load(file.path));
+        CHECK_EQ(t, joined(manifest.assetsFor("/html")), "/html/style.css /html/app.js /html/logo.png");
+        // a directory route is found with and without its trailing slash
+        CHECK_EQ(t, joined(manifest.assetsFor("/html/")), "/html/style.css /html/app.js /html/logo.png");
+        CHECK_EQ(t, joined(manifest.assetsFor("/lonely")), "");
+        CHECK(t, !manifest.load("/nonexistent/push.manifest"));
+    }
+
+    if (t.begin("push/limit")) {
+        PushManifest manifest;
+        manifest.add("/", "/");
+        for (int i = 0; i < 2 * MAX_PUSHES_PER_RESPONSE; ++i) manifest.add("/", "/asset" + std::to_string(i));
+        CHECK_EQ(t, manifest.assetsFor("/").size(), (size_t)MAX_PUSHES_PER_RESPONSE);
+        CHECK_EQ(t, manifest.assetsFor("/").front(), "/asset0");
+    }
+
+    if (t.begin("push/digest")) {
+        char dir[] = "/tmp/unittestsXXXXXX";
+        CHECK(t, mkdtemp(dir) != nullptr);
+        std::string style = std::string(dir) + "/style.css";
+        std::string script = std::string(dir) + "/app.js";
+        std::ofstream(style) << "body {}";
+        std::ofstream(script) << "var x;";
+        TempFile manifest("/page /style.css /app.js\n");
+        WebBinder binder;
+        binder.bindFile(style, "/style.css");
+        binder.bindFile(script, "/app.js");
+        binder.loadPushManifest(manifest.path);
+
+        // computed once, after that the assets are not looked up again
+        std::string digest = binder.pushDigest("/page");
+        CHECK(t, statLookups() > 0);
+        double lookups = statLookups();
+        CHECK_EQ(t, binder.pushDigest("/page?v=2"), digest);
+        CHECK_EQ(t, statLookups(), lookups);
+
+        // until inotify reports that an asset changed
+        std::ofstream(script) << "var x, y;";
+        std::string changed = digest;
+        for (int i = 0; i < 200 && changed == digest; i++) {
+            usleep(10000);
+            changed = binder.pushDigest("/page");
+        }
+        CHECK(t, changed != digest);
+        CHECK_EQ(t, binder.pushDigest("/page"), changed);
+
+        unlink(style.c_str());
+        unlink(script.c_str());
+        rmdir(dir);
+    }
+}
+
+static std::string headersOf(const std::vector<http2::headers::Header>& headers) {
+    std::string out;
+    for (const auto& header : headers) out += header.name + ": " + header.value + "\n";
+    return out;
+}
+
+static void hpackTests(Tests& t) {
+    using http2::headers::Header;
+
+    if (!t.begin("hpack/long_fields")) return;
+
+    // lengths of 127 and more need a second length byte, they used to abort the encoder
+    std::string accept = "text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,"
+                         "*/*;q=0.8,application/signed-exchange;v=b3;q=0.7";
+    std::string link;
+    for (int i = 0; i < 8; ++i) link += (i ? ", " : "") + std::string("</html/assets/script") + std::to_string(i) + ".js>; rel=preload; as=script";
+    const std::vector<Header> headers = {
+        {":status", "200"},
+        {"accept", accept},
+        {"link", link},
+        {std::string(126, 'a'), "x"},
+        {std::string(127, 'b'), std::string(127, 'y')},
+        {std::string(300, 'c'), std::string(5000, 'z')},
+        {"set-cookie", "id=" + std::string(200, '7')},
+    };
+    CHECK(t, accept.size() >= 127);
+
+    hpack::Encoder encoder;
+    hpack::Decoder decoder;
+    for (int round = 0; round < 2; ++round) {
+        // the second round encodes against the dynamic table the first one filled
+        std::vector<uint8_t> block;
+        encoder.encode_all(headers, block);
+        std::vector<Header> decoded;
+        CHECK(t, decoder.decode(block, decoded));
+        CHECK_EQ(t, headersOf(decoded), headersOf(headers));
+    }
+}
+
+// Plays the browser for one Client of the real server over a MemoryTransport, like the stack
+// benchmarks do. Frames go in through the socketpair, the client is driven the way the event
+// loop drives it, and every frame the server sends back is kept for the checks.
+class TestPeer {
+private:
+    hpack::Encoder encoder;
+    hpack::Decoder decoder;
+    std::vector<uint8_t> in;
+    uint32_t nextStreamId = 1;
+    epoll_event event{};
+
+    // parses what the server wrote so far, false when nothing new arrived
+    bool receive() {
+        uint8_t buf[65536];
+        bool any = false;
+        ssize_t n;
+        while ((n = recv(transport->peerFD, buf, sizeof(buf), 0)) > 0) {
+            in.insert(in.end(), buf, buf + n);
+            any = true;
+        }
+
+        size_t consumed = 0;
+        std::vector<protocol::Frame> parsed = protocol::Frame::toFrames(in.data(), in.data() + in.size(), consumed);
+        in.erase(in.begin(), in.begin() + consumed);
+        for (const auto& frame : parsed) {
+            if (frame.type() == protocol::HEADERS_FRAME) {
+                std::vector<http2::headers::Header> headers;
+                decoder.decode(frame.payload(), headers);
+                for (const auto& header : headers) {
+                    if (header.name == ":status") statuses[frame.stream_id()].push_back(header.value);
+                    if (header.name == "link") links[frame.stream_id()].push_back(header.value);
+                }
+            }
+            frames.push_back(frame);
+        }
+        return any;
+    }
+
+public:
+    MemoryTransport* transport;
+    Client* client;
+    std::vector<protocol::Frame> frames;                       // everything the server sent, in order
+    std::map<uint32_t, std::vector<std::string>> statuses;     // :status of each response HEADERS by stream
+    std::map<uint32_t, std::vector<std::string>> links;        // link headers of the responses by stream
+
+    TestPeer(WebBinder* binder, const protocol::Settings& settings = protocol::Settings())
+        : transport(new MemoryTransport()) {
+        sockaddr_in6 addr{};
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_loopback;
+        static int nextId = 1;
+        client = new Client(nextId++, addr, sizeof(addr), &ClientManager::threadPool, transport, binder);
+
+        static const std::string preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+        std::vector<uint8_t> out(preface.begin(), preface.end());
+        protocol::Frame frame(protocol::SETTINGS_FRAME, protocol::NO_FLAGS, 0);
+        settings.encode(frame.mutable_payload());
+        std::vector<uint8_t> encoded = frame.encode();
+        out.insert(out.end(), encoded.begin(), encoded.end());
+        write(out);
+    }
+
+    ~TestPeer() { delete client; }
+
+    TestPeer(const TestPeer&) = delete;
+    TestPeer& operator=(const TestPeer&) = delete;
+
+    bool closed() const { return client->clientFD.state == FD_CLOSED; }
+
+    // runs the client until nothing new has arrived for a while, bodies produced on a worker included
+    void settle() {
+        int64_t quietSince = Metrics::now();
+        while (!closed() && Metrics::now() - quietSince < 50 * 1000000LL) {
+            ClientManager::handleClient(client, event);
+            if (receive()) {
+                quietSince = Metrics::now();
+                continue;
+            }
+            pollfd pfd = {transport->peerFD, POLLIN, 0};
+            poll(&pfd, 1, 5);
+        }
+        receive();
+    }
+
+    void write(const std::vector<uint8_t>& bytes) {
+        size_t at = 0;
+        while (at < bytes.size()) {
+            ssize_t n = ::send(transport->peerFD, bytes.data() + at, bytes.size() - at, MSG_NOSIGNAL);
+            if (n < 0) {
+                ClientManager::handleClient(client, event);
+                receive();
+                continue;
+            }
+            at += n;
+        }
+        settle();
+    }
+
+    void send(const protocol::Frame& frame) { write(frame.encode()); }
+
+    // the HEADERS of a GET on a new stream, for tests that send several requests in one write
+    protocol::Frame requestFrame(const std::string& path, uint8_t flags = protocol::END_HEADERS | protocol::END_STREAM,
+                                 const std::vector<http2::headers::Header>& extra = {}) {
+        uint32_t streamId = nextStreamId;
+        nextStreamId += 2;
+
+        std::vector<http2::headers::Header> headers = {
+            {":method", "GET"}, {":scheme", "https"}, {":authority", "localhost"}, {":path", path},
+        };
+        headers.insert(headers.end(), extra.begin(), extra.end());
+        protocol::Frame frame(protocol::HEADERS_FRAME, flags, streamId);
+        encoder.encode_all(headers, frame.mutable_payload());
+        return frame;
+    }
+
+    // a GET on a new stream, flags END_HEADERS | END_STREAM unless the test wants it in pieces
+    uint32_t request(const std::string& path, uint8_t flags = protocol::END_HEADERS | protocol::END_STREAM,
+                     const std::vector<http2::headers::Header>& extra = {}) {
+        protocol::Frame frame = requestFrame(path, flags, extra);
+        send(frame);
+        return frame.stream_id();
+    }
+
+    void windowUpdate(uint32_t streamId, uint32_t increment) {
+        send(protocol::Frame(protocol::WINDOW_UPDATE_FRAME, protocol::NO_FLAGS, streamId, {
+            uint8_t(increment >> 24), uint8_t(increment >> 16), uint8_t(increment >> 8), uint8_t(increment)
+        }));
+    }
+
+    void settings(const protocol::Settings& settings) {
+        protocol::Frame frame(protocol::SETTINGS_FRAME, protocol::NO_FLAGS, 0);
+        settings.encode(frame.mutable_payload());
+        send(frame);
+    }
+
+    size_t dataBytes(uint32_t streamId) const {
+        size_t bytes = 0;
+        for (const auto& frame : frames) {
+            if (frame.type() == protocol::DATA_FRAME && frame.stream_id() == streamId) bytes += frame.payload().size();
+        }
+        return bytes;
+    }
+
+    bool ended(uint32_t streamId) const {
+        for (const auto& frame : frames) {
+            if ((frame.type() == protocol::DATA_FRAME || frame.type() == protocol::HEADERS_FRAME) &&
+                frame.stream_id() == streamId && frame.has_flag(protocol::END_STREAM)) return true;
+        }
+        return false;
+    }
+
+    // the error code of the RST_STREAM (or with stream 0, the GOAWAY) the server sent, -1 for none
+    int64_t errorOf(uint32_t streamId) const {
+        for (const auto& frame : frames) {
+            const std::vector<uint8_t>& p = frame.payload();
+            if (streamId == 0 && frame.type() == protocol::GOAWAY_FRAME && p.size() >= 8) {
+                return (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+            }
+            if (streamId != 0 && frame.type() == protocol::RST_STREAM_FRAME && frame.stream_id() == streamId && p.size() == 4) {
+                return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+            }
+        }
+        return -1;
+    }
+};
+
+static void flowControlTests(Tests& t) {
+    TempFile file(std::string(100000, 'x'));
+    WebBinder binder;
+    binder.bindFile(file.path, "/file");
+
+    if (t.begin("flow/window_update")) {
+        protocol::Settings settings;
+        settings.set_initial_window_size(4000);
+        TestPeer peer(&binder, settings);
+
+        uint32_t sid = peer.request("/file");
+        CHECK_EQ(t, peer.dataBytes(sid), 4000u);
+        CHECK(t, !peer.ended(sid));
+
+        peer.windowUpdate(sid, 6000);
+        CHECK_EQ(t, peer.dataBytes(sid), 10000u);
+
+        // the connection window of 65535 holds the stream back as well
+        peer.windowUpdate(sid, 100000);
+        CHECK_EQ(t, peer.dataBytes(sid), 65535u);
+        peer.windowUpdate(0, 100000);
+        CHECK_EQ(t, peer.dataBytes(sid), 100000u);
+        CHECK(t, peer.ended(sid));
+        CHECK(t, peer.client->streams.empty());
+        CHECK(t, !peer.closed());
+    }
+
+    if (t.begin("flow/partial_settings")) {
+        protocol::Settings settings;
+        settings.set_initial_window_size(4000);
+        settings.set_enable_push(false);
+        settings.set_max_frame_size(32768);
+        TestPeer peer(&binder, settings);
+
+        uint32_t sid = peer.request("/file");
+        CHECK_EQ(t, peer.dataBytes(sid), 4000u);
+
+        // only the header table size changes, the window and the other settings stay as they were
+        protocol::Settings tableOnly;
+        tableOnly.set_header_table_size(8192);
+        peer.settings(tableOnly);
+        CHECK_EQ(t, peer.dataBytes(sid), 4000u);
+        CHECK_EQ(t, peer.client->settings.initial_window_size(), 4000u);
+        CHECK_EQ(t, peer.client->settings.max_frame_size(), 32768u);
+        CHECK(t, !peer.client->settings.enable_push());
+        CHECK_EQ(t, peer.client->streams.at(sid)->sendWindow, 0);
+
+        // a larger initial window credits the open stream with the difference
+        protocol::Settings larger;
+        larger.set_initial_window_size(14000);
+        peer.settings(larger);
+        CHECK_EQ(t, peer.dataBytes(sid), 14000u);
+        CHECK_EQ(t, peer.client->settings.max_frame_size(), 32768u);
+
+        // and one that pushes an open stream's window past 2^31-1 is a FLOW_CONTROL_ERROR
+        peer.windowUpdate(sid, 100000);
+        CHECK(t, peer.client->streams.at(sid)->sendWindow > 0);
+        protocol::Settings overflow;
+        overflow.set_initial_window_size(0x7FFFFFFF);
+        peer.settings(overflow);
+        CHECK_EQ(t, peer.errorOf(0), (int64_t) protocol::FLOW_CONTROL_ERROR);
+        CHECK(t, peer.closed());
+    }
+}
+
+static void streamLifecycleTests(Tests& t) {
+    TempFile small(std::string(1000, 's'));
+    TempFile large(std::string(100000, 'l'));
+    WebBinder binder;
+    binder.bindFile(small.path, "/small");
+    binder.bindFile(large.path, "/large");
+
+    if (t.begin("stream/request_body_after_response")) {
+        TestPeer peer(&binder);
+
+        // the answer is complete before the request is, the rest of it is turned down with NO_ERROR
+        uint32_t sid = peer.request("/small", protocol::END_HEADERS);
+        CHECK(t, peer.ended(sid));
+        CHECK_EQ(t, peer.errorOf(sid), (int64_t) protocol::NO_ERROR);
+        CHECK(t, peer.client->streams.empty());
+        CHECK_EQ(t, peer.client->peerStreams, 0u);
+
+        // DATA the peer had sent before it saw the reset is dropped quietly
+        peer.send(protocol::Frame(protocol::DATA_FRAME, protocol::END_STREAM, sid, {1, 2, 3}));
+        CHECK(t, !peer.closed());
+        CHECK_EQ(t, peer.errorOf(0), -1);
+
+        // the same for a body that needed a window update to finish
+        uint32_t large = peer.request("/large", protocol::END_HEADERS);
+        CHECK(t, !peer.ended(large));
+        peer.windowUpdate(large, 100000);
+        peer.windowUpdate(0, 100000);
+        CHECK(t, peer.ended(large));
+        CHECK_EQ(t, peer.errorOf(large), (int64_t) protocol::NO_ERROR);
+        CHECK(t, peer.client->streams.empty());
+    }
+
+    if (t.begin("stream/request_body_before_response")) {
+        TestPeer peer(&binder);
+
+        // the request ends with a DATA frame while the response is held back by flow control
+        uint32_t sid = peer.request("/large", protocol::END_HEADERS);
+        CHECK_EQ(t, peer.client->streams.at(sid)->state, OPEN);
+        peer.send(protocol::Frame(protocol::DATA_FRAME, protocol::END_STREAM, sid, {1, 2, 3}));
+        CHECK_EQ(t, peer.client->streams.at(sid)->state, HALF_CLOSED_REMOTE);
+
+        peer.windowUpdate(sid, 100000);
+        peer.windowUpdate(0, 100000);
+        CHECK(t, peer.ended(sid));
+        CHECK_EQ(t, peer.errorOf(sid), -1);
+        CHECK(t, peer.client->streams.empty());
+    }
+
+    if (t.begin("stream/continuation")) {
+        TestPeer peer(&binder);
+
+        // END_STREAM on HEADERS still counts once a CONTINUATION ends the header block
+        uint32_t sid = peer.request("/small", protocol::END_STREAM);
+        CHECK(t, peer.client->streams.count(sid) == 1);
+        peer.send(protocol::Frame(protocol::CONTINUATION_FRAME, protocol::END_HEADERS, sid));
+        CHECK(t, peer.ended(sid));
+        CHECK_EQ(t, peer.dataBytes(sid), 1000u);
+        CHECK_EQ(t, peer.errorOf(sid), -1);
+        CHECK(t, peer.client->streams.empty());
+    }
+}
+
+// A generated body that has nothing to give until the test opens its gate, the worker compressing
+// it sits in wait() meanwhile. The gate opens by itself after a few seconds so a regression fails
+// the checks instead of hanging the run.
+struct Gate {
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool open = false;
+    std::atomic<bool> entered{false};
+    std::atomic<bool> destroyed{false};
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex);
+        open = true;
+        opened.notify_all();
+    }
+};
+
+class GatedBodyStream : public BodyStream {
+private:
+    std::shared_ptr<Gate> gate;
+    size_t left = 4096;
+public:
+    explicit GatedBodyStream(std::shared_ptr<Gate> gate) : gate(std::move(gate)) {}
+
+    ~GatedBodyStream() override { gate->destroyed = true; }
+
+    size_t remaining() const override { return left; }
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override {
+        {
+            std::lock_guard<std::mutex> lock(gate->mutex);
+            if (!gate->open) return WOULD_BLOCK;
+        }
+        size_t len = std::min(maxLen, left);
+        std::memset(dst, 'g', len);
+        left -= len;
+        return len;
+    }
+
+    void wait() override {
+        gate->entered = true;
+        std::unique_lock<std::mutex> lock(gate->mutex);
+        gate->opened.wait_for(lock, std::chrono::seconds(3), [this] { return gate->open; });
+        gate->open = true;
+    }
+
+    void skip(size_t len) override { left -= std::min(len, left); }
+};
+
+static bool waitFor(const std::atomic<bool>& flag) {
+    for (int i = 0; i < 200 && !flag; i++) usleep(10000);
+    return flag;
+}
+
+static void admissionTests(Tests& t) {
+    TempFile file(std::string(100000, 'x'));
+    WebBinder binder;
+    binder.bindFile(file.path, "/file");
+    protocol::Settings noWindow;
+    noWindow.set_initial_window_size(0);
+
+    if (t.begin("admission/connection_caps")) {
+        size_t before = Admission::connections;
+
+        size_t admitted = 0;
+        while (Admission::admit("192.0.2.1")) admitted++;
+        CHECK_EQ(t, admitted, Admission::maxConnectionsPerIp);
+        CHECK(t, Admission::admit("192.0.2.2"));
+        Admission::release("192.0.2.1");
+        CHECK(t, Admission::admit("192.0.2.1"));
+        for (size_t i = 0; i < admitted; i++) Admission::release("192.0.2.1");
+        Admission::release("192.0.2.2");
+        CHECK_EQ(t, Admission::connections, before);
+
+        // at the global cap accepting pauses, and resumes only below ADMISSION_RESUME_PERCENT of it
+        std::vector<std::string> ips;
+        for (size_t i = 0; Admission::connections < Admission::maxConnections; i++) {
+            std::string ip = "10." + std::to_string(i >> 16 & 255) + "." + std::to_string(i >> 8 & 255) + "." +
+                             std::to_string(i & 255);
+            if (Admission::admit(ip)) ips.push_back(ip);
+        }
+        CHECK(t, !Admission::admit("203.0.113.1"));
+        CHECK(t, Admission::acceptPaused());
+        Admission::release(ips.back());
+        ips.pop_back();
+        CHECK(t, Admission::acceptPaused());
+        while (Admission::connections * 100 >= Admission::maxConnections * ADMISSION_RESUME_PERCENT) {
+            Admission::release(ips.back());
+            ips.pop_back();
+        }
+        CHECK(t, !Admission::acceptPaused());
+        for (const auto& ip : ips) Admission::release(ip);
+        CHECK_EQ(t, Admission::connections, before);
+    }
+
+    if (t.begin("admission/stream_limits")) {
+        // with no window the responses cannot finish, every stream stays open
+        TestPeer peer(&binder, noWindow);
+        std::vector<uint8_t> requests;
+        for (size_t i = 0; i < Admission::maxConcurrentStreams; i++) {
+            std::vector<uint8_t> frame = peer.requestFrame("/file").encode();
+            requests.insert(requests.end(), frame.begin(), frame.end());
+        }
+        peer.write(requests);
+        CHECK_EQ(t, peer.client->peerStreams, Admission::maxConcurrentStreams);
+
+        // one more than SETTINGS_MAX_CONCURRENT_STREAMS is refused, the connection stays up
+        uint32_t refused = peer.request("/file");
+        CHECK_EQ(t, peer.errorOf(refused), (int64_t) protocol::REFUSED_STREAM);
+        CHECK_EQ(t, peer.client->peerStreams, Admission::maxConcurrentStreams);
+        CHECK(t, !peer.closed());
+
+        // past the budget of the whole server a new connection is turned away as well
+        TestPeer other(&binder, noWindow);
+        size_t open = Admission::openStreams;
+        Admission::openStreams = Admission::maxOpenStreams;
+        uint32_t calm = other.request("/file");
+        Admission::openStreams = open;
+        CHECK_EQ(t, other.errorOf(calm), (int64_t) protocol::ENHANCE_YOUR_CALM);
+        CHECK_EQ(t, other.client->peerStreams, 0u);
+    }
+
+    if (t.begin("admission/shed_idle")) {
+        TestPeer idle(&binder);
+        TestPeer busy(&binder, noWindow);
+        uint32_t sid = busy.request("/file");
+        int idleFD = idle.client->clientFD.fd;
+        int busyFD = busy.client->clientFD.fd;
+        ClientManager::clients[idleFD] = idle.client;
+        ClientManager::clients[busyFD] = busy.client;
+        int watch = dup(idle.transport->peerFD); // the transport goes away with the shed client
+
+        size_t open = Admission::openStreams;
+        Admission::openStreams = Admission::maxOpenStreams;
+        CHECK(t, Admission::overloaded());
+        ClientManager::shedIdle();
+        Admission::openStreams = open;
+
+        // the idle connection is closed once its GOAWAY is out, the one with a stream stays
+        CHECK(t, ClientManager::clients.count(idleFD) == 0);
+        if (ClientManager::clients.count(idleFD) == 0) idle.client = nullptr;
+        CHECK(t, ClientManager::clients.count(busyFD) == 1);
+        CHECK_EQ(t, busy.client->drainDeadlineNs, 0);
+        CHECK(t, busy.client->streams.count(sid) == 1);
+        CHECK(t, !ClientManager::draining());
+
+        std::vector<uint8_t> in(65536);
+        ssize_t n = recv(watch, in.data(), in.size(), MSG_DONTWAIT);
+        in.resize(n > 0 ? n : 0);
+        size_t consumed = 0;
+        bool goaway = false;
+        for (const auto& frame : protocol::Frame::toFrames(in.data(), in.data() + in.size(), consumed)) {
+            goaway = goaway || frame.type() == protocol::GOAWAY_FRAME;
+        }
+        CHECK(t, goaway);
+
+        close(watch);
+        ClientManager::clients.erase(idleFD);
+        ClientManager::clients.erase(busyFD);
+    }
+}
+
+static void earlyHintsTests(Tests& t) {
+    TempFile page("<html></html>");
+    TempFile style("body {}");
+    TempFile script("var x;");
+    TempFile manifest("/page /style.css /app.js\n");
+    WebBinder binder;
+    binder.bindFile(page.path, "/page");
+    binder.bindFile(style.path, "/style.css");
+    binder.bindFile(script.path, "/app.js");
+    binder.loadPushManifest(manifest.path);
+
+    if (t.begin("push/early_hints")) {
+        protocol::Settings noPush;
+        noPush.set_enable_push(false);
+        TestPeer peer(&binder, noPush);
+
+        // the 103 comes first and the final response does not repeat its link header
+        uint32_t sid = peer.request("/page");
+        CHECK_EQ(t, joined(peer.statuses[sid]), "103 200");
+        CHECK_EQ(t, joined(peer.links[sid]), "</style.css>; rel=preload; as=style, </app.js>; rel=preload; as=script");
+        CHECK(t, peer.ended(sid));
+
+        // a conditional request may end in a 304, it gets no hints
+        uint32_t conditional = peer.request("/page", protocol::END_HEADERS | protocol::END_STREAM,
+                                            {{"if-none-match", "\"other\""}});
+        CHECK_EQ(t, joined(peer.statuses[conditional]), "200");
+        CHECK(t, peer.links[conditional].empty());
+    }
+
+    if (t.begin("push/early_hints_pushed")) {
+        TestPeer peer(&binder);
+
+        // a client that takes pushes gets the assets themselves instead
+        uint32_t sid = peer.request("/page");
+        CHECK_EQ(t, joined(peer.statuses[sid]), "200");
+        CHECK(t, peer.links[sid].empty());
+        CHECK_EQ(t, peer.statuses.size(), 3u);
+    }
+}
+
+static void compressionTests(Tests& t) {
+    if (t.begin("compress/reset_mid_chunk")) {
+        std::shared_ptr<Gate> gate = std::make_shared<Gate>();
+        WebBinder binder;
+        binder.bindHandler("/gated", [gate](const std::map<std::string, std::string>&) {
+            ResponseData data;
+            data.mimeType = "text/html";
+            data.generator = [gate]() { return std::make_unique<GatedBodyStream>(gate); };
+            return data;
+        });
+        TestPeer peer(&binder);
+
+        uint32_t sid = peer.request("/gated", protocol::END_HEADERS | protocol::END_STREAM, {{"accept-encoding", "gzip"}});
+        CHECK(t, waitFor(gate->entered));
+        CHECK_EQ(t, peer.statuses[sid].size(), 1u);
+        CHECK_EQ(t, peer.dataBytes(sid), 0u);
+
+        // the reset drops the stream while its chunk is still being compressed, the event loop
+        // goes on without waiting for the worker
+        int64_t start = Metrics::now();
+        peer.send(protocol::Frame(protocol::RST_STREAM_FRAME, protocol::NO_FLAGS, sid, {0, 0, 0, protocol::CANCEL}));
+        CHECK(t, Metrics::now() - start < 1000 * 1000000LL);
+        CHECK(t, peer.client->streams.empty());
+        CHECK(t, !gate->destroyed);
+
+        // the job still owns the source and frees it once it is done with the chunk
+        gate->release();
+        CHECK(t, waitFor(gate->destroyed));
+
+        gate->destroyed = false;
+        uint32_t next = peer.request("/gated", protocol::END_HEADERS | protocol::END_STREAM, {{"accept-encoding", "gzip"}});
+        CHECK(t, peer.ended(next));
+        CHECK(t, peer.dataBytes(next) > 0);
+        CHECK(t, waitFor(gate->destroyed));
+        CHECK(t, !peer.closed());
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        switch (opt) {
+            case 'f': filter = optarg; break;
+            default:
+                fprintf(stderr, "usage: unittests [-f filter]\n");
+                return 2;
+        }
+    }
+
+    // the code under test logs what it rejects, that is expected here
+    if (!getenv("LOG_LEVEL")) Logger::setLevel(LEVEL_FATAL);
+
+    Tests tests(filter);
+    byteRangeTests(tests);
+    ifRangeTests(tests);
+    httpDateTests(tests);
+    conditionalTests(tests);
+    escapingTests(tests);
+    routerTests(tests);
+    floodGuardTests(tests);
+    pushManifestTests(tests);
+    hpackTests(tests);
+    flowControlTests(tests);
+    streamLifecycleTests(tests);
+    admissionTests(tests);
+    earlyHintsTests(tests);
+    compressionTests(tests);
+    return tests.finish();
+}
@@ -1,21 +1,265 @@
 #include "logger.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <strings.h>
+#include <unistd.h>
 
+#define LOG_RING_SIZE 4096      // records a thread can queue before it starts dropping them
+#define LOG_IDLE_WAIT_MS 500    // backstop for the writer's sleep, producers wake it as soon as they log
 
-const std::map<std::string, LogColor> Logger::logColors = {
-    {"DEBUG", BLUE},
-    {"INFO", GREEN},
-    {"WARNING", YELLOW},
-    {"ERROR", RED},
-    {"FATAL", MAGENTA}
+std::atomic<int> Logger::level{LOG_LEVEL_INFO};
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+struct LogRecord {
+    int64_t timeNs;
+    LogLevel level;
+    std::string message;
+};
+
+// Single producer, single consumer queue. Only the owning thread pushes and only
+// the writer thread pops, so head and tail are the only synchronisation needed.
+class LogRing {
+private:
+    std::vector<LogRecord> slots;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, written by the writer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, written by the owner
+
+public:
+    const int thread;
+    std::atomic<bool> orphaned{false}; // the owning thread has exited
+
+    LogRing(int thread) : slots(LOG_RING_SIZE), thread(thread) {}
+
+    bool push(LogRecord&& record) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size()) return false;
+        slots[t % slots.size()] = std::move(record);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool pop(LogRecord& record) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        record = std::move(slots[h % slots.size()]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
 };
 
-void Logger::log(const std::string& level, const std::string& message, LogColor color) {
-    if (logColors.find(level) != logColors.end()) {
-        color = logColors.at(level);
-    } else {
-        color = RESET;
-        std::cerr << "Unknown log level: " << level << std::endl;
-        return;
+class LogWriter {
+private:
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::mutex ringsMutex;   // only taken when a thread logs for the first time and by the writer
+    std::mutex outputMutex;  // serialises draining between the writer and flush()
+    FILE* out;
+    bool colors;
+    int nextThread = 0;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> idle{false}; // the writer is about to sleep, the next push has to wake it
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::thread writer;
+
+    bool pending() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (const auto& r : rings) {
+            if (!r->empty()) return true;
+        }
+        return dropped.load(std::memory_order_relaxed) > 0;
+    }
+
+    void run() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            if (drain() > 0) continue;
+
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            idle.store(true, std::memory_order_relaxed);
+            // pairs with the fence in enqueue: either the producer sees idle or we see its record
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!pending() && !stopping.load(std::memory_order_acquire)) {
+                wake.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_WAIT_MS));
+            }
+            idle.store(false, std::memory_order_relaxed);
+        }
+        drain();
+    }
+
+    void notify() {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        wake.notify_one();
+    }
+
+public:
+    LogWriter() : out(stdout), colors(isatty(STDOUT_FILENO)) {
+        const char* levelName = std::getenv("LOG_LEVEL");
+        if (levelName) {
+            static const char* names[] = {"debug", "info", "warning", "error", "fatal"};
+            for (int i = 0; i < 5; ++i) {
+                if (strcasecmp(levelName, names[i]) == 0) Logger::level.store(i);
+            }
+        }
+        const char* file = std::getenv("LOG_FILE");
+        if (file) setOutput(file);
+
+        writer = std::thread(&LogWriter::run, this);
+    }
+
+    // never destroyed, threads may still log while static objects are torn down
+    static LogWriter& instance() {
+        static LogWriter* writer = [] {
+            LogWriter* w = new LogWriter();
+            std::atexit([] { LogWriter::instance().stop(); });
+            return w;
+        }();
+        return *writer;
+    }
+
+    bool setOutput(const std::string& path) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        FILE* file = stdout;
+        if (!path.empty() && path != "-") {
+            file = std::fopen(path.c_str(), "a");
+            if (!file) return false;
+        }
+        if (out != stdout) std::fclose(out);
+        out = file;
+        colors = isatty(fileno(out));
+        return true;
+    }
+
+    LogRing& ring() {
+        struct Owner {
+            std::shared_ptr<LogRing> ring;
+            ~Owner() { if (ring) ring->orphaned.store(true, std::memory_order_release); }
+        };
+        thread_local Owner owner;
+        if (!owner.ring) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            owner.ring = std::make_shared<LogRing>(++nextThread);
+            rings.push_back(owner.ring);
+        }
+        return *owner.ring;
+    }
+
+    void enqueue(LogRecord&& record) {
+        if (stopping.load(std::memory_order_acquire)) {
+            // the writer is gone, late messages during exit are written directly
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::string line = format(record, 0);
+            std::fwrite(line.data(), 1, line.size(), out);
+            std::fflush(out);
+            return;
+        }
+        if (!ring().push(std::move(record))) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // a busy writer drains without being told, only a sleeping one costs a notify
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idle.load(std::memory_order_relaxed)) notify();
+    }
+
+    std::string format(const LogRecord& record, int thread) const {
+        static const char* names[] = {"DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+        static const LogColor colorOf[] = {BLUE, GREEN, YELLOW, RED, MAGENTA};
+
+        time_t seconds = record.timeNs / 1000000000;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char stamp[32];
+        size_t len = strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+        snprintf(stamp + len, sizeof(stamp) - len, ".%03d", (int) (record.timeNs / 1000000 % 1000));
+
+        std::string line;
+        line.reserve(record.message.size() + 48);
+        if (colors) line += Logger::getColorCode(colorOf[record.level]);
+        line += stamp;
+        line += " [";
+        line += names[record.level];
+        line += "] ";
+        if (thread > 0) line += "[" + std::to_string(thread) + "] ";
+        line += record.message;
+        if (colors) line += Logger::getColorCode(RESET);
+        line += '\n';
+        return line;
+    }
+
+    // writes out everything queued so far in one batch, returns the number of records
+    size_t drain() {
+        std::vector<std::shared_ptr<LogRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            // rings of exited threads go once they are empty
+            rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<LogRing>& r) {
+                return r->orphaned.load(std::memory_order_acquire) && r.use_count() == 1 && r->empty();
+            }), rings.end());
+            current = rings;
+        }
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::vector<std::pair<LogRecord, int>> batch;
+        LogRecord record;
+        for (const auto& r : current) {
+            while (r->pop(record)) batch.emplace_back(std::move(record), r->thread);
+        }
+
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (batch.empty() && lost == 0) return 0;
+
+        // rings are drained one after the other, the timestamps restore the order across threads
+        std::stable_sort(batch.begin(), batch.end(), [](const auto& a, const auto& b) {
+            return a.first.timeNs < b.first.timeNs;
+        });
+
+        std::string buffer;
+        for (const auto& [entry, thread] : batch) buffer += format(entry, thread);
+        if (lost > 0) {
+            buffer += format({nowNs(), LEVEL_WARNING,
+                              "Logger dropped " + std::to_string(lost) + " messages, ring buffers were full"}, 0);
+        }
+        std::fwrite(buffer.data(), 1, buffer.size(), out);
+        std::fflush(out);
+        return batch.size();
+    }
+
+    void stop() {
+        if (stopping.exchange(true)) return;
+        notify();
+        if (writer.joinable()) writer.join();
     }
-    std::cout << getColorCode(color) << "[" << level << "] " << message << getColorCode(RESET) << std::endl;
-}
\ No newline at end of file
+};
+
+// started with the program, so LOG_LEVEL applies before the first message is logged
+static LogWriter& startWriter = LogWriter::instance();
+
+bool Logger::setOutput(const std::string& path) {
+    return LogWriter::instance().setOutput(path);
+}
+
+void Logger::log(LogLevel messageLevel, std::string message) {
+    if (messageLevel < level.load(std::memory_order_relaxed)) return;
+
+    LogWriter::instance().enqueue({nowNs(), messageLevel, std::move(message)});
+}
+
+void Logger::flush() {
+    LogWriter::instance().drain();
+}
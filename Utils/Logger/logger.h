@@ -3,6 +3,7 @@
 #include <vector>
 #include <map>
 #include <iostream>
+#include <atomic>
 
 enum LogColor {
     RESET = 0,
@@ -16,35 +17,86 @@ enum LogColor {
     WHITE = 37
 };
 
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_FATAL 4
 
+// levels below this are compiled out, release builds keep INFO and up
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+enum LogLevel {
+    LEVEL_DEBUG = LOG_LEVEL_DEBUG,
+    LEVEL_INFO = LOG_LEVEL_INFO,
+    LEVEL_WARNING = LOG_LEVEL_WARNING,
+    LEVEL_ERROR = LOG_LEVEL_ERROR,
+    LEVEL_FATAL = LOG_LEVEL_FATAL
+};
+
+// The message expression is only evaluated when its level is enabled, so filtered
+// calls cost one comparison and no string building.
+#define LOG_AT(level, message) \
+    do { if ((level) >= LOG_COMPILE_LEVEL && Logger::enabled(level)) Logger::log(level, message); } while (0)
+
+#define LOG_DEBUG(message) LOG_AT(LEVEL_DEBUG, message)
+#define LOG_INFO(message) LOG_AT(LEVEL_INFO, message)
+#define LOG_WARNING(message) LOG_AT(LEVEL_WARNING, message)
+#define LOG_ERROR(message) LOG_AT(LEVEL_ERROR, message)
+#define LOG_FATAL(message) Logger::fatal(message)
+
+// Messages are queued on a ring buffer owned by the calling thread and written
+// out in batches by a background thread, so logging never blocks on the output.
+// LOG_LEVEL (debug, info, warning, error) and LOG_FILE configure it at startup.
 class Logger {
-    static void log(const std::string& level, const std::string& message, LogColor color= RESET); 
-    
-    const static std::map<std::string, LogColor> logColors; 
+    static std::atomic<int> level;
 
     static std::string getColorCode(LogColor color) {
         return "\033[" + std::to_string(color) + "m";
     }
 
+    friend class LogWriter;
+
 public:
+    static bool enabled(LogLevel messageLevel) {
+        return messageLevel >= level.load(std::memory_order_relaxed);
+    }
+
+    static void setLevel(LogLevel minimum) { level.store(minimum, std::memory_order_relaxed); }
+
+    // "-" or an empty path writes to stdout
+    static bool setOutput(const std::string& path);
+
+    static void log(LogLevel messageLevel, std::string message);
+
+    // writes everything queued so far before returning
+    static void flush();
+
     static void debug(const std::string &message) {
-        log("DEBUG", message, BLUE);
+        log(LEVEL_DEBUG, message);
     }
 
     static void info(const std::string &message) {
-        log("INFO", message, GREEN);
+        log(LEVEL_INFO, message);
     }
 
     static void warning(const std::string &message) {
-        log("WARNING", message, YELLOW);
+        log(LEVEL_WARNING, message);
     }
 
     static void error(const std::string &message) {
-        log("ERROR", message, RED);
+        log(LEVEL_ERROR, message);
     }
 
     static void fatal(const std::string &message) {
-        log("FATAL", message, MAGENTA);
+        log(LEVEL_FATAL, message);
+        flush();
         std::exit(EXIT_FAILURE);
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,230 @@
+#include "metrics.h"
+#include "Utils/Logger/logger.h"
+#include <mutex>
+#include <memory>
+#include <map>
+#include <algorithm>
+#include <ctime>
+#include <cstdio>
+
+namespace {
+
+struct MetricInfo {
+    std::string name;
+    std::string help;
+    std::string labels;
+};
+
+struct GaugeInfo {
+    std::string name;
+    std::string help;
+    std::function<double()> read;
+};
+
+struct HistogramShard {
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> sumNs;
+    std::atomic<uint64_t> count;
+};
+
+// One thread's slots. Only the owning thread writes them, the scraper only reads.
+struct Shard {
+    std::atomic<uint64_t> counters[METRICS_MAX_COUNTERS];
+    HistogramShard histograms[METRICS_MAX_HISTOGRAMS];
+
+    Shard() {
+        for (auto& c : counters) c.store(0, std::memory_order_relaxed);
+        for (auto& h : histograms) {
+            for (auto& b : h.buckets) b.store(0, std::memory_order_relaxed);
+            h.sumNs.store(0, std::memory_order_relaxed);
+            h.count.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct Registry {
+    std::mutex mutex; // registration, new threads and scrapes only
+    std::vector<MetricInfo> counters;
+    std::vector<MetricInfo> histograms;
+    std::vector<GaugeInfo> gauges;
+    // shards of exited threads are kept, their counts stay part of the totals
+    std::vector<std::shared_ptr<Shard>> shards;
+
+    static Registry& instance() {
+        static Registry* registry = new Registry(); // outlives every static Counter
+        return *registry;
+    }
+};
+
+Shard& localShard() {
+    thread_local std::shared_ptr<Shard> shard;
+    if (!shard) {
+        shard = std::make_shared<Shard>();
+        Registry& registry = Registry::instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.shards.push_back(shard);
+    }
+    return *shard;
+}
+
+inline void bump(std::atomic<uint64_t>& slot, uint64_t n) {
+    // single writer, so a relaxed load and store is enough and never retries
+    slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+int registerMetric(std::vector<MetricInfo>& list, size_t max, const MetricInfo& info) {
+    std::lock_guard<std::mutex> lock(Registry::instance().mutex);
+    if (list.size() >= max) {
+        LOG_ERROR("Too many metrics, not recording " + info.name);
+        return -1;
+    }
+    list.push_back(info);
+    return list.size() - 1;
+}
+
+std::string withLabels(const std::string& name, const std::string& labels, const std::string& extra = "") {
+    std::string all = labels;
+    if (!extra.empty()) all += (all.empty() ? "" : ",") + extra;
+    return all.empty() ? name : name + "{" + all + "}";
+}
+
+std::string formatNumber(double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    return buf;
+}
+
+void header(std::string& out, std::map<std::string, bool>& described, const std::string& name,
+            const std::string& help, const char* type) {
+    if (described[name]) return;
+    described[name] = true;
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+} // namespace
+
+Counter::Counter(const std::string& name, const std::string& help, const std::string& labels)
+    : id(registerMetric(Registry::instance().counters, METRICS_MAX_COUNTERS, {name, help, labels})) {}
+
+void Counter::add(uint64_t n) const {
+    if (id >= 0) bump(localShard().counters[id], n);
+}
+
+LabeledCounter::LabeledCounter(const std::string& name, const std::string& help, const std::string& label,
+                               const std::vector<std::string>& values) {
+    for (const auto& value : values) {
+        counters.emplace_back(name, help, label + "=\"" + value + "\"");
+    }
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, const std::string& labels)
+    : id(registerMetric(Registry::instance().histograms, METRICS_MAX_HISTOGRAMS, {name, help, labels})) {}
+
+int Histogram::bucketOf(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) return value;
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent >= HISTOGRAM_MAX_EXPONENT) return HISTOGRAM_BUCKETS - 1;
+    int sub = (value >> (exponent - 3)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return HISTOGRAM_SUB_BUCKETS + (exponent - 3) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+uint64_t Histogram::bucketUpperBound(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    int exponent = (bucket - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS + 3;
+    uint64_t sub = (bucket - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS;
+    return ((HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+void Histogram::record(int64_t ns) const {
+    if (id < 0) return;
+    uint64_t value = ns < 0 ? 0 : ns;
+    HistogramShard& h = localShard().histograms[id];
+    bump(h.buckets[bucketOf(value)], 1);
+    bump(h.sumNs, value);
+    bump(h.count, 1);
+}
+
+void Histogram::recordSince(int64_t startNs) const {
+    record(Metrics::now() - startNs);
+}
+
+int64_t Metrics::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void Metrics::gauge(const std::string& name, const std::string& help, std::function<double()> read) {
+    Registry& registry = Registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.gauges.push_back({name, help, std::move(read)});
+}
+
+std::string Metrics::render() {
+    // Prometheus buckets in seconds, the fine grained buckets are folded into these
+    static const double bounds[] = {
+        1e-6, 5e-6, 1e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3,
+        1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+    };
+    const size_t boundCount = sizeof(bounds) / sizeof(bounds[0]);
+
+    Registry& registry = Registry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    std::string out;
+    std::map<std::string, bool> described;
+
+    // samples of one metric have to be listed together, whichever file registered them
+    std::vector<size_t> order(registry.counters.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&registry](size_t a, size_t b) {
+        return registry.counters[a].name < registry.counters[b].name;
+    });
+
+    for (size_t i : order) {
+        uint64_t total = 0;
+        for (const auto& shard : registry.shards) total += shard->counters[i].load(std::memory_order_relaxed);
+
+        const MetricInfo& info = registry.counters[i];
+        header(out, described, info.name, info.help, "counter");
+        out += withLabels(info.name, info.labels) + " " + std::to_string(total) + "\n";
+    }
+
+    for (const auto& gauge : registry.gauges) {
+        header(out, described, gauge.name, gauge.help, "gauge");
+        out += gauge.name + " " + formatNumber(gauge.read()) + "\n";
+    }
+
+    for (size_t i = 0; i < registry.histograms.size(); ++i) {
+        std::vector<uint64_t> cumulative(boundCount + 1, 0);
+        uint64_t sumNs = 0, count = 0;
+        for (const auto& shard : registry.shards) {
+            const HistogramShard& h = shard->histograms[i];
+            for (int b = 0; b < HISTOGRAM_BUCKETS; ++b) {
+                uint64_t n = h.buckets[b].load(std::memory_order_relaxed);
+                if (n == 0) continue;
+                double upper = Histogram::bucketUpperBound(b) / 1e9;
+                size_t slot = 0;
+                while (slot < boundCount && bounds[slot] < upper) slot++;
+                cumulative[slot] += n;
+            }
+            sumNs += h.sumNs.load(std::memory_order_relaxed);
+            count += h.count.load(std::memory_order_relaxed);
+        }
+
+        const MetricInfo& info = registry.histograms[i];
+        header(out, described, info.name, info.help, "histogram");
+        uint64_t running = 0;
+        for (size_t slot = 0; slot <= boundCount; ++slot) {
+            running += cumulative[slot];
+            std::string le = slot < boundCount ? formatNumber(bounds[slot]) : "+Inf";
+            out += withLabels(info.name + "_bucket", info.labels, "le=\"" + le + "\"") + " " +
+                   std::to_string(running) + "\n";
+        }
+        out += withLabels(info.name + "_sum", info.labels) + " " + formatNumber(sumNs / 1e9) + "\n";
+        out += withLabels(info.name + "_count", info.labels) + " " + std::to_string(count) + "\n";
+    }
+
+    return out;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+
+#define METRICS_MAX_COUNTERS 256
+#define METRICS_MAX_HISTOGRAMS 16
+
+// Log-linear buckets in the style of HdrHistogram: 8 sub-buckets per power of two,
+// so every bucket is within 12.5% of the values it holds, up to 2^36 ns (~68 s).
+#define HISTOGRAM_SUB_BUCKETS 8
+#define HISTOGRAM_MAX_EXPONENT 36
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_EXPONENT - 2))
+
+// A monotonically increasing count. Each thread adds into its own slot, which is
+// a plain load and store, so recording never waits; the slots are summed on scrape.
+class Counter {
+private:
+    int id;
+public:
+    // labels are given pre-formatted, e.g. type="DATA"
+    Counter(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    void add(uint64_t n = 1) const;
+};
+
+// One counter per value of a label, e.g. frames by type, indexed by the value's position.
+class LabeledCounter {
+private:
+    std::vector<Counter> counters;
+public:
+    LabeledCounter(const std::string& name, const std::string& help, const std::string& label,
+                   const std::vector<std::string>& values);
+
+    void add(size_t index, uint64_t n = 1) const {
+        if (index < counters.size()) counters[index].add(n);
+    }
+};
+
+// Distribution of durations in nanoseconds, recorded per thread like Counter.
+class Histogram {
+private:
+    int id;
+public:
+    Histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+    void record(int64_t ns) const;
+
+    // since a start taken with Metrics::now()
+    void recordSince(int64_t startNs) const;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketUpperBound(int bucket);
+};
+
+class Metrics {
+public:
+    // CLOCK_MONOTONIC in nanoseconds, the base of every duration recorded
+    static int64_t now();
+
+    // a value read at scrape time, e.g. a queue length
+    static void gauge(const std::string& name, const std::string& help, std::function<double()> read);
+
+    // every metric in the Prometheus text exposition format
+    static std::string render();
+};
@@ -0,0 +1,112 @@
+#include "trace.h"
+#include "Utils/Logger/logger.h"
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+namespace {
+
+struct Span {
+    const char* name; // string literals only, they outlive the ring
+    int conn;
+    int stream;
+    int64_t startNs;
+    int64_t endNs;
+    bool async;
+};
+
+struct Ring {
+    // only sampled connections take the lock, untraced ones never get here
+    std::mutex mutex;
+    std::vector<Span> spans = std::vector<Span>(TRACE_RING_SIZE);
+    uint64_t next = 0;
+
+    static Ring& instance() {
+        static Ring* ring = new Ring(); // spans may be recorded while statics are destroyed
+        return *ring;
+    }
+
+    void push(const Span& span) {
+        std::lock_guard<std::mutex> lock(mutex);
+        spans[next++ % TRACE_RING_SIZE] = span;
+    }
+};
+
+uint64_t sampleEvery() {
+    const char* rate = std::getenv("TRACE_SAMPLE");
+    if (!rate) return 0;
+    double fraction = std::atof(rate);
+    if (fraction <= 0) return 0;
+
+    uint64_t every = fraction >= 1 ? 1 : (uint64_t) std::llround(1 / fraction);
+    LOG_INFO("Tracing 1 in " + std::to_string(every) + " connections");
+    return every;
+}
+
+void appendMicros(std::string& out, int64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld.%03lld", (long long) (ns / 1000), (long long) (ns % 1000));
+    out += buf;
+}
+
+} // namespace
+
+bool Trace::sample() {
+    static const uint64_t every = sampleEvery();
+    static std::atomic<uint64_t> connections{0};
+    if (every == 0) return false;
+    return connections.fetch_add(1, std::memory_order_relaxed) % every == 0;
+}
+
+void Trace::span(const char* name, int conn, int stream, int64_t startNs, int64_t endNs) {
+    Ring::instance().push({name, conn, stream, startNs, endNs ? endNs : Metrics::now(), false});
+}
+
+void Trace::streamSpan(int conn, int stream, int64_t startNs) {
+    Ring::instance().push({"stream", conn, stream, startNs, Metrics::now(), true});
+}
+
+std::string Trace::render() {
+    std::vector<Span> spans;
+    {
+        Ring& ring = Ring::instance();
+        std::lock_guard<std::mutex> lock(ring.mutex);
+        uint64_t first = ring.next > TRACE_RING_SIZE ? ring.next - TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < ring.next; ++i) spans.push_back(ring.spans[i % TRACE_RING_SIZE]);
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool firstEvent = true;
+    auto event = [&](const Span& span, const char* phase, int64_t ns, bool withDuration) {
+        out += firstEvent ? "\n" : ",\n";
+        firstEvent = false;
+        out += "{\"name\":\"" + std::string(span.name) + "\",\"cat\":\"http2\",\"ph\":\"" + phase +
+               "\",\"pid\":1,\"tid\":" + std::to_string(span.conn) + ",\"ts\":";
+        appendMicros(out, ns);
+        if (withDuration) {
+            out += ",\"dur\":";
+            appendMicros(out, span.endNs - span.startNs);
+        }
+        if (span.async) {
+            // async slices pair up by id, streams ids repeat across connections
+            out += ",\"id\":\"" + std::to_string(span.conn) + "." + std::to_string(span.stream) + "\"";
+        }
+        if (span.stream) out += ",\"args\":{\"stream\":" + std::to_string(span.stream) + "}";
+        out += "}";
+    };
+
+    for (const Span& span : spans) {
+        if (span.async) {
+            event(span, "b", span.startNs, false);
+            event(span, "e", span.endNs, false);
+        } else {
+            event(span, "X", span.startNs, true);
+        }
+    }
+
+    out += "\n]}\n";
+    return out;
+}
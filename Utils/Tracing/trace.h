@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include "Utils/Metrics/metrics.h"
+
+#define TRACE_RING_SIZE 16384 // spans kept, the oldest are overwritten first
+
+// Spans of sampled connections, exported as Chrome trace-event JSON for Perfetto or
+// chrome://tracing. Each connection is one track, its streams appear as async slices.
+// Set TRACE_SAMPLE to the fraction of connections to trace, e.g. 0.01; 0 (default) is off.
+class Trace {
+public:
+    // decides once per connection whether its spans are recorded
+    static bool sample();
+
+    // a slice on the connection's track, stream 0 for connection level work; endNs 0 is now
+    static void span(const char* name, int conn, int stream, int64_t startNs, int64_t endNs = 0);
+
+    // the lifetime of a stream, it overlaps the other streams of its connection
+    static void streamSpan(int conn, int stream, int64_t startNs);
+
+    static std::string render();
+};
+
+// Records the enclosing scope as a span when enabled, costs a branch otherwise.
+class TraceSpan {
+private:
+    const char* name;
+    int conn;
+    int stream;
+    int64_t startNs;
+public:
+    TraceSpan(bool enabled, const char* name, int conn, int stream = 0)
+        : name(enabled ? name : nullptr), conn(conn), stream(stream), startNs(enabled ? Metrics::now() : 0) {}
+
+    ~TraceSpan() {
+        if (name) Trace::span(name, conn, stream, startNs);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
@@ -0,0 +1,200 @@
+#include "directoryListing.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include "util.cpp"
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+static const Counter hits("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"listing\",result=\"hit\"");
+static const Counter misses("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"listing\",result=\"miss\"");
+
+ThreadPool ListingCache::scanPool = ThreadPool(LISTING_SCAN_THREADS);
+
+std::shared_ptr<const DirectoryListing> DirectoryListing::scan(const std::string& dir, uint64_t version) {
+    auto listing = std::make_shared<DirectoryListing>();
+    listing->dir = dir;
+    listing->version = version;
+
+    std::error_code ec;
+    for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        const fs::directory_entry& dirEntry = *it;
+        std::error_code entryEc;
+        Entry entry;
+        entry.name = dirEntry.path().filename().string();
+        entry.directory = dirEntry.is_directory(entryEc);
+        if (!entry.directory && !dirEntry.is_regular_file(entryEc)) continue;
+        entry.size = entry.directory ? 0 : dirEntry.file_size(entryEc);
+        entry.mtimeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            dirEntry.last_write_time(entryEc).time_since_epoch()).count();
+        if (entryEc) continue; // removed while we were reading the directory
+        listing->entries.push_back(std::move(entry));
+    }
+    if (ec) {
+        LOG_ERROR("Failed to list directory: " + dir + ", " + ec.message());
+    }
+
+    auto& entries = listing->entries;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        if (a.directory != b.directory) return a.directory;
+        return a.name < b.name;
+    });
+
+    listing->bySize.resize(entries.size());
+    for (uint32_t i = 0; i < entries.size(); ++i) listing->bySize[i] = i;
+    listing->byMtime = listing->bySize;
+    std::stable_sort(listing->bySize.begin(), listing->bySize.end(), [&entries](uint32_t a, uint32_t b) {
+        return entries[a].size < entries[b].size;
+    });
+    std::stable_sort(listing->byMtime.begin(), listing->byMtime.end(), [&entries](uint32_t a, uint32_t b) {
+        return entries[a].mtimeNs < entries[b].mtimeNs;
+    });
+
+    LOG_DEBUG("Scanned " + std::to_string(entries.size()) + " entries in " + dir);
+    return listing;
+}
+
+PendingListing ListingCache::get(const std::string& rawDir, StatCache& stats) {
+    std::string dir = StatCache::normalize(rawDir);
+    uint64_t version = stats.version(dir);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = listings.find(dir);
+    if (it != listings.end() && it->second.version == version) {
+        hits.add();
+        return it->second.listing;
+    }
+    misses.add();
+
+    // set before the signal, a stream woken by it must find the listing ready
+    auto promise = std::make_shared<std::promise<std::shared_ptr<const DirectoryListing>>>();
+    PendingListing listing = promise->get_future().share();
+    scanPool.enqueue(0, [promise, dir, version]() {
+        promise->set_value(DirectoryListing::scan(dir, version));
+        BodyStream::signalReady();
+    });
+
+    if (listings.size() >= LISTING_CACHE_MAX && it == listings.end()) {
+        listings.clear();
+    }
+    listings[dir] = {version, listing};
+    return listing;
+}
+
+ListingBodyStream::Page ListingBodyStream::parsePage(const std::map<std::string, std::string>& params) {
+    Page page;
+
+    auto it = params.find("sort");
+    if (it != params.end()) {
+        if (it->second == "size") page.sort = DirectoryListing::BY_SIZE;
+        else if (it->second == "mtime") page.sort = DirectoryListing::BY_MTIME;
+    }
+
+    it = params.find("order");
+    page.descending = it != params.end() && it->second == "desc";
+
+    it = params.find("limit");
+    if (it != params.end()) {
+        page.limit = std::min<size_t>(std::strtoul(it->second.c_str(), nullptr, 10), LISTING_MAX_LIMIT);
+    }
+
+    it = params.find("page");
+    if (it != params.end()) {
+        page.page = std::max<size_t>(std::strtoul(it->second.c_str(), nullptr, 10), 1);
+    }
+
+    return page;
+}
+
+ListingBodyStream::ListingBodyStream(PendingListing scan, const std::string& boundUrl, const Page& page)
+    : scan(std::move(scan)), boundUrl(boundUrl), page(page), next(0), end(0), footerDone(false), bufferOffset(0) {}
+
+void ListingBodyStream::start() {
+    listing = scan.get();
+    size_t total = listing->entries.size();
+    if (page.limit == 0) {
+        next = 0;
+        end = total;
+    } else {
+        next = std::min(total, (page.page - 1) * page.limit);
+        end = std::min(total, next + page.limit);
+    }
+
+    buffer = "<html><body><h1>Index for " + Util::htmlEscape(listing->dir) + "</h1><ul>";
+}
+
+size_t ListingBodyStream::entryAt(size_t position) const {
+    if (page.descending) position = listing->entries.size() - 1 - position;
+    switch (page.sort) {
+        case DirectoryListing::BY_SIZE: return listing->bySize[position];
+        case DirectoryListing::BY_MTIME: return listing->byMtime[position];
+        default: return position;
+    }
+}
+
+void ListingBodyStream::renderRow(const DirectoryListing::Entry& entry) {
+    // names come from the file system, anything in them must stay text and one path segment
+    std::string href = Util::htmlEscape(boundUrl + Util::percentEncode(entry.name));
+    std::string name = Util::htmlEscape(entry.name);
+    if (entry.directory) {
+        buffer += "<li><img src=\"/html/folder.png\" alt=\"Folder Icon\" style=\"width:16px;height:16px;\"> ";
+        buffer += "<a href=\"" + href + "/\">" + name + "/</a></li>";
+    } else {
+        buffer += "<li><img src=\"/html/file.png\" alt=\"File Icon\" style=\"width:16px;height:16px;\"> ";
+        buffer += "<a href=\"" + href + "\">" + name + "</a></li>";
+    }
+}
+
+std::string ListingBodyStream::pageLink(size_t pageNumber) const {
+    static const char* sortNames[] = {"name", "size", "mtime"};
+    return "?sort=" + std::string(sortNames[page.sort]) + "&amp;order=" + (page.descending ? "desc" : "asc") +
+           "&amp;limit=" + std::to_string(page.limit) + "&amp;page=" + std::to_string(pageNumber);
+}
+
+void ListingBodyStream::renderFooter() {
+    buffer += "</ul>";
+    if (page.limit > 0) {
+        buffer += "<p>";
+        if (page.page > 1) {
+            buffer += "<a href=\"" + pageLink(page.page - 1) + "\">Previous</a> ";
+        }
+        if (end < listing->entries.size()) {
+            buffer += "<a href=\"" + pageLink(page.page + 1) + "\">Next</a>";
+        }
+        buffer += "</p>";
+    }
+    buffer += "</body></html>";
+    footerDone = true;
+}
+
+size_t ListingBodyStream::remaining() const {
+    // the exact length is known once the last row has been rendered
+    return footerDone ? buffer.size() - bufferOffset : UNKNOWN_LENGTH;
+}
+
+ssize_t ListingBodyStream::read(uint8_t* dst, size_t maxLen) {
+    if (!listing) {
+        if (scan.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return WOULD_BLOCK;
+        start();
+    }
+
+    buffer.erase(0, bufferOffset);
+    bufferOffset = 0;
+
+    // one row past maxLen, so the read that takes the last bytes can already report that nothing is left
+    while (!footerDone && buffer.size() <= maxLen) {
+        if (next < end) {
+            renderRow(listing->entries[entryAt(next++)]);
+        } else {
+            renderFooter();
+        }
+    }
+
+    size_t len = std::min(maxLen, buffer.size());
+    std::memcpy(dst, buffer.data(), len);
+    bufferOffset = len;
+    return len;
+}
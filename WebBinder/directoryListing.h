@@ -0,0 +1,102 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <future>
+#include <cstdint>
+#include "Response/bodyStream.h"
+#include "Multithreading/threadPool.h"
+#include "statCache.h"
+
+#pragma once
+
+#define LISTING_CACHE_MAX 256   // directories whose listing is kept in memory
+#define LISTING_MAX_LIMIT 10000 // largest page a client can ask for
+#define LISTING_SCAN_THREADS 2  // directories scanned at once, off the event loop
+
+// What one scan of a directory found. Never modified after the scan, so requests
+// that are still streaming an older snapshot keep it alive on their own.
+struct DirectoryListing {
+    struct Entry {
+        std::string name;
+        bool directory;
+        uint64_t size;
+        int64_t mtimeNs;
+    };
+
+    enum SortKey { BY_NAME, BY_SIZE, BY_MTIME };
+
+    std::string dir;
+    uint64_t version; // StatCache::version of dir at the time of the scan
+    std::vector<Entry> entries;      // directories first, then by name
+    std::vector<uint32_t> bySize;    // indices into entries, smallest first
+    std::vector<uint32_t> byMtime;   // indices into entries, oldest first
+
+    static std::shared_ptr<const DirectoryListing> scan(const std::string& dir, uint64_t version);
+};
+
+typedef std::shared_future<std::shared_ptr<const DirectoryListing>> PendingListing;
+
+// Listing snapshots by directory, rescanned once inotify reports a change. Scans run on
+// their own pool and signal BodyStream::readyFD when done; requests that arrive while
+// a directory is being scanned share that scan.
+class ListingCache {
+private:
+    struct Scan {
+        uint64_t version;
+        PendingListing listing;
+    };
+
+    std::map<std::string, Scan> listings;
+    std::mutex mutex;
+
+    static ThreadPool scanPool;
+
+public:
+    PendingListing get(const std::string& dir, StatCache& stats);
+};
+
+// Renders a page of a listing as HTML a few rows at a time, so only the
+// chunk being sent is ever held in memory however large the directory is.
+// Reads return WOULD_BLOCK until the scan behind it has finished.
+class ListingBodyStream : public BodyStream {
+public:
+    struct Page {
+        DirectoryListing::SortKey sort = DirectoryListing::BY_NAME;
+        bool descending = false;
+        size_t page = 1;  // 1-based
+        size_t limit = 0; // 0 lists every entry
+    };
+
+    ListingBodyStream(PendingListing scan, const std::string& boundUrl, const Page& page);
+
+    // sort, order, page and limit query parameters
+    static Page parsePage(const std::map<std::string, std::string>& params);
+
+    size_t remaining() const override;
+
+    ssize_t read(uint8_t* dst, size_t maxLen) override;
+
+    void wait() override { scan.wait(); }
+
+    void skip(size_t len) override {}
+
+private:
+    PendingListing scan;
+    std::shared_ptr<const DirectoryListing> listing; // null until the scan is done
+    std::string boundUrl;
+    Page page;
+    size_t next; // position in sort order of the next row to render
+    size_t end;
+    bool footerDone;
+
+    std::string buffer;
+    size_t bufferOffset;
+
+    void start();
+    size_t entryAt(size_t position) const;
+    void renderRow(const DirectoryListing::Entry& entry);
+    void renderFooter();
+    std::string pageLink(size_t pageNumber) const;
+};
@@ -0,0 +1,236 @@
+#include "encodingCache.h"
+#include "util.cpp"
+#include "Utils/Metrics/metrics.h"
+#include <sys/stat.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+const std::vector<std::string> EncodingCache::supported = {"br", "gzip"};
+
+static const Counter hits("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"encoding\",result=\"hit\"");
+static const Counter misses("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"encoding\",result=\"miss\"");
+
+std::vector<std::string> EncodingCache::acceptedEncodings(const std::string& acceptEncoding) {
+    std::map<std::string, double> weights;
+    size_t start = 0;
+    while (start < acceptEncoding.length()) {
+        size_t end = acceptEncoding.find(',', start);
+        if (end == std::string::npos) end = acceptEncoding.length();
+        std::string token = acceptEncoding.substr(start, end - start);
+        start = end + 1;
+
+        double q = 1.0;
+        size_t semi = token.find(';');
+        if (semi != std::string::npos) {
+            std::string param = Util::strip(token.substr(semi + 1));
+            if (param.compare(0, 2, "q=") == 0) q = std::atof(param.c_str() + 2);
+            token = token.substr(0, semi);
+        }
+        weights[Util::toLower(Util::strip(token))] = q;
+    }
+
+    std::vector<std::pair<double, std::string>> ranked;
+    for (const auto& encoding : supported) {
+        auto it = weights.find(encoding);
+        if (it == weights.end()) it = weights.find("*");
+        if (it != weights.end() && it->second > 0) ranked.push_back({it->second, encoding});
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    std::vector<std::string> accepted;
+    for (const auto& [q, encoding] : ranked) accepted.push_back(encoding);
+    return accepted;
+}
+
+bool EncodingCache::compress(const std::string& encoding, const std::vector<u_int8_t>& input,
+                             std::vector<u_int8_t>& output, bool best) {
+    if (encoding == "br") {
+        size_t outSize = BrotliEncoderMaxCompressedSize(input.size());
+        if (outSize == 0) return false;
+        output.resize(outSize);
+        if (!BrotliEncoderCompress(best ? BROTLI_MAX_QUALITY : FAST_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                   input.size(), input.data(), &outSize, output.data())) {
+            return false;
+        }
+        output.resize(outSize);
+        return true;
+    }
+
+    if (encoding == "gzip") {
+        z_stream zs{};
+        if (deflateInit2(&zs, best ? Z_BEST_COMPRESSION : FAST_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 9,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        output.resize(deflateBound(&zs, input.size()));
+        zs.next_in = const_cast<Bytef*>(input.data());
+        zs.avail_in = input.size();
+        zs.next_out = output.data();
+        zs.avail_out = output.size();
+        int ret = deflate(&zs, Z_FINISH);
+        output.resize(zs.total_out);
+        deflateEnd(&zs);
+        return ret == Z_STREAM_END;
+    }
+
+    return false;
+}
+
+EncodingCache::Entry& EncodingCache::touch(const std::string& path) {
+    auto [it, created] = entries.try_emplace(path);
+    if (created) {
+        recent.push_front(path);
+    } else {
+        recent.splice(recent.begin(), recent, it->second.recent);
+    }
+    it->second.recent = recent.begin();
+    return it->second;
+}
+
+void EncodingCache::dropVariants(Entry& entry) {
+    memory -= entry.memory;
+    entry.memory = 0;
+    entry.variants.clear();
+}
+
+void EncodingCache::evict() {
+    while (memory > ENCODING_CACHE_MAX_BYTES && !recent.empty()) {
+        auto it = entries.find(recent.back());
+        LOG_DEBUG("Evicting compressed variants of " + it->first);
+        // a job still compressing the file finds no entry and drops its result
+        dropVariants(it->second);
+        entries.erase(it);
+        recent.pop_back();
+    }
+}
+
+void EncodingCache::scan(const ResponseData& content, Entry& entry) {
+    entry.mtimeNs = content.mtimeNs;
+    entry.size = content.fileSize;
+    dropVariants(entry);
+
+    std::vector<std::string> missing;
+    for (const auto& encoding : supported) {
+        std::string sibling = content.filePath + (encoding == "gzip" ? ".gz" : ".br");
+        struct stat st;
+        if (stat(sibling.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec >= content.mtimeNs) {
+            Variant variant;
+            variant.path = sibling;
+            variant.size = st.st_size;
+            entry.variants[encoding] = variant;
+        } else {
+            missing.push_back(encoding);
+        }
+    }
+
+    if (missing.empty() || entry.pending || content.fileSize > MAX_COMPRESS_SIZE) return;
+
+    entry.pending = true;
+    std::string path = content.filePath;
+    int64_t mtimeNs = content.mtimeNs;
+    compressor.enqueue(0, [this, path, mtimeNs, missing]() {
+        generate(path, mtimeNs, missing, false);
+    });
+}
+
+void EncodingCache::generate(const std::string& path, int64_t mtimeNs, const std::vector<std::string>& encodings,
+                             bool best) {
+    ResponseData original;
+    bool ok = original.readFromFile(path);
+
+    std::map<std::string, Variant> generated;
+    for (const auto& encoding : ok ? encodings : std::vector<std::string>{}) {
+        auto output = std::make_shared<std::vector<u_int8_t>>();
+        if (!compress(encoding, original.data, *output, best)) {
+            LOG_ERROR("Failed to compress " + path + " with " + encoding);
+            continue;
+        }
+        if (output->size() >= original.data.size()) continue;
+
+        LOG_INFO("Compressed " + path + " with " + encoding + (best ? " at the best level" : "") + ": " +
+                     std::to_string(original.data.size()) + " -> " + std::to_string(output->size()));
+        Variant variant;
+        variant.size = output->size();
+        variant.data = std::move(output);
+        generated[encoding] = std::move(variant);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end()) return; // evicted while we were compressing it
+    Entry& entry = it->second;
+    if (!best) entry.pending = false;
+    if (entry.mtimeNs != mtimeNs) return; // the file changed while we were compressing it
+
+    std::vector<std::string> improvable;
+    for (auto& [encoding, variant] : generated) {
+        auto current = entry.variants.find(encoding);
+        if (current != entry.variants.end()) {
+            if (!current->second.data || current->second.size <= variant.size) continue;
+            entry.memory -= current->second.size;
+            memory -= current->second.size;
+        }
+        entry.memory += variant.size;
+        memory += variant.size;
+        entry.variants[encoding] = std::move(variant);
+        improvable.push_back(encoding);
+    }
+    evict();
+
+    // the best level runs behind every fast pass, it only shaves off the last few percent
+    if (!best && !improvable.empty()) {
+        compressor.enqueue(-1, [this, path, mtimeNs, improvable]() {
+            generate(path, mtimeNs, improvable, true);
+        });
+    }
+}
+
+void EncodingCache::prepare(const std::string& path) {
+    ResponseData content = ResponseData::fromPath(path);
+    if (!content.isFile() || !ResponseData::isCompressible(content.mimeType)) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = touch(content.filePath);
+    if (entry.mtimeNs != content.mtimeNs || entry.size != content.fileSize) {
+        scan(content, entry);
+    }
+}
+
+bool EncodingCache::apply(ResponseData& content, const std::string& acceptEncoding) {
+    if (!content.isFile() || !ResponseData::isCompressible(content.mimeType)) return false;
+
+    std::vector<std::string> accepted = acceptedEncodings(acceptEncoding);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Entry& entry = touch(content.filePath);
+    if (entry.mtimeNs != content.mtimeNs || entry.size != content.fileSize) {
+        scan(content, entry);
+    }
+
+    for (const auto& encoding : accepted) {
+        auto it = entry.variants.find(encoding);
+        if (it == entry.variants.end()) continue;
+
+        const Variant& variant = it->second;
+        if (variant.data) {
+            content.sharedData = variant.data;
+        } else {
+            content.filePath = variant.path;
+            content.fileSize = variant.size;
+        }
+        content.contentEncoding = encoding;
+        if (!content.etag.empty()) {
+            // each encoding is its own representation and needs its own strong tag
+            content.etag.insert(content.etag.size() - 1, "-" + encoding);
+        }
+        hits.add();
+        return true;
+    }
+
+    // no accepted variant is ready, the identity body goes out instead
+    if (!accepted.empty()) misses.add();
+    return false;
+}
@@ -0,0 +1,75 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include "Response/responseData.h"
+#include "Multithreading/threadPool.h"
+
+#pragma once
+
+#define MAX_COMPRESS_SIZE (16 * 1024 * 1024)
+#define ENCODING_CACHE_MAX_BYTES (64 * 1024 * 1024) // generated variants kept in memory, over all files
+#define FAST_BROTLI_QUALITY 5                       // first pass, so a variant is ready within milliseconds
+#define FAST_GZIP_LEVEL 6
+
+// Compressed variants of served files. A .br or .gz file next to the original is
+// used as is. Missing variants are generated on a background thread, first at a fast
+// level and then again at the best level once nothing else is queued. Generated
+// variants stay in memory until the original changes or, past ENCODING_CACHE_MAX_BYTES,
+// until they are the least recently served.
+class EncodingCache {
+private:
+    struct Variant {
+        std::string path; // sibling file, empty when generated in memory
+        size_t size = 0;
+        std::shared_ptr<const std::vector<u_int8_t>> data;
+    };
+
+    struct Entry {
+        int64_t mtimeNs = -1;
+        size_t size = 0;
+        bool pending = false;
+        std::map<std::string, Variant> variants; // keyed by content-encoding
+        size_t memory = 0; // bytes of the variants generated in memory
+        std::list<std::string>::iterator recent;
+    };
+
+    std::map<std::string, Entry> entries;
+    std::list<std::string> recent; // paths of the entries, most recently served first
+    size_t memory = 0;
+    std::mutex mutex;
+    ThreadPool compressor; // declared last so queued jobs finish before the entries go away
+
+    void scan(const ResponseData& content, Entry& entry);
+
+    void generate(const std::string& path, int64_t mtimeNs, const std::vector<std::string>& encodings, bool best);
+
+    // finds or creates the entry for path and marks it most recently used
+    Entry& touch(const std::string& path);
+
+    void dropVariants(Entry& entry);
+
+    // drops the least recently served entries until the generated variants fit the budget
+    void evict();
+
+public:
+    // encodings we can produce, in order of preference
+    static const std::vector<std::string> supported;
+
+    EncodingCache() : compressor(1) {}
+
+    // supported encodings the client accepts, best first
+    static std::vector<std::string> acceptedEncodings(const std::string& acceptEncoding);
+
+    // best trades a lot of CPU time for a few percent, only for variants generated ahead of time
+    static bool compress(const std::string& encoding, const std::vector<u_int8_t>& input,
+                         std::vector<u_int8_t>& output, bool best);
+
+    // makes sure the variants of a file are looked up or queued for generation
+    void prepare(const std::string& path);
+
+    // swaps the body of a file response for its best accepted variant, if one is ready
+    bool apply(ResponseData& content, const std::string& acceptEncoding);
+};
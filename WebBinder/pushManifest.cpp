@@ -0,0 +1,114 @@
+#include "pushManifest.h"
+#include "Utils/Logger/logger.h"
+#include "util.cpp"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+void PushManifest::add(const std::string& route, const std::string& asset) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string>& list = assets[route];
+    if (asset == route || std::find(list.begin(), list.end(), asset) != list.end()) return;
+    if (list.size() >= MAX_PUSHES_PER_RESPONSE) {
+        LOG_WARNING("Too many pushed assets for route: " + route + ", ignoring " + asset);
+        return;
+    }
+    list.push_back(asset);
+}
+
+bool PushManifest::load(const std::string& manifestPath) {
+    std::ifstream file(manifestPath);
+    if (!file) {
+        LOG_ERROR("Failed to open push manifest: " + manifestPath);
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        line = Util::strip(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+
+        std::istringstream words(line);
+        std::string route, asset;
+        words >> route;
+        while (words >> asset) {
+            add(route, asset);
+        }
+    }
+
+    LOG_INFO("Loaded push manifest: " + manifestPath);
+    return true;
+}
+
+std::string PushManifest::resolve(const std::string& route, const std::string& ref) {
+    std::string url = ref.substr(0, ref.find('#'));
+    if (url.empty() || url.compare(0, 2, "//") == 0 || url.find(':') != std::string::npos) {
+        return ""; // other origins and data: urls cannot be pushed
+    }
+    if (url[0] == '/') return url;
+    return route.substr(0, route.rfind('/') + 1) + url;
+}
+
+// value of attr inside the tag starting at lower[start], empty if it has none
+static std::string attribute(const std::string& html, const std::string& lower, size_t start, size_t end,
+                             const std::string& attr) {
+    size_t at = lower.find(" " + attr + "=", start);
+    if (at == std::string::npos || at > end) return "";
+    at += attr.length() + 2;
+
+    char quote = html[at];
+    if (quote == '"' || quote == '\'') {
+        size_t close = html.find(quote, at + 1);
+        if (close == std::string::npos || close > end) return "";
+        return html.substr(at + 1, close - at - 1);
+    }
+    size_t close = html.find_first_of(" \t\r\n>", at);
+    return html.substr(at, std::min(close, end) - at);
+}
+
+void PushManifest::scanHtml(const std::string& route, const std::string& htmlPath) {
+    std::ifstream file(htmlPath);
+    if (!file) return;
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string html = ss.str();
+    std::string lower = Util::toLower(html);
+
+    size_t found = 0;
+    for (size_t pos = lower.find('<'); pos != std::string::npos; pos = lower.find('<', pos + 1)) {
+        size_t end = lower.find('>', pos);
+        if (end == std::string::npos) break;
+
+        std::string ref;
+        if (lower.compare(pos, 5, "<link") == 0) {
+            std::string rel = Util::toLower(attribute(html, lower, pos, end, "rel"));
+            if (rel == "stylesheet" || rel == "preload" || rel == "modulepreload") {
+                ref = attribute(html, lower, pos, end, "href");
+            }
+        } else if (lower.compare(pos, 7, "<script") == 0 || lower.compare(pos, 4, "<img") == 0) {
+            ref = attribute(html, lower, pos, end, "src");
+        }
+
+        std::string url = resolve(route, ref);
+        if (!url.empty()) {
+            add(route, url);
+            found++;
+        }
+    }
+
+    if (found > 0) {
+        LOG_INFO("Found " + std::to_string(found) + " pushable assets in " + htmlPath);
+    } else {
+        LOG_INFO("No same-origin assets in " + htmlPath + ", nothing is pushed with " + route +
+                 " unless the push manifest lists it");
+    }
+}
+
+std::vector<std::string> PushManifest::assetsFor(const std::string& route) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = assets.find(route);
+    if (it == assets.end() && route.length() > 1 && route.back() == '/') {
+        it = assets.find(route.substr(0, route.length() - 1));
+    }
+    return it == assets.end() ? std::vector<std::string>{} : it->second;
+}
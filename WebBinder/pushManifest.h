@@ -0,0 +1,28 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+#pragma once
+
+#define MAX_PUSHES_PER_RESPONSE 8
+
+// Subresources that a page will request as soon as it is parsed, by route. They
+// come from a manifest file ("route asset asset ..." per line) or from scanning
+// the bound HTML files for same-origin stylesheets, scripts and images.
+class PushManifest {
+private:
+    std::map<std::string, std::vector<std::string>> assets;
+    mutable std::mutex mutex;
+
+    static std::string resolve(const std::string& route, const std::string& ref);
+
+public:
+    void add(const std::string& route, const std::string& asset);
+
+    bool load(const std::string& manifestPath);
+
+    void scanHtml(const std::string& route, const std::string& htmlPath);
+
+    std::vector<std::string> assetsFor(const std::string& route) const;
+};
@@ -0,0 +1,88 @@
+#include "router.h"
+#include <algorithm>
+
+Router::Router(std::vector<Route> routes) : routes(std::move(routes)) {
+    for (size_t i = 0; i < this->routes.size(); ++i) {
+        insert(this->routes[i].url, i);
+    }
+}
+
+Router::Node* Router::findChild(const Node& node, char c) {
+    auto it = std::lower_bound(node.children.begin(), node.children.end(), c,
+                               [](const std::unique_ptr<Node>& child, char c) { return child->label[0] < c; });
+    if (it == node.children.end() || (*it)->label[0] != c) return nullptr;
+    return it->get();
+}
+
+void Router::insert(const std::string& url, int route) {
+    Node* node = &root;
+    size_t pos = 0;
+
+    while (pos < url.length()) {
+        Node* child = findChild(*node, url[pos]);
+        if (!child) {
+            auto leaf = std::make_unique<Node>();
+            leaf->label = url.substr(pos);
+            leaf->route = route;
+            auto it = std::lower_bound(node->children.begin(), node->children.end(), url[pos],
+                                       [](const std::unique_ptr<Node>& n, char c) { return n->label[0] < c; });
+            node->children.insert(it, std::move(leaf));
+            return;
+        }
+
+        size_t common = 0;
+        while (common < child->label.length() && pos + common < url.length() &&
+               child->label[common] == url[pos + common]) {
+            common++;
+        }
+
+        if (common < child->label.length()) {
+            // split the edge, the existing child moves below the shared prefix
+            auto tail = std::make_unique<Node>();
+            tail->label = child->label.substr(common);
+            tail->route = child->route;
+            tail->children = std::move(child->children);
+
+            child->label.resize(common);
+            child->route = -1;
+            child->children.clear();
+            child->children.push_back(std::move(tail));
+        }
+
+        node = child;
+        pos += common;
+    }
+
+    node->route = route;
+}
+
+Router::Match Router::match(const std::string& url) const {
+    Match best;
+    const Node* node = &root;
+    size_t pos = 0;
+
+    while (true) {
+        if (node->route >= 0) {
+            const Route& route = routes[node->route];
+            if (pos == url.length()) {
+                best.route = &route;
+                best.exact = true;
+                return best;
+            }
+            // "/html" covers "/html/a" but not "/htmlfoo"
+            if (route.kind == DIRECTORY_ROUTE && (url[pos] == '/' || (pos > 0 && url[pos - 1] == '/'))) {
+                best.route = &route;
+            }
+        }
+
+        if (pos == url.length()) break;
+
+        const Node* child = findChild(*node, url[pos]);
+        if (!child || url.compare(pos, child->label.length(), child->label) != 0) break;
+
+        node = child;
+        pos += child->label.length();
+    }
+
+    return best;
+}
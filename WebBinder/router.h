@@ -0,0 +1,50 @@
+#include <string>
+#include <vector>
+#include <memory>
+
+#pragma once
+
+struct RouteHandler; // defined by whoever binds handler routes, the trie only carries it
+// Compressed radix trie over the bound URLs. Built once from the bindings and never
+// modified afterwards, so any number of threads can match against it without locking.
+// A lookup walks the URL once and returns the longest matching binding.
+class Router {
+public:
+    enum Kind {
+        FILE_ROUTE,      // matches its URL exactly
+        DIRECTORY_ROUTE, // matches its URL and everything below it
+        HANDLER_ROUTE    // matches its URL exactly, the response is generated in process
+    };
+
+    struct Route {
+        std::string url;
+        std::string path;
+        Kind kind;
+        std::shared_ptr<const RouteHandler> handler = nullptr; // HANDLER_ROUTE only
+    };
+
+    struct Match {
+        const Route* route = nullptr;
+        bool exact = false; // the URL is the bound URL itself, not a path below it
+    };
+
+    Router(std::vector<Route> routes);
+
+    Match match(const std::string& url) const;
+
+    size_t size() const { return routes.size(); }
+
+private:
+    struct Node {
+        std::string label; // edge from the parent
+        int route = -1;    // index into routes, -1 for inner nodes
+        std::vector<std::unique_ptr<Node>> children; // sorted by the first byte of their label
+    };
+
+    std::vector<Route> routes;
+    Node root;
+
+    void insert(const std::string& url, int route);
+
+    static Node* findChild(const Node& node, char c);
+};
@@ -0,0 +1,191 @@
+#include "statCache.h"
+#include "Utils/Logger/logger.h"
+#include "Utils/Metrics/metrics.h"
+#include <filesystem>
+#include <chrono>
+#include <climits>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static const Counter hits("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"stat\",result=\"hit\"");
+static const Counter misses("http2_cache_lookups_total", "Cache lookups by cache and result", "cache=\"stat\",result=\"miss\"");
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string parentOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    if (slash == 0) return "/";
+    return path.substr(0, slash);
+}
+
+StatCache::StatCache() : inotifyFd(-1), stopFd(-1) {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd = eventfd(0, EFD_CLOEXEC);
+    if (inotifyFd < 0 || stopFd < 0) {
+        LOG_WARNING("inotify unavailable, stat cache entries expire after a TTL, errno: " + std::to_string(errno));
+        return;
+    }
+    watcher = std::thread(&StatCache::readEvents, this);
+}
+
+StatCache::~StatCache() {
+    if (watcher.joinable()) {
+        uint64_t one = 1;
+        if (write(stopFd, &one, sizeof(one)) < 0) {
+            LOG_ERROR("Failed to stop the stat cache watcher, errno: " + std::to_string(errno));
+        }
+        watcher.join();
+    }
+    if (inotifyFd >= 0) close(inotifyFd);
+    if (stopFd >= 0) close(stopFd);
+}
+
+std::string StatCache::normalize(const std::string& path) {
+    std::string normal = std::filesystem::path(path).lexically_normal().string();
+    if (normal.length() > 1 && normal.back() == '/') normal.pop_back();
+    return normal.empty() ? "." : normal;
+}
+
+FileInfo StatCache::lookup(const std::string& rawPath) {
+    std::string path = normalize(rawPath);
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = entries.find(path);
+        if (it != entries.end() && (it->second.expiresNs == INT64_MAX || it->second.expiresNs > nowNs())) {
+            hits.add();
+            return it->second.info;
+        }
+    }
+    misses.add();
+
+    // An event for a change between the stat and the insert below can be handled before
+    // the entry exists, so erasing it would be a no-op. The directory's version is taken
+    // before the stat instead, and a result it may not reflect is only kept for the TTL.
+    std::string dir = parentOf(path);
+    int wd = watch(dir);
+    uint64_t seen = 0;
+    if (wd >= 0) {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = versions.find(dir);
+        if (it != versions.end()) seen = it->second;
+    }
+
+    FileInfo info;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        info.type = S_ISREG(st.st_mode) ? FileInfo::REGULAR :
+                    S_ISDIR(st.st_mode) ? FileInfo::DIRECTORY : FileInfo::OTHER;
+        info.size = st.st_size;
+        info.mtimeNs = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        info.inode = st.st_ino;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (entries.size() >= STAT_CACHE_MAX_ENTRIES) {
+        LOG_WARNING("Stat cache full, dropping " + std::to_string(entries.size()) + " entries");
+        entries.clear();
+    }
+    auto it = versions.find(dir);
+    bool unchanged = wd >= 0 && it != versions.end() && it->second == seen;
+    entries[path] = {info, unchanged ? INT64_MAX : nowNs() + STAT_CACHE_TTL_NS};
+    return info;
+}
+
+uint64_t StatCache::version(const std::string& rawDir) {
+    std::string dir = normalize(rawDir);
+    if (watch(dir) < 0) {
+        return (uint64_t) (nowNs() / STAT_CACHE_TTL_NS) | (1ULL << 63);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = versions.find(dir);
+    return it == versions.end() ? 0 : it->second;
+}
+
+int StatCache::watch(const std::string& dir) {
+    if (inotifyFd < 0) return -1;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = watches.find(dir);
+        if (it != watches.end()) return it->second;
+    }
+
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0) {
+        // missing directories and exhausted watch limits are both served from the TTL
+        if (errno != ENOENT && errno != ENOTDIR) {
+            LOG_WARNING("Failed to watch directory: " + dir + ", errno: " + std::to_string(errno));
+        }
+        return -1;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (watches.emplace(dir, wd).second) {
+        watchedDirs[wd].push_back(dir);
+        // present from the start, so a queue overflow bumps it like any other
+        versions.emplace(dir, 0);
+    }
+    return wd;
+}
+
+void StatCache::invalidate(const std::string& path) {
+    entries.erase(path);
+}
+
+void StatCache::readEvents() {
+    alignas(struct inotify_event) char buf[16 * 1024];
+    struct pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("Stat cache watcher failed to poll, errno: " + std::to_string(errno));
+            break;
+        }
+        if (fds[1].revents) break;
+
+        ssize_t len = read(inotifyFd, buf, sizeof(buf));
+        if (len <= 0) continue;
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (char* p = buf; p < buf + len; ) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // events were lost or a whole directory went away, start over
+                entries.clear();
+                for (auto& [dir, version] : versions) version++;
+                if (event->mask & IN_IGNORED) {
+                    for (const auto& dir : watchedDirs[event->wd]) watches.erase(dir);
+                    watchedDirs.erase(event->wd);
+                }
+                continue;
+            }
+
+            auto it = watchedDirs.find(event->wd);
+            if (it == watchedDirs.end()) continue;
+            for (const auto& dir : it->second) {
+                versions[dir]++;
+                invalidate(dir);
+                if (event->len > 0) {
+                    std::string name = event->name;
+                    invalidate(dir == "." ? name : dir == "/" ? "/" + name : dir + "/" + name);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <cstdint>
+#include <sys/types.h>
+
+#pragma once
+
+#define STAT_CACHE_TTL_NS 1000000000LL // for paths whose directory could not be watched
+#define STAT_CACHE_MAX_ENTRIES 65536   // bounds the memory a scan for random paths can take
+
+struct FileInfo {
+    enum Type {
+        MISSING, // negative entry, the path did not exist
+        REGULAR,
+        DIRECTORY,
+        OTHER
+    };
+
+    Type type = MISSING;
+    size_t size = 0;
+    int64_t mtimeNs = 0;
+    ino_t inode = 0;
+};
+
+// Caches stat() results for the paths requests resolve to, including paths that do
+// not exist. Entries are dropped when inotify reports a change in their directory, so
+// resolving a request takes no syscalls once its path has been seen. Paths in
+// directories that cannot be watched fall back to a short TTL.
+class StatCache {
+private:
+    struct Entry {
+        FileInfo info;
+        int64_t expiresNs; // INT64_MAX while the directory is watched
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::map<int, std::vector<std::string>> watchedDirs; // inotify watch -> directories it covers
+    std::unordered_map<std::string, int> watches;
+    std::unordered_map<std::string, uint64_t> versions; // bumped on every change in a watched directory
+    std::shared_mutex mutex;
+
+    int inotifyFd;
+    int stopFd;
+    std::thread watcher;
+
+    int watch(const std::string& dir);
+    void readEvents();
+    void invalidate(const std::string& path);
+
+public:
+    StatCache();
+    ~StatCache();
+
+    StatCache(const StatCache&) = delete;
+    StatCache& operator=(const StatCache&) = delete;
+
+    FileInfo lookup(const std::string& path);
+
+    // changes whenever the contents of dir change, so data derived from it can be cached
+    // until then; for directories that cannot be watched it changes every TTL instead
+    uint64_t version(const std::string& dir);
+
+    // "./html//a.png" and "html/a.png" share one entry
+    static std::string normalize(const std::string& path);
+};
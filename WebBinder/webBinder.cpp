@@ -1,4 +1,6 @@
 #include "webBinder.h"
+#include "util.cpp"
+#include <algorithm>
 
 namespace fs = std::filesystem;
 
@@ -6,104 +8,209 @@ const ResponseData WebBinder::empty = ResponseData("text/plain", std::vector<u_i
 
 bool WebBinder::bindDirectory(const std::string& dir, const std::string& url) {
     if (!fs::is_directory(dir)) {
-        Logger::error("Failed to bind directory: " + dir + " - Not a valid directory");
+        LOG_ERROR("Failed to bind directory: " + dir + " - Not a valid directory");
         return false;
     }
+    std::lock_guard<std::mutex> lock(routerMutex);
     if (dirBindings.find(url) != dirBindings.end()) {
-        Logger::warning("Directory already bound to URL: " + url + ", replacing with new directory: " + dir);
+        LOG_WARNING("Directory already bound to URL: " + url + ", replacing with new directory: " + dir);
     }
     if(fileBindings.find(url) != fileBindings.end()) {
-        Logger::warning("File already bound to URL: " + url + ", removing existing binding");
+        LOG_WARNING("File already bound to URL: " + url + ", removing existing binding");
         fileBindings.erase(url);
     }
     dirBindings[url] = dir;
+    router.store(nullptr, std::memory_order_release);
     return true;
 }
 
 void WebBinder::bindFile(const std::string& file, const std::string& url) {
     if (!fs::is_regular_file(file)) {
-        Logger::error("Failed to bind file: " + file + " - Not a valid file");
+        LOG_ERROR("Failed to bind file: " + file + " - Not a valid file");
         return;
     }
+    std::lock_guard<std::mutex> lock(routerMutex);
     if (fileBindings.find(url) != fileBindings.end()) {
-        Logger::warning("File already bound to URL: " + url + ", replacing with new file: " + file);
+        LOG_WARNING("File already bound to URL: " + url + ", replacing with new file: " + file);
     }
     if(dirBindings.find(url) != dirBindings.end()) {
-        Logger::warning("Directory already bound to URL: " + url + ", removing existing binding");
+        LOG_WARNING("Directory already bound to URL: " + url + ", removing existing binding");
         dirBindings.erase(url);
     }
     fileBindings[url] = file;
+    router.store(nullptr, std::memory_order_release);
+    encodings.prepare(file);
+    if (ResponseData::getMimeType(file) == "text/html") {
+        pushes.scanHtml(url, file);
+    }
 }
 
-ResponseData WebBinder::getFileContent(const std::string& file) {
-    if (!std::filesystem::is_regular_file(file)) {
-        Logger::error("Failed to get content: " + file + " - Not a valid file");
-        return empty;
+void WebBinder::bindHandler(const std::string& url,
+                            std::function<ResponseData(const std::map<std::string, std::string>&)> generate) {
+    std::lock_guard<std::mutex> lock(routerMutex);
+    if (handlerBindings.find(url) != handlerBindings.end()) {
+        LOG_WARNING("Handler already bound to URL: " + url + ", replacing it");
+    }
+    if (fileBindings.erase(url) || dirBindings.erase(url)) {
+        LOG_WARNING("URL " + url + " is reserved for a handler, removing existing binding");
+    }
+    handlerBindings[url] = std::make_shared<const RouteHandler>(RouteHandler{std::move(generate)});
+    router.store(nullptr, std::memory_order_release);
+}
+
+bool WebBinder::loadPushManifest(const std::string& manifestPath) {
+    return pushes.load(manifestPath);
+}
+
+std::vector<std::string> WebBinder::pushAssets(const std::string& url) {
+    return pushes.assetsFor(url.substr(0, url.find('?')));
+}
+
+std::string WebBinder::pushDigest(const std::string& url) {
+    std::string route = url.substr(0, url.find('?'));
+    {
+        std::lock_guard<std::mutex> lock(pushDigestMutex);
+        auto it = pushDigests.find(route);
+        if (it != pushDigests.end() &&
+            std::all_of(it->second.dirs.begin(), it->second.dirs.end(), [this](const auto& dir) {
+                return stats.version(dir.first) == dir.second;
+            })) {
+            return it->second.digest;
+        }
     }
 
-    std::ifstream inFile(file);
-    if (!inFile) {
-        Logger::error("Failed to open file: " + file);
+    // the versions are taken before the ETags, a change in between is seen on the next request;
+    // assets that are not files have no directory to watch and keep the digest from being cached
+    std::vector<std::string> assets = pushes.assetsFor(route);
+    PushDigest entry;
+    bool cacheable = true;
+    for (const auto& asset : assets) {
+        ResponseData content = getContent(asset);
+        if (!content.isFile()) {
+            cacheable = false;
+            continue;
+        }
+        std::string dir = fs::path(content.filePath).parent_path().string();
+        bool seen = std::any_of(entry.dirs.begin(), entry.dirs.end(), [&dir](const auto& d) { return d.first == dir; });
+        if (!seen) entry.dirs.push_back({dir, 0});
+    }
+    for (auto& [dir, version] : entry.dirs) {
+        version = stats.version(dir);
+    }
+
+    std::string versions;
+    for (const auto& asset : assets) {
+        versions += asset + getContent(asset).etag;
+    }
+    char token[32];
+    snprintf(token, sizeof(token), "%016zx", std::hash<std::string>{}(versions));
+    entry.digest = token;
+
+    if (cacheable) {
+        std::lock_guard<std::mutex> lock(pushDigestMutex);
+        pushDigests[route] = entry;
+    }
+    return entry.digest;
+}
+
+ResponseData WebBinder::getFileContent(const std::string& file) {
+    FileInfo info = stats.lookup(file);
+    if (info.type != FileInfo::REGULAR) {
+        LOG_ERROR("Failed to get content: " + file + " - Not a valid file");
         return empty;
     }
-    
-    return ResponseData::fromPath(file);
+
+    ResponseData resp;
+    resp.mimeType = ResponseData::getMimeType(file);
+    resp.setFile(file, info.size, info.mtimeNs, info.inode);
+    return resp;
 }
 
-ResponseData WebBinder::getDirectoryContent(const std::string& dir, std::string boundUrl) {
-    if (!std::filesystem::is_directory(dir)) {
-        Logger::error("Failed to get directory content: " + dir + " - Not a valid directory");
+ResponseData WebBinder::getDirectoryContent(const std::string& dir, std::string boundUrl,
+                                            const std::map<std::string, std::string>& params) {
+    if (stats.lookup(dir).type != FileInfo::DIRECTORY) {
+        LOG_ERROR("Failed to get directory content: " + dir + " - Not a valid directory");
         return empty;
     }
 
     if(boundUrl.back() != '/') boundUrl += '/';
 
-    std::string document = "<html><body><h1>Index for " + dir + "</h1><ul>";
-    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
-        if (entry.is_directory()) {
-            document += "<li><img src=\"/html/folder.png\" alt=\"Folder Icon\" style=\"width:16px;height:16px;\"> ";
-            document += "<a href=\"" + boundUrl + entry.path().filename().string() + "/\">" + entry.path().filename().string() + "/</a></li>";
-        } else if (entry.is_regular_file()) {
-            document += "<li><img src=\"/html/file.png\" alt=\"File Icon\" style=\"width:16px;height:16px;\"> ";
-            document += "<a href=\"" + boundUrl + entry.path().filename().string() + "\">" + entry.path().filename().string() + "</a></li>";
-        }
+    PendingListing listing = listings.get(dir, stats);
+    ListingBodyStream::Page page = ListingBodyStream::parsePage(params);
+
+    ResponseData resp;
+    resp.mimeType = "text/html";
+    resp.generator = [listing, boundUrl, page]() {
+        return std::make_unique<ListingBodyStream>(listing, boundUrl, page);
+    };
+    return resp;
+}
+
+const Router* WebBinder::routes() {
+    const Router* current = router.load(std::memory_order_acquire);
+    if (current) return current;
+
+    std::lock_guard<std::mutex> lock(routerMutex);
+    current = router.load(std::memory_order_relaxed);
+    if (current) return current;
+
+    std::vector<Router::Route> bindings;
+    for (const auto& [url, dir] : dirBindings) {
+        bindings.push_back({url, dir, Router::DIRECTORY_ROUTE});
+    }
+    for (const auto& [url, file] : fileBindings) {
+        bindings.push_back({url, file, Router::FILE_ROUTE});
+    }
+    for (const auto& [url, handler] : handlerBindings) {
+        bindings.push_back({url, "", Router::HANDLER_ROUTE, handler});
     }
 
-    document += "</ul></body></html>";
-    return ResponseData(
-        "text/html",
-        std::vector<u_int8_t>(document.begin(), document.end())
-    );
+    routers.push_back(std::make_unique<const Router>(std::move(bindings)));
+    current = routers.back().get();
+    router.store(current, std::memory_order_release);
+    LOG_DEBUG("Built router with " + std::to_string(current->size()) + " bindings");
+    return current;
 }
 
-ResponseData WebBinder::getContent(const std::string& url) {
-    if(dirBindings.find(url) != dirBindings.end()) {
-        return getDirectoryContent(dirBindings[url], url);
-    } else if(fileBindings.find(url) != fileBindings.end()) {
-        return getFileContent(fileBindings[url]);
-    } else {
-        bool found = false; std::string newUrl = "";
-        for (const auto& [dirUrl, dirPath] : dirBindings) {
-            if (url.find(dirUrl) == 0) {
-                found = true;
-                newUrl = dirPath + url.substr(dirUrl.length());
-                break;
-            }
-        }
+ResponseData WebBinder::getContent(const std::string& target) {
+    size_t queryAt = target.find('?');
+    // listings percent-encode the names they link to
+    std::string url = Util::percentDecode(target.substr(0, queryAt), false);
+    if (url.find('\0') != std::string::npos || ("/" + url + "/").find("/../") != std::string::npos) {
+        LOG_WARNING("Rejected path outside the bound directories: " + url);
+        return empty;
+    }
+    std::map<std::string, std::string> params;
+    if (queryAt != std::string::npos) {
+        params = Util::parseQueryString(target.substr(queryAt + 1));
+    }
 
-        if(found) {
-            if(fs::is_directory(newUrl)) {
-                return getDirectoryContent(newUrl, url);
-            } else if(fs::is_regular_file(newUrl)) {
-                return getFileContent(newUrl);
-            } else {
-                Logger::error("Path found but not a valid file or directory: " + newUrl);
-                return empty;
-            }
-        } else 
-            Logger::error("No binding found for URL: " + url);
+    Router::Match match = routes()->match(url);
+    if (!match.route) {
+        LOG_ERROR("No binding found for URL: " + url);
         return empty;
     }
+
+    if (match.route->kind == Router::HANDLER_ROUTE) {
+        return match.route->handler->generate(params);
+    }
+    if (match.route->kind == Router::FILE_ROUTE) {
+        return getFileContent(match.route->path);
+    }
+    if (match.exact) {
+        return getDirectoryContent(match.route->path, url, params);
+    }
+
+    std::string newUrl = match.route->path + url.substr(match.route->url.length());
+    FileInfo::Type type = stats.lookup(newUrl).type;
+    if (type == FileInfo::DIRECTORY) {
+        return getDirectoryContent(newUrl, url, params);
+    } else if (type == FileInfo::REGULAR) {
+        return getFileContent(newUrl);
+    }
+
+    LOG_ERROR("Path found but not a valid file or directory: " + newUrl);
+    return empty;
 }
 
 ResponseData WebBinder::getErrorPage(int errorCode) {
@@ -114,4 +221,7 @@ ResponseData WebBinder::getErrorPage(int errorCode) {
         "text/html",
         std::vector<u_int8_t>(content.begin(), content.end())
     );
-}
\ No newline at end of file
+}
+bool WebBinder::applyEncoding(ResponseData& content, const std::string& acceptEncoding) {
+    return encodings.apply(content, acceptEncoding);
+}
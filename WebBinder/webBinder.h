@@ -2,18 +2,53 @@
 #include <vector>
 #include <map>
 #include <fstream>
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include "Utils/Logger/logger.h"
 #include "Response/responseData.h"
 #include "http2/headers/statusCode.h"
+#include "encodingCache.h"
+#include "router.h"
+#include "statCache.h"
+#include "directoryListing.h"
+#include "pushManifest.h"
 
 #pragma once
 
+// Generates the response for a reserved URL, e.g. /metrics, from the request's query parameters.
+struct RouteHandler {
+    std::function<ResponseData(const std::map<std::string, std::string>&)> generate;
+};
+
 class WebBinder {
 private:
     std::map<std::string, std::string> dirBindings;
     std::map<std::string, std::string> fileBindings;
+    std::map<std::string, std::shared_ptr<const RouteHandler>> handlerBindings;
 
     static const ResponseData empty; 
+
+    // built from the bindings on the first lookup after they change, lookups only load the pointer
+    std::atomic<const Router*> router{nullptr};
+    std::vector<std::unique_ptr<const Router>> routers; // every version stays alive while the binder does
+    std::mutex routerMutex;
+
+    const Router* routes();
+
+    EncodingCache encodings;
+    StatCache stats;
+    ListingCache listings;
+    PushManifest pushes;
+
+    // digest of the asset versions pushed with a route, valid while the directories of the
+    // assets keep their StatCache::version
+    struct PushDigest {
+        std::string digest;
+        std::vector<std::pair<std::string, uint64_t>> dirs;
+    };
+    std::map<std::string, PushDigest> pushDigests;
+    std::mutex pushDigestMutex;
 public:
     WebBinder() = default;
 
@@ -21,11 +56,28 @@ public:
 
     void bindFile(const std::string& file, const std::string& url);
 
+    // reserves url for a response generated in process, it wins over any file or directory there
+    void bindHandler(const std::string& url,
+                     std::function<ResponseData(const std::map<std::string, std::string>&)> generate);
+
     ResponseData getContent(const std::string& url); 
     
     ResponseData getFileContent(const std::string& file);
 
-    ResponseData getDirectoryContent(const std::string& dir, std::string boundUrl); 
+    ResponseData getDirectoryContent(const std::string& dir, std::string boundUrl,
+                                     const std::map<std::string, std::string>& params = {}); 
 
     ResponseData getErrorPage(int errorCode = 404);
+
+    bool loadPushManifest(const std::string& manifestPath);
+
+    // assets to push or hint (103 Early Hints) along with the response for url
+    std::vector<std::string> pushAssets(const std::string& url);
+
+    // names the current versions of the pushAssets of url, recomputed only once the stat cache
+    // reports a change where they live
+    std::string pushDigest(const std::string& url);
+
+    // picks a pre-compressed variant of a file response matching the client's accept-encoding
+    bool applyEncoding(ResponseData& content, const std::string& acceptEncoding);
 };
\ No newline at end of file
@@ -3,10 +3,13 @@
 extern const std::map<int, std::string> http2::status::errorMessages = {
     {HTTP2_OK, "OK"},
     {HTTP2_NO_CONTENT, "No Content"},
+    {HTTP2_PARTIAL_CONTENT, "Partial Content"},
+    {HTTP2_NOT_MODIFIED, "Not Modified"},
     {HTTP2_BAD_REQUEST, "Bad Request"},
     {HTTP2_UNAUTHORIZED, "Unauthorized"},
     {HTTP2_FORBIDDEN, "Forbidden"},
     {HTTP2_NOT_FOUND, "Not Found"},
+    {HTTP2_RANGE_NOT_SATISFIABLE, "Range Not Satisfiable"},
     {HTTP2_INTERNAL_SERVER_ERROR, "Internal Server Error"},
     {HTTP2_NOT_IMPLEMENTED, "Not Implemented"},
     {HTTP2_SERVICE_UNAVAILABLE, "Service Unavailable"}
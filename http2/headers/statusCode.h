@@ -5,10 +5,13 @@
 enum Http2StatusCode {
     HTTP2_OK = 200,
     HTTP2_NO_CONTENT = 204,
+    HTTP2_PARTIAL_CONTENT = 206,
+    HTTP2_NOT_MODIFIED = 304,
     HTTP2_BAD_REQUEST = 400,
     HTTP2_UNAUTHORIZED = 401,
     HTTP2_FORBIDDEN = 403,
     HTTP2_NOT_FOUND = 404,
+    HTTP2_RANGE_NOT_SATISFIABLE = 416,
     HTTP2_INTERNAL_SERVER_ERROR = 500,
     HTTP2_NOT_IMPLEMENTED = 501,
     HTTP2_SERVICE_UNAVAILABLE = 503
@@ -29,23 +29,26 @@ std::vector<uint8_t> Frame::encode(bool debug) const { // getFrame (encode it)
   // std::cerr << "DEBUG: " << *this << std::endl;
   uint32_t s = payload_.size();
   if (s > 0x00ffffffUL) abort();
-  std::vector<uint8_t> frame;
+  std::vector<uint8_t> frame(9);
   frame.reserve(9 + s);
-  frame.insert(frame.end(), {
-                             uint8_t(s >> 16),     // Size (hi byte)
-                             uint8_t(s >> 8),      // Size (mid byte)
-                             uint8_t(s),           // Size (lo byte)
-                             type_,                // Type byte
-                             flags_,               // Flags byte
-                             uint8_t(sid_ >> 24),  // Stream ID (hi byte)
-                             uint8_t(sid_ >> 16),  // Stream ID (mid-hi byte)
-                             uint8_t(sid_ >> 8),   // Stream ID (mid-lo byte)
-                             uint8_t(sid_),        // Stream ID (lo byte)
-                            });
+  encodeHeader(frame.data(), s, type_, flags_, sid_);
   frame.insert(frame.end(), payload_.begin(), payload_.end());
   return frame;
 }
 
+void Frame::encodeHeader(uint8_t* out, uint32_t size, uint8_t type,
+                         uint8_t flags, uint32_t stream_id) {
+  out[0] = uint8_t(size >> 16);       // Size (hi byte)
+  out[1] = uint8_t(size >> 8);        // Size (mid byte)
+  out[2] = uint8_t(size);             // Size (lo byte)
+  out[3] = type;                      // Type byte
+  out[4] = flags;                     // Flags byte
+  out[5] = uint8_t(stream_id >> 24);  // Stream ID (hi byte)
+  out[6] = uint8_t(stream_id >> 16);  // Stream ID (mid-hi byte)
+  out[7] = uint8_t(stream_id >> 8);   // Stream ID (mid-lo byte)
+  out[8] = uint8_t(stream_id);        // Stream ID (lo byte)
+}
+
 bool Frame::decode(const uint8_t* p, const uint8_t* q) {
   if(q - p < 9) return false;
 
@@ -96,10 +99,26 @@ std::vector<Frame> Frame::toFrames(const uint8_t* begin, const uint8_t* end) {
   while (curr < end) {
     uint32_t size = (curr[0] << 16) | (curr[1] << 8) | curr[2];
     Frame frame;
-    if (!frame.decode(curr, end)) Logger::warning("Failed to decode frame at position: " + std::to_string(curr - begin));
+    if (!frame.decode(curr, end)) LOG_WARNING("Failed to decode frame at position: " + std::to_string(curr - begin));
+    frames.push_back(std::move(frame));
+    curr += 9 + size;
+  }
+  return frames;
+}
+
+std::vector<Frame> Frame::toFrames(const uint8_t* begin, const uint8_t* end,
+                                   std::size_t& consumed) {
+  std::vector<Frame> frames;
+  const uint8_t* curr = begin;
+  while (static_cast<std::size_t>(end - curr) >= 9) {
+    uint32_t size = (curr[0] << 16) | (curr[1] << 8) | curr[2];
+    if (static_cast<std::size_t>(end - curr) < 9 + size) break;  // rest of the frame has not arrived yet
+    Frame frame;
+    if (!frame.decode(curr, curr + 9 + size)) LOG_WARNING("Failed to decode frame at position: " + std::to_string(curr - begin));
     frames.push_back(std::move(frame));
     curr += 9 + size;
   }
+  consumed = curr - begin;
   return frames;
 }
 
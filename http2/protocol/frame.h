@@ -69,6 +69,16 @@ class Frame final {
 
   static std::vector<Frame> toFrames(const uint8_t* begin, const uint8_t* end); 
 
+  // toFrames decodes only the complete frames in the region and reports how
+  // many bytes were used, so a partially received frame can be kept for later.
+  static std::vector<Frame> toFrames(const uint8_t* begin, const uint8_t* end,
+                                     std::size_t& consumed);
+
+  // encodeHeader writes the 9 byte frame header for a payload of the given
+  // size to out, so payloads can be produced in place behind it.
+  static void encodeHeader(uint8_t* out, uint32_t size, uint8_t type,
+                           uint8_t flags, uint32_t stream_id);
+
   bool isPriority() const { return hasPriority_; }
   uint32_t streamDependency() const { return streamDependency_; }
   bool isExclusive() const { return exclusive_; }
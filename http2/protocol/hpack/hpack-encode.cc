@@ -38,9 +38,6 @@ void Encoder::sensitive_header(std::string name) {
 }
 
 void Encoder::encode(const Header& h, std::vector<uint8_t>& output) {
-  if (h.name.size() >= 127) abort();
-  if (h.value.size() >= 127) abort();
-
   bool is_sensitive = (sensitive_.find(h.name) != sensitive_.end());
   bool is_big = h.size() > 256;
 
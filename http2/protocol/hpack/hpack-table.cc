@@ -7,7 +7,8 @@ namespace protocol {
 namespace hpack {
 
 const std::vector<Header>& static_table() {
-  const auto& table = *new std::vector<Header>{
+  // built once and never freed, it is used until the very end of the process
+  static const auto& table = *new std::vector<Header>{
       {},
       {http2::headers::kAuthority, ""},
       {http2::headers::kMethod, http2::headers::kMethodGET},
@@ -1,28 +1,81 @@
 #include "Client/clientManager.h"
 #include "Networking/Epoller/epoller.h"
 #include "Networking/Socket/socket.h"
+#include "Networking/Socket/certStore.h"
 #include "Utils/Logger/logger.h"
 #include "atomic"
 #include "WebBinder/webBinder.h"
+#include "Utils/Metrics/metrics.h"
+#include "Utils/Tracing/trace.h"
+#include <csignal>
+#include <cstdlib>
+#include <memory>
 
 bool running = true;
 
 int main() {
+    // a peer resetting the connection mid-write must fail that write, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    // reloads the TLS certificates without dropping connections
+    signal(SIGHUP, CertStore::requestReload);
+
     Epoller epoller;
     // ClientManager clientManager;
 
-    Socket socket(8080);
+    // TLS_PORT moves the TLS listener (0 turns it off), H2C_PORT adds a cleartext one for HTTP/2
+    // with prior knowledge behind a load balancer that already terminates TLS
+    const char* tlsPort = std::getenv("TLS_PORT");
+    const char* h2cPort = std::getenv("H2C_PORT");
+    std::vector<std::unique_ptr<Socket>> listeners;
+
+    int port = tlsPort ? std::atoi(tlsPort) : PORT;
+    // TLS_TICKET_KEYS names the ticket key file shared across the fleet, re-read every
+    // TLS_TICKET_ROTATE seconds, TLS_SESSION_CACHE sizes the optional session ID cache
+    const char* ticketKeys = std::getenv("TLS_TICKET_KEYS");
+    const char* ticketRotate = std::getenv("TLS_TICKET_ROTATE");
+    const char* sessionCache = std::getenv("TLS_SESSION_CACHE");
+    // KTLS=1 hands record encryption to the kernel so files go out with sendfile, off by default
+    const char* ktls = std::getenv("KTLS");
+
+    if (port > 0) {
+        listeners.push_back(std::make_unique<Socket>(port));
+        if (ktls && std::atoi(ktls) == 1) {
+            listeners.back()->enableKtls();
+        }
+        listeners.back()->enableSessionResumption(ticketKeys ? ticketKeys : "",
+                                                  ticketRotate ? std::atoi(ticketRotate) : 0,
+                                                  sessionCache ? std::atol(sessionCache) : 0);
+    }
+    if (h2cPort && std::atoi(h2cPort) > 0) {
+        listeners.push_back(std::make_unique<Socket>(std::atoi(h2cPort), false));
+    }
 
     WebBinder webBinder;
 
     webBinder.bindDirectory("./html/", "/html");
     webBinder.bindFile("./html/reallyCoolSite.html", "/");
+    webBinder.loadPushManifest("./push.manifest");
+    // the metrics and trace dumps are served to anyone who can reach a listener, so only on request
+    const char* metrics = std::getenv("METRICS");
+    if (metrics && std::atoi(metrics) == 1) {
+        webBinder.bindHandler("/metrics", [](const std::map<std::string, std::string>&) {
+            std::string text = Metrics::render();
+            return ResponseData("text/plain; version=0.0.4", std::vector<u_int8_t>(text.begin(), text.end()));
+        });
+        webBinder.bindHandler("/trace", [](const std::map<std::string, std::string>&) {
+            std::string json = Trace::render();
+            return ResponseData("application/json", std::vector<u_int8_t>(json.begin(), json.end()));
+        });
+        LOG_WARNING("Serving /metrics and /trace on every listener, keep them behind a firewall");
+    }
 
     epoller.setBinder(webBinder);
 
-    epoller.addFD(socket.sockFD);
+    for (const auto& listener : listeners) {
+        epoller.addFD(listener->sockFD);
+    }
 
     while(running) {
         epoller.epollLoop();
     }
-}
\ No newline at end of file
+}
\ No newline at end of file
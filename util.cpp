@@ -1,5 +1,8 @@
+#pragma once
 #include <string>
 #include <map>
+#include <ctime>
+#include <cctype>
 
 class Util {
 public:
@@ -22,15 +25,16 @@ public:
         return upperStr;
     }
 
-    static std::string percentDecode(const std::string& str) {
+    // plusIsSpace for query strings (form encoding), a '+' in a path is just a '+'
+    static std::string percentDecode(const std::string& str, bool plusIsSpace = true) {
         std::string decoded;
         for (size_t i = 0; i < str.length(); ++i) {
-            if (str[i] == '%' && i + 2 < str.length()) {
-                std::string hex = str.substr(i + 1, 2);
-                char decodedChar = static_cast<char>(std::stoi(hex, nullptr, 16));
-                decoded += decodedChar;
+            // an escape needs two hex digits, anything else (%zz, a trailing %) is kept as is
+            if (str[i] == '%' && i + 2 < str.length() &&
+                isxdigit(static_cast<unsigned char>(str[i + 1])) && isxdigit(static_cast<unsigned char>(str[i + 2]))) {
+                decoded += static_cast<char>(std::stoi(str.substr(i + 1, 2), nullptr, 16));
                 i += 2;
-            } else if (str[i] == '+') {
+            } else if (str[i] == '+' && plusIsSpace) {
                 decoded += ' ';
             } else {
                 decoded += str[i];
@@ -39,6 +43,39 @@ public:
         return decoded;
     }
 
+    // text and attribute values of generated HTML
+    static std::string htmlEscape(const std::string& str) {
+        std::string escaped;
+        escaped.reserve(str.size());
+        for (char c : str) {
+            switch (c) {
+                case '&': escaped += "&amp;"; break;
+                case '<': escaped += "&lt;"; break;
+                case '>': escaped += "&gt;"; break;
+                case '"': escaped += "&quot;"; break;
+                case '\'': escaped += "&#39;"; break;
+                default: escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    // a file name as one path segment of a URL, only unreserved characters stay as they are
+    static std::string percentEncode(const std::string& str) {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string encoded;
+        for (unsigned char c : str) {
+            if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+                encoded += c;
+            } else {
+                encoded += '%';
+                encoded += hex[c >> 4];
+                encoded += hex[c & 0xF];
+            }
+        }
+        return encoded;
+    }
+
     static std::map<std::string, std::string> parseQueryString(const std::string& query) {
         std::map<std::string, std::string> params;
         size_t start = 0;
@@ -58,4 +95,21 @@ public:
         }
         return params;
     }
-};
\ No newline at end of file
+
+    // IMF-fixdate as used by last-modified, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+    static std::string formatHttpDate(time_t t) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char buf[64];
+        strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        return buf;
+    }
+
+    static bool parseHttpDate(const std::string& str, time_t& out) {
+        struct tm tm = {};
+        const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (end == nullptr) return false;
+        out = timegm(&tm);
+        return true;
+    }
+};